@@ -37,8 +37,9 @@ int main() {
   auto texture_stash = make_shared<Stash<Texture>>();
   auto font_stash = make_shared<Stash<Font>>();
 
-  // Declare a basic scene
-  auto deferred_renderer = DeferredRenderer(window.get_size());
+  // Declare a basic scene, the renderer and the gizmo pick from one tree
+  auto world_bounds = make_shared<WorldBounds>();
+  auto deferred_renderer = DeferredRenderer(window.get_size(), world_bounds);
   auto texture_renderer = TextureRenderer();
   auto line_renderer = LineRenderer();
   auto sm_loader = StaticMeshLoader(texture_stash);
@@ -46,7 +47,8 @@ int main() {
   // Declare UI related
   auto imgui = ImguiIntegration(&window, window.get_content_scale());
   auto editor_root =
-      editor::EditorRoot(sm_loader, texture_stash, window.get_size());
+      editor::EditorRoot(sm_loader, texture_stash, window.get_size(),
+                         world_bounds);
   auto world = editor_root.new_world(sm_loader);
   camera.add_listener(&window);
   editor_root.add_listener(&window);
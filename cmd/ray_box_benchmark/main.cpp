@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+#include "spdlog/spdlog.h"
+#include "src/graphics/box_batch.h"
+
+// clang-format off
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+// clang-format on
+
+import data;
+import graphics;
+
+using namespace std;
+using namespace ale;
+using namespace ale::data;
+using namespace ale::graphics;
+using namespace glm;
+
+long long elapsed_us(chrono::high_resolution_clock::time_point start) {
+  auto elapsed = chrono::high_resolution_clock::now() - start;
+  return chrono::duration_cast<chrono::microseconds>(elapsed).count();
+}
+
+// nearest box the way the gizmo used to find it, one Ray::intersect per box
+BoxHit nearest_one_by_one(Ray &ray, const vector<BoundingBox> &boxes) {
+  BoxHit best;
+  for (int i = 0; i < boxes.size(); ++i) {
+    auto t = ray.intersect(boxes[i]);
+    if (t.has_value() && *t < best.t) {
+      best = BoxHit{i, *t};
+    }
+  }
+  return best;
+}
+
+// hits of different paths agree when they pick the same box, or boxes the
+// same distance away
+bool same_hit(BoxHit a, BoxHit b) {
+  if (a.index == b.index) {
+    return true;
+  }
+  return a.index >= 0 && b.index >= 0 && abs(a.t - b.t) < 1e-4f * b.t;
+}
+
+// Shoots rays from the middle of a cloud of random boxes and times the
+// nearest hit search: Ray::intersect box by box against the batched kernels
+// at every simd level the cpu has, one ray at a time and as packets.
+//
+// usage: RayBoxBenchmark [boxes] [rays]
+int main(int argc, char **argv) {
+  ale::logger::init();
+
+  int box_count = argc > 1 ? stoi(argv[1]) : 1024;
+  int ray_count = argc > 2 ? stoi(argv[2]) : 16384;
+
+  mt19937 random(1);
+  uniform_real_distribution<float> position(-50.0f, 50.0f);
+  uniform_real_distribution<float> extent(0.1f, 2.0f);
+  uniform_real_distribution<float> direction(-1.0f, 1.0f);
+
+  vector<BoundingBox> boxes;
+  BoxBatch batch;
+  for (int i = 0; i < box_count; ++i) {
+    vec3 center = vec3(position(random), position(random), position(random));
+    vec3 half = vec3(extent(random), extent(random), extent(random));
+    boxes.emplace_back(center - half, center + half);
+    batch.add(center - half, center + half);
+  }
+
+  // packets of camera rays share an origin and spread a little
+  vector<Ray> rays;
+  vector<vec3> origins;
+  vector<vec3> inv_dirs;
+  vec3 forward = normalize(vec3(1.0f, 0.3f, 0.2f));
+  for (int i = 0; i < ray_count; ++i) {
+    vec3 spread = vec3(direction(random), direction(random),
+                       direction(random));
+    rays.emplace_back(vec3(0.0f), forward + 0.3f * spread);
+    origins.push_back(rays.back().origin);
+    inv_dirs.push_back(rays.back().invDir);
+  }
+
+  SPDLOG_INFO("{} boxes, {} rays, cpu supports {}", box_count, ray_count,
+              simd_level_name(simd_level()));
+
+  auto start = chrono::high_resolution_clock::now();
+  vector<BoxHit> expected(ray_count);
+  for (int i = 0; i < ray_count; ++i) {
+    expected[i] = nearest_one_by_one(rays[i], boxes);
+  }
+  long long baseline_us = elapsed_us(start);
+  SPDLOG_INFO("Ray::intersect one by one: {}us", baseline_us);
+
+  vector<SimdLevel> levels = {SimdLevel::SCALAR};
+  if (simd_level() >= SimdLevel::SSE) {
+    levels.push_back(SimdLevel::SSE);
+  }
+  if (simd_level() >= SimdLevel::AVX2) {
+    levels.push_back(SimdLevel::AVX2);
+  }
+
+  vector<BoxHit> hits(ray_count);
+  for (auto level: levels) {
+    start = chrono::high_resolution_clock::now();
+    for (int i = 0; i < ray_count; ++i) {
+      hits[i] = intersect_nearest(batch, origins[i], inv_dirs[i], 0.0f,
+                                  INFINITY, level);
+    }
+    long long single_us = elapsed_us(start);
+    int mismatches = 0;
+    for (int i = 0; i < ray_count; ++i) {
+      mismatches += !same_hit(hits[i], expected[i]);
+    }
+
+    start = chrono::high_resolution_clock::now();
+    intersect_nearest_packet(batch, origins.data(), inv_dirs.data(), ray_count,
+                             hits.data(), 0.0f, INFINITY, level);
+    long long packet_us = elapsed_us(start);
+    for (int i = 0; i < ray_count; ++i) {
+      mismatches += !same_hit(hits[i], expected[i]);
+    }
+
+    SPDLOG_INFO("{}: {}us ray by ray ({:.1f}x), {}us in packets ({:.1f}x), "
+                "{} mismatches",
+                simd_level_name(level), single_us,
+                (float) baseline_us / max(single_us, 1LL), packet_us,
+                (float) baseline_us / max(packet_us, 1LL), mismatches);
+  }
+
+  return 0;
+}
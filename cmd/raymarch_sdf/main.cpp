@@ -101,10 +101,7 @@ public:
     alignas(16) vec4 innerBBMax;
     alignas(16) vec4 outerBBMin;
     alignas(16) vec4 outerBBMax;
-    int atlasIndex;
-    int atlasCount;
-    int _1 = 0; // padding
-    int _2 = 0; // padding
+    alignas(16) ivec4 atlasOrigin; // xyz = first voxel in the page, w = page
   };
 
   void draw_packed(Camera &camera, SdfModelPacked &sdfModelPacked,
@@ -123,10 +120,7 @@ public:
             .innerBBMax = vec4(p.inner_bb.max, 0.0),
             .outerBBMin = vec4(p.outer_bb.min, 0.0),
             .outerBBMax = vec4(p.outer_bb.max, 0.0),
-            .atlasIndex = p.atlas_index,
-            .atlasCount = p.atlas_count,
-            ._1 = 0,
-            ._2 = 0,
+            .atlasOrigin = ivec4(p.atlas_origin, p.atlas_index),
         });
       }
       int details_size = details.size();
@@ -157,7 +151,7 @@ public:
                 camera.get_view_matrix());
     shader.setMat4("invViewProj", invViewProj);
 
-    // binds texture2D atlas[16];
+    // binds sampler3D atlas[6];
     // binds int atlasSize;
     vector<pair<Transform, vector<unsigned int>>> entries = {};
     sdfModelPacked.bind_to_shader(shader, entries, 0);
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+// clang-format off
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+// clang-format on
+
+import data;
+import graphics;
+
+using namespace std;
+using namespace ale;
+using namespace ale::data;
+using namespace ale::graphics;
+using namespace ale::graphics::sdf;
+namespace fs = std::filesystem;
+
+struct BakeJob {
+  Model *model;
+  int mesh_index;
+  int resolution;
+};
+
+long long elapsed_ms(chrono::high_resolution_clock::time_point start) {
+  auto elapsed = chrono::high_resolution_clock::now() - start;
+  return chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+}
+
+// Bakes every mesh under a content directory into caches/sdf, the same
+// cache StaticMeshLoader reads, so the editor starts warm. Runs on the cpu
+// only, no window or gl context is created.
+//
+// usage: SdfBake [content dir] [--force]
+int main(int argc, char **argv) {
+  ale::logger::init();
+
+  string content_dir = afs::root("resources/models/content_browser");
+  bool force = false;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--force") {
+      force = true;
+    } else {
+      content_dir = arg;
+    }
+  }
+
+  auto start = chrono::high_resolution_clock::now();
+  auto models = vector<unique_ptr<Model>>();
+  for (auto &entry: fs::recursive_directory_iterator(content_dir)) {
+    auto extension = entry.path().extension().string();
+    if (!entry.is_regular_file() ||
+        (extension != ".obj" && extension != ".gltf" && extension != ".glb")) {
+      continue;
+    }
+    models.push_back(make_unique<Model>(entry.path().generic_string(), false,
+                                        false));
+  }
+
+  // same choices StaticMeshLoader makes, otherwise the cache keys differ
+  auto cache = SdfCache(afs::root("caches/sdf"), SdfGeneratorGPUV2::VERSION);
+  auto jobs = vector<BakeJob>();
+  int skipped = 0;
+  for (auto &model: models) {
+    for (int i = 0; i < model->meshes.size(); ++i) {
+      int resolution = choose_sdf_resolution(model->meshes[i]);
+      if (!force && cache.contains(model->meshes[i], resolution)) {
+        ++skipped;
+        continue;
+      }
+      jobs.push_back(BakeJob{model.get(), i, resolution});
+    }
+  }
+  SPDLOG_INFO("{} models, {} meshes to bake, {} already cached, {}ms",
+              models.size(), jobs.size(), skipped, elapsed_ms(start));
+
+  // biggest first. Meshes with enough tiles to keep every core busy are
+  // baked one at a time with all threads, the small ones are spread over
+  // single threaded bakers instead
+  sort(jobs.begin(), jobs.end(), [](BakeJob &a, BakeJob &b) {
+    return a.resolution > b.resolution;
+  });
+  int thread_count = std::max(1u, thread::hardware_concurrency());
+  auto is_large = [&](BakeJob &job) {
+    int tiles = job.resolution / SdfBakerCpu::TILE_SIZE;
+    return tiles * tiles * tiles >= 4 * thread_count;
+  };
+
+  mutex log_lock;
+  auto bake = [&](SdfBakerCpu &baker, BakeJob &job) {
+    auto job_start = chrono::high_resolution_clock::now();
+    auto &mesh = job.model->meshes[job.mesh_index];
+    auto distances = baker.bake(mesh, job.resolution);
+    cache.save(mesh, job.resolution, distances);
+
+    lock_guard guard(log_lock);
+    SPDLOG_INFO("{} mesh {}: res {}, {}ms", job.model->path.string(),
+                job.mesh_index, job.resolution, elapsed_ms(job_start));
+  };
+
+  start = chrono::high_resolution_clock::now();
+  auto first_small = find_if_not(jobs.begin(), jobs.end(), is_large);
+  auto parallel_baker = SdfBakerCpu(thread_count);
+  for (auto it = jobs.begin(); it != first_small; ++it) {
+    bake(parallel_baker, *it);
+  }
+
+  atomic<int> next = first_small - jobs.begin();
+  auto worker = [&]() {
+    auto baker = SdfBakerCpu(1);
+    for (int i = next++; i < jobs.size(); i = next++) {
+      bake(baker, jobs[i]);
+    }
+  };
+  {
+    auto workers = vector<jthread>();
+    for (int i = 1; i < thread_count; ++i) {
+      workers.emplace_back(worker);
+    }
+    worker();
+  }
+
+  SPDLOG_INFO("baked {} meshes in {}ms", jobs.size(), elapsed_ms(start));
+  return 0;
+}
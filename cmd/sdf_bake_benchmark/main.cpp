@@ -0,0 +1,574 @@
+// clang-format off
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+// clang-format on
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <entt/entt.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "spdlog/spdlog.h"
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
+#include "src/graphics/sdf/triangle_batch.h"
+
+// clang-format off
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+// clang-format on
+
+import data;
+import graphics;
+
+using namespace std;
+using namespace ale;
+using namespace ale::data;
+using namespace ale::graphics;
+using namespace ale::graphics::sdf;
+using namespace glm;
+
+using Image = vector<vector<vector<vec4>>>;
+
+long long elapsed_ms(chrono::high_resolution_clock::time_point start) {
+  auto elapsed = chrono::high_resolution_clock::now() - start;
+  return chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+}
+
+long long elapsed_us(chrono::high_resolution_clock::time_point start) {
+  auto elapsed = chrono::high_resolution_clock::now() - start;
+  return chrono::duration_cast<chrono::microseconds>(elapsed).count();
+}
+
+// bakes every voxel of the mesh on the cpu, use_bvh = false tests every
+// triangle like the old generator did
+long long bake(SdfBvh &bvh, BoundingBox outer_bb, int resolution, bool use_bvh,
+               Image &image) {
+  auto start = chrono::high_resolution_clock::now();
+  vec3 normal;
+  int nodes_size = use_bvh ? bvh.nodes.size() : 0;
+  for (int x = 0; x < resolution; ++x) {
+    for (int y = 0; y < resolution; ++y) {
+      for (int z = 0; z < resolution; ++z) {
+        generate_sdf(ivec3(x, y, z), bvh.vertices.size(), bvh.indices.size(),
+                     nodes_size, outer_bb.min, outer_bb.max, ivec3(resolution),
+                     bvh.vertices, bvh.indices, bvh.nodes, image, normal);
+      }
+    }
+  }
+  return elapsed_ms(start);
+}
+
+// brute force against the bvh on the cpu, every triangle against the
+// closest ones. Returns the bvh bake for the other cpu benchmarks to check
+Image bvh_bake(const string &path, int mesh_index, SdfBvh &bvh,
+               BoundingBox outer_bb, long long build_ms, int resolution) {
+  auto brute_image =
+      Image(resolution, vector(resolution, vector(resolution, vec4(0.0f))));
+  auto bvh_image = brute_image;
+  auto brute_ms = bake(bvh, outer_bb, resolution, false, brute_image);
+  auto bvh_ms = bake(bvh, outer_bb, resolution, true, bvh_image);
+
+  float max_error = 0.0f;
+  for (int x = 0; x < resolution; ++x) {
+    for (int y = 0; y < resolution; ++y) {
+      for (int z = 0; z < resolution; ++z) {
+        max_error = std::max(max_error, abs(abs(brute_image[x][y][z].x) -
+                                            abs(bvh_image[x][y][z].x)));
+      }
+    }
+  }
+
+  SPDLOG_INFO("{} mesh {}: {} triangles, {} nodes, res {}", path, mesh_index,
+              bvh.indices.size() / 3, bvh.nodes.size(), resolution);
+  SPDLOG_INFO("  bvh build {}ms | brute force {}ms | bvh {}ms | {:.1f}x | "
+              "max error {}",
+              build_ms, brute_ms, bvh_ms,
+              (float) brute_ms / std::max(bvh_ms, 1ll), max_error);
+  return bvh_image;
+}
+
+// unsigned distance kernels against every triangle, on a coarser grid so
+// the scalar run stays short
+void simd_kernels(SdfBvh &bvh, BoundingBox outer_bb, int resolution) {
+  auto batch = TriangleBatch(bvh.vertices, bvh.indices);
+  int kernel_res = std::max(1, resolution / 2);
+  float scalar_sum = 0.0f;
+  long long scalar_ms = 0;
+  for (auto level: {SimdLevel::SCALAR, SimdLevel::SSE, SimdLevel::AVX2}) {
+    if (level > simd_level()) {
+      break;
+    }
+    auto start = chrono::high_resolution_clock::now();
+    float sum = 0.0f;
+    for (int x = 0; x < kernel_res; ++x) {
+      for (int y = 0; y < kernel_res; ++y) {
+        for (int z = 0; z < kernel_res; ++z) {
+          vec3 p = voxel_center(ivec3(x, y, z), outer_bb.min, outer_bb.max,
+                                ivec3(kernel_res));
+          sum += sqrt(min_triangle_distance2(batch, p, 0, batch.size, level));
+        }
+      }
+    }
+    auto kernel_ms = elapsed_ms(start);
+    if (level == SimdLevel::SCALAR) {
+      scalar_ms = kernel_ms;
+      scalar_sum = sum;
+    }
+    SPDLOG_INFO("  {} kernel {}ms | {:.1f}x | sum diff {}",
+                simd_level_name(level), kernel_ms,
+                (float) scalar_ms / std::max(kernel_ms, 1ll),
+                sum - scalar_sum);
+  }
+}
+
+// narrow band against the exact bake, both on every core. Returns the
+// exact bake
+vector<float> narrow_band(SdfBvh &bvh, BoundingBox outer_bb, int resolution) {
+  auto baker = SdfBakerCpu();
+  auto start = chrono::high_resolution_clock::now();
+  auto exact = baker.bake(bvh, outer_bb, resolution, SdfBakeMode::EXACT);
+  auto exact_ms = elapsed_ms(start);
+  start = chrono::high_resolution_clock::now();
+  auto narrow = baker.bake(bvh, outer_bb, resolution, SdfBakeMode::NARROW_BAND);
+  auto narrow_ms = elapsed_ms(start);
+  SPDLOG_INFO("  exact {}ms | narrow band {}ms | max error {}", exact_ms,
+              narrow_ms, SdfBakerCpu::max_error(exact, narrow));
+  return exact;
+}
+
+// sparse bricks of the exact bake, sampled back at every voxel
+void bricks(const vector<float> &exact, BoundingBox outer_bb, int resolution) {
+  auto bricked = SdfBricked(exact, resolution, outer_bb);
+  float brick_error = 0.0f;
+  for (int z = 0; z < resolution; ++z) {
+    for (int y = 0; y < resolution; ++y) {
+      for (int x = 0; x < resolution; ++x) {
+        float d = exact[(z * resolution + y) * resolution + x];
+        vec3 p = voxel_center(ivec3(x, y, z), outer_bb.min, outer_bb.max,
+                              ivec3(resolution));
+        // far cells only keep a lower bound, so only compare near the
+        // surface
+        if (abs(d) < length(outer_bb.getSize()) / resolution) {
+          brick_error = std::max(brick_error, abs(bricked.sample(p) - d));
+        }
+      }
+    }
+  }
+  SPDLOG_INFO("  bricks {}/{} | {}KB vs dense {}KB | {:.1f}x | "
+              "surface error {}",
+              bricked.brick_count(), bricked.cells.size(),
+              bricked.memory_bytes() / 1024,
+              bricked.dense_memory_bytes() / 1024,
+              (float) bricked.dense_memory_bytes() / bricked.memory_bytes(),
+              brick_error);
+}
+
+// quantized atlas storage, round trip error and encode/decode speed
+void quantization(const vector<float> &exact) {
+  auto quantization = sdf_quantization(exact);
+  auto report = [&](auto encoded_type, const char *name) {
+    using T = decltype(encoded_type);
+    auto start = chrono::high_resolution_clock::now();
+    auto encoded = encode_snorm<T>(exact, quantization);
+    auto encode_us = elapsed_us(start);
+    start = chrono::high_resolution_clock::now();
+    auto decoded = decode_snorm<T>(encoded, quantization);
+    auto decode_us = elapsed_us(start);
+    float mb = exact.size() * sizeof(float) / (1024.0f * 1024.0f);
+    SPDLOG_INFO("  {} {}KB | max error {} | encode {:.0f}MB/s | "
+                "decode {:.0f}MB/s",
+                name, encoded.size() * sizeof(T) / 1024,
+                SdfBakerCpu::max_error(exact, decoded),
+                mb / std::max(encode_us, 1ll) * 1e6f,
+                mb / std::max(decode_us, 1ll) * 1e6f);
+  };
+  report(int16_t(), "snorm16");
+  report(int8_t(), "snorm8");
+}
+
+// incremental rebake after pulling the vertex closest to the center further
+// in, which leaves the bounding box alone
+void incremental_rebake(Mesh &mesh, int resolution) {
+  if (mesh.vertices.empty()) {
+    return;
+  }
+  auto baker = SdfBakerCpu();
+  auto old_distances = baker.bake(mesh, resolution);
+  auto edited = mesh;
+  vec3 center = mesh.boundingBox.getCenter();
+  auto closest = min_element(
+      edited.vertices.begin(), edited.vertices.end(),
+      [&](Vertex &a, Vertex &b) {
+        return distance(a.position, center) < distance(b.position, center);
+      });
+  vec3 moved = mix(closest->position, center, 0.1f);
+  for (auto &vertex: edited.vertices) {
+    if (vertex.position == closest->position) {
+      vertex.position = moved;
+    }
+  }
+
+  auto start = chrono::high_resolution_clock::now();
+  auto expected = baker.bake(edited, resolution);
+  auto full_ms = elapsed_ms(start);
+  start = chrono::high_resolution_clock::now();
+  auto rebake = baker.rebake(mesh, edited, old_distances, resolution);
+  auto rebake_ms = elapsed_ms(start);
+  SPDLOG_INFO("  full rebake {}ms | incremental {}ms | {} dirty tiles | "
+              "max error {}",
+              full_ms, rebake_ms, rebake.dirty_tiles.size(),
+              SdfBakerCpu::max_error(expected, rebake.distances));
+}
+
+// thread scaling of the tiled baker, 1, 2, 4, ... up to every core
+void thread_scaling(SdfBvh &bvh, BoundingBox outer_bb, int resolution,
+                    const Image &bvh_image) {
+  auto thread_counts = vector<int>();
+  int max_threads = std::max(1u, thread::hardware_concurrency());
+  for (int t = 1; t < max_threads; t *= 2) {
+    thread_counts.push_back(t);
+  }
+  thread_counts.push_back(max_threads);
+
+  long long single_ms = 0;
+  for (int thread_count: thread_counts) {
+    auto baker = SdfBakerCpu(thread_count);
+    auto start = chrono::high_resolution_clock::now();
+    auto distances = baker.bake(bvh, outer_bb, resolution);
+    auto baker_ms = elapsed_ms(start);
+    if (thread_count == 1) {
+      single_ms = baker_ms;
+    }
+
+    // must match the serial bake exactly, it runs the same code
+    float mismatch = 0.0f;
+    for (int x = 0; x < resolution; ++x) {
+      for (int y = 0; y < resolution; ++y) {
+        for (int z = 0; z < resolution; ++z) {
+          int index = (z * resolution + y) * resolution + x;
+          mismatch = std::max(mismatch,
+                              abs(distances[index] - bvh_image[x][y][z].x));
+        }
+      }
+    }
+    SPDLOG_INFO("  {} threads {}ms | {:.1f}x | mismatch {}", thread_count,
+                baker_ms, (float) single_ms / std::max(baker_ms, 1ll),
+                mismatch);
+  }
+}
+
+// every cpu benchmark of one mesh, none of them needs a gl context
+void cpu_mesh(const string &path, int mesh_index, Mesh &mesh,
+              int resolution) {
+  auto outer_bb = mesh.boundingBox.apply_scale(Transform{
+      .scale = vec3(1.1, 1.1, 1.1),
+  });
+
+  auto start = chrono::high_resolution_clock::now();
+  auto bvh = SdfBvh(mesh);
+  auto build_ms = elapsed_ms(start);
+
+  auto bvh_image =
+      bvh_bake(path, mesh_index, bvh, outer_bb, build_ms, resolution);
+  simd_kernels(bvh, outer_bb, resolution);
+  auto exact = narrow_band(bvh, outer_bb, resolution);
+  bricks(exact, outer_bb, resolution);
+  quantization(exact);
+  incremental_rebake(mesh, resolution);
+  thread_scaling(bvh, outer_bb, resolution, bvh_image);
+}
+
+// dense atlas space for the chosen resolutions of every mesh, 3d pages
+// against the old 64 row strips (64 per 4096^2 texture, res <= 64 only)
+void atlas_packing(const vector<int> &atlas_resolutions) {
+  auto packer = SdfAtlasPacker(ivec3(ATLAS_SIZE), ATLAS_PAGES_MAX);
+  long long voxels = 0;
+  int packed = 0;
+  for (int res: atlas_resolutions) {
+    if (res <= 64 && packer.insert(ivec3(res))) {
+      voxels += (long long) res * res * res;
+      ++packed;
+    }
+  }
+  int strip_textures = (packed + 63) / 64;
+  float strip_occupancy =
+      strip_textures == 0
+          ? 0.0f
+          : voxels /
+                (float(ATLAS_SIZE) * ATLAS_SIZE * ATLAS_SIZE * strip_textures);
+  SPDLOG_INFO("atlas, {} sdfs | 3d pages {} at {:.1f}% | strip textures {} "
+              "at {:.1f}%",
+              packed, packer.page_count(), packer.occupancy() * 100.0f,
+              strip_textures, strip_occupancy * 100.0f);
+}
+
+// gpu generation, a dispatch per mesh against one batched dispatch. The
+// batch runs twice, the second one reuses the buffers of the first
+void gpu_generation(SdfGeneratorGPUV2 &generator, const string &path,
+                    int resolution) {
+  auto model = Model(path);
+  glFinish();
+  auto start = chrono::high_resolution_clock::now();
+  auto single = generator.generate_gpu(model, resolution);
+  glFinish();
+  auto single_ms = elapsed_ms(start);
+
+  auto batched_ms = vector<long long>();
+  auto batched = vector<Texture3D>();
+  for (int run = 0; run < 2; ++run) {
+    start = chrono::high_resolution_clock::now();
+    batched = generator.generate_gpu_batched(model, resolution);
+    glFinish();
+    batched_ms.push_back(elapsed_ms(start));
+  }
+
+  float max_error = 0.0f;
+  for (int i = 0; i < single.size(); ++i) {
+    auto expected = single[i].retrieve_data_from_gpu();
+    auto actual = batched[i].retrieve_data_from_gpu();
+    max_error = std::max(max_error, SdfBakerCpu::max_error(expected, actual));
+  }
+  float mesh_count = std::max<size_t>(model.meshes.size(), 1);
+  SPDLOG_INFO("{} gpu, {} meshes, res {}", path, model.meshes.size(),
+              resolution);
+  SPDLOG_INFO("  per mesh dispatch {:.1f}ms/mesh | batched {:.1f}ms/mesh | "
+              "reused buffers {:.1f}ms/mesh | {:.1f}x | max error {}",
+              single_ms / mesh_count, batched_ms[0] / mesh_count,
+              batched_ms[1] / mesh_count,
+              (float) single_ms / std::max(batched_ms[1], 1ll), max_error);
+}
+
+// shadow caster objects of a scene, rebuilt every frame like the
+// renderers used to against SdfShadowCasters, static and with 1% moving
+void shadow_casters(SdfGeneratorGPUV2 &generator, const string &path) {
+  constexpr int ENTITY_COUNT = 10000;
+  constexpr int FRAMES = 100;
+  auto model = make_shared<Model>(path);
+  auto textures = generator.generate_gpu_batched(*model, 16);
+  auto sdf_model = SdfModel(model->meshes[0], std::move(textures[0]), 16);
+  auto packed = make_shared<SdfModelPacked>(vector<SdfModel *>{&sdf_model});
+  auto shader = Shader(
+      afs::root("resources/shaders/renderer/basic_renderer.vs").c_str(),
+      afs::root("resources/shaders/renderer/basic_renderer.fs").c_str());
+
+  auto world = entt::registry{};
+  for (int i = 0; i < ENTITY_COUNT; ++i) {
+    auto entity = world.create();
+    world.emplace<Transform>(
+        entity, Transform{.translation = vec3(i % 100, 0.0f, i / 100)});
+    world.emplace<StaticMesh>(entity, model, packed, vector<unsigned int>{0});
+  }
+
+  glFinish();
+  auto start = chrono::high_resolution_clock::now();
+  for (int frame = 0; frame < FRAMES; ++frame) {
+    auto entries = vector<pair<Transform, vector<unsigned int>>>();
+    for (auto [entity, transform, static_mesh]:
+         world.view<Transform, StaticMesh>().each()) {
+      entries.emplace_back(transform, static_mesh.get_model_shadow().second);
+    }
+    packed->bind_to_shader(shader, entries, 5);
+  }
+  glFinish();
+  auto rebuild_us = elapsed_us(start) / FRAMES;
+
+  auto casters = SdfShadowCasters();
+  casters.bind_to_shader(shader, world, 5);
+  glFinish();
+  start = chrono::high_resolution_clock::now();
+  for (int frame = 0; frame < FRAMES; ++frame) {
+    casters.bind_to_shader(shader, world, 5);
+  }
+  glFinish();
+  auto static_us = elapsed_us(start) / FRAMES;
+
+  auto movers = vector<entt::entity>();
+  for (auto entity: world.view<Transform>()) {
+    if (movers.size() * 100 < ENTITY_COUNT) {
+      movers.push_back(entity);
+    }
+  }
+  start = chrono::high_resolution_clock::now();
+  for (int frame = 0; frame < FRAMES; ++frame) {
+    for (auto entity: movers) {
+      world.patch<Transform>(
+          entity, [](Transform &t) { t.translation.y += 0.01f; });
+    }
+    casters.bind_to_shader(shader, world, 5);
+  }
+  glFinish();
+  auto moving_us = elapsed_us(start) / FRAMES;
+
+  SPDLOG_INFO("shadow casters, {} objects | rebuilt {}us/frame | "
+              "static {}us/frame | {} moving {}us/frame",
+              casters.size(), rebuild_us, static_us, movers.size(), moving_us);
+}
+
+// cpu ray queries against the first mesh, a grid of rays from the front
+// traced plainly and over-relaxed
+void traces(SdfGeneratorGPUV2 &generator, const string &path, int resolution) {
+  constexpr int RAYS = 128;
+  auto model = Model(path);
+  auto &mesh = model.meshes[0];
+  auto textures = generator.generate_gpu_batched(model, resolution);
+  auto sdf_model = SdfModel(mesh, std::move(textures[0]), resolution);
+  sdf_model.get_distances();
+
+  vec3 center = (mesh.boundingBox.min + mesh.boundingBox.max) * 0.5f;
+  float radius = length(mesh.boundingBox.getSize()) * 0.5f;
+  vec3 eye = center + vec3(0.0f, 0.0f, radius * 3.0f);
+  for (auto mode: {SdfTraceMode::SPHERE, SdfTraceMode::ENHANCED}) {
+    auto settings = SdfTraceSettings{
+        .mode = mode,
+        .max_distance = radius * 6.0f,
+    };
+    auto stats = SdfTraceStats();
+    auto start = chrono::high_resolution_clock::now();
+    for (int y = 0; y < RAYS; ++y) {
+      for (int x = 0; x < RAYS; ++x) {
+        vec3 target = center + vec3(x * 2.0f / (RAYS - 1) - 1.0f,
+                                    y * 2.0f / (RAYS - 1) - 1.0f, 0.0f) *
+                                   radius;
+        stats.add(sdf_model.trace(Ray(eye, target - eye), settings));
+      }
+    }
+    SPDLOG_INFO("trace {}, {} rays, {} hits | steps mean {:.1f} p95 {} "
+                "max {} | {}us",
+                mode == SdfTraceMode::SPHERE ? "sphere" : "enhanced",
+                stats.rays, stats.hits, stats.mean_steps(),
+                stats.percentile_steps(0.95f), stats.max_steps,
+                elapsed_us(start));
+  }
+}
+
+// soft shadow factors of a ground grid under 10x10 copies of the first
+// mesh for a few point lights, on one thread, on all of them and walking
+// the instance bvh. Once with uniform scale and once stretched and
+// rotated, where objects report less than their box distance
+void cpu_shadows(SdfGeneratorGPUV2 &generator, const string &path) {
+  constexpr int GRID = 64;
+  auto model = Model(path);
+  auto textures = generator.generate_gpu_batched(model, 32);
+  auto sdf_model = SdfModel(model.meshes[0], std::move(textures[0]), 32);
+  auto packed = SdfModelPacked(vector<SdfModel *>{&sdf_model});
+  auto points = vector<SdfShadowPoint>();
+  for (int i = 0; i < GRID * GRID; ++i) {
+    vec3 position = vec3(i % GRID, 0.0f, i / GRID) * (20.0f / GRID);
+    points.push_back(SdfShadowPoint{position - vec3(0.0f, 1.0f, 0.0f),
+                                    vec3(0.0f, 1.0f, 0.0f)});
+  }
+  auto lights = vector<vec3>{vec3(10.0f, 10.0f, 10.0f), vec3(0.0f, 6.0f, 0.0f),
+                             vec3(20.0f, 4.0f, 5.0f)};
+
+  auto start = chrono::high_resolution_clock::now();
+  auto single = SdfShadowCpu(packed, 1);
+  auto read_back_ms = elapsed_ms(start);
+  auto threaded = SdfShadowCpu(packed);
+
+  for (bool stretched: {false, true}) {
+    auto objects = vector<SdfModelPacked::GPUObject>();
+    for (int i = 0; i < 100; ++i) {
+      auto transform =
+          Transform{.translation = vec3(i % 10, 0.0f, i / 10) * 2.0f};
+      if (stretched) {
+        transform.rotation = quat(radians(vec3(0.0f, i * 17.0f, i * 5.0f)));
+        transform.scale = vec3(2.5f, 0.4f, 1.0f);
+      }
+      objects.push_back(packed.gpu_object(transform.get_model_matrix(), 0));
+    }
+
+    start = chrono::high_resolution_clock::now();
+    auto expected = single.shadow_factors(objects, points, lights);
+    auto single_ms = elapsed_ms(start);
+    start = chrono::high_resolution_clock::now();
+    auto actual = threaded.shadow_factors(objects, points, lights);
+    auto threaded_ms = elapsed_ms(start);
+
+    auto boxes = vector<BoundingBox>();
+    auto distance_scales = vector<float>();
+    for (auto &object: objects) {
+      boxes.push_back(BoundingBox(vec3(object.outer_bbmin),
+                                  vec3(object.outer_bbmax))
+                          .transform(object.model_mat));
+      distance_scales.push_back(
+          SdfInstanceBvh::distance_scale(object.model_mat));
+    }
+    auto bvh = SdfInstanceBvh();
+    bvh.build(boxes, distance_scales);
+    start = chrono::high_resolution_clock::now();
+    auto culled = threaded.shadow_factors(objects, points, lights, bvh.nodes);
+    auto bvh_ms = elapsed_ms(start);
+
+    float max_difference = 0.0f;
+    float lit = 0.0f;
+    for (int i = 0; i < expected.size(); ++i) {
+      max_difference = std::max({max_difference, abs(expected[i] - actual[i]),
+                                 abs(expected[i] - culled[i])});
+      lit += expected[i];
+    }
+    SPDLOG_INFO("cpu shadows, {} {} objects, {} points x {} lights | "
+                "read back {}ms | 1 thread {}ms | {} threads {}ms | "
+                "instance bvh {}ms | {:.1f}% lit | max difference {}",
+                objects.size(), stretched ? "stretched" : "uniform",
+                points.size(), lights.size(), read_back_ms, single_ms,
+                thread::hardware_concurrency(), threaded_ms, bvh_ms,
+                lit / std::max<size_t>(expected.size(), 1) * 100.0f,
+                max_difference);
+  }
+}
+
+// usage: SdfBakeBenchmark [--cpu] [resolution] [model paths...]
+// --cpu stops after the cpu benchmarks, which run without a gl context.
+// LIBGL_ALWAYS_SOFTWARE=1 runs the gpu part on mesa's llvmpipe
+int main(int argc, char **argv) {
+  ale::logger::init();
+
+  int arg = 1;
+  bool cpu_only = argc > arg && string(argv[arg]) == "--cpu";
+  if (cpu_only) {
+    ++arg;
+  }
+  int resolution = argc > arg ? stoi(argv[arg++]) : 32;
+  vector<string> paths;
+  for (; arg < argc; ++arg) {
+    paths.push_back(argv[arg]);
+  }
+  if (paths.empty()) {
+    paths.push_back(afs::root("resources/models/content_browser/tree.obj"));
+    paths.push_back(afs::root("resources/models/content_browser/monkey.obj"));
+  }
+
+  // the meshes stay off the gpu, so nothing here needs a window
+  auto atlas_resolutions = vector<int>();
+  for (auto &path: paths) {
+    auto model = Model(path, false, false);
+    for (int i = 0; i < model.meshes.size(); ++i) {
+      atlas_resolutions.push_back(choose_sdf_resolution(model.meshes[i]));
+      cpu_mesh(path, i, model.meshes[i], resolution);
+    }
+  }
+  atlas_packing(atlas_resolutions);
+  if (cpu_only) {
+    return 0;
+  }
+
+  glfwInit();
+  {
+    // meshes upload to gl on construction, so a context is needed
+    auto window = Window(320, 240, "SDF Bake Benchmark");
+    auto generator = SdfGeneratorGPUV2();
+    for (auto &path: paths) {
+      gpu_generation(generator, path, resolution);
+    }
+    shadow_casters(generator, paths[0]);
+    traces(generator, paths[0], resolution);
+    cpu_shadows(generator, paths[0]);
+  }
+  glfwTerminate();
+  return 0;
+}
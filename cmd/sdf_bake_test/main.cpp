@@ -0,0 +1,107 @@
+#include <cmath>
+#include <functional>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include "spdlog/spdlog.h"
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
+
+// clang-format off
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+// clang-format on
+
+import data;
+import graphics;
+
+using namespace std;
+using namespace ale;
+using namespace ale::data;
+using namespace ale::graphics;
+using namespace ale::graphics::sdf;
+using namespace glm;
+
+// meshes stay on the cpu, nothing here needs a gl context
+Mesh cpu_mesh(vector<vec3> positions, vector<unsigned int> indices) {
+  auto vertices = vector<Vertex>();
+  auto bb_min = vec3(INFINITY);
+  auto bb_max = vec3(-INFINITY);
+  for (auto &position: positions) {
+    vertices.push_back(Vertex{.position = position});
+    bb_min = min(bb_min, position);
+    bb_max = max(bb_max, position);
+  }
+  if (positions.empty()) {
+    bb_min = vec3(-1.0f);
+    bb_max = vec3(1.0f);
+  }
+  return Mesh(vertices, indices, PendingTexturePath{},
+              BoundingBox(bb_min, bb_max), false);
+}
+
+bool all_finite(const vector<float> &distances) {
+  for (float d: distances) {
+    if (!isfinite(d)) {
+      return false;
+    }
+  }
+  return !distances.empty();
+}
+
+// an empty mesh is a single leaf without triangles, every traversal has to
+// stop there instead of reading it as an inner node
+bool empty_mesh() {
+  auto mesh = cpu_mesh({}, {});
+  auto bvh = SdfBvh(mesh);
+  if (bvh.nodes.size() != 1 || bvh.nodes[0].data.w == 0) {
+    return false;
+  }
+
+  auto closest = closest_triangle(vec3(0.5f), bvh.indices.size(),
+                                  bvh.nodes.size(), bvh.vertices, bvh.indices,
+                                  bvh.nodes);
+  if (closest.distance != no_triangle().distance) {
+    return false;
+  }
+
+  auto baker = SdfBakerCpu();
+  for (auto mode: {SdfBakeMode::EXACT, SdfBakeMode::NARROW_BAND}) {
+    if (!all_finite(baker.bake(mesh, 8, mode))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// a quad has no extent along y, the narrow band has to voxelize it all the
+// same and match the exact bake
+bool flat_mesh() {
+  auto mesh = cpu_mesh({vec3(-1.0f, 0.0f, -1.0f), vec3(1.0f, 0.0f, -1.0f),
+                        vec3(1.0f, 0.0f, 1.0f), vec3(-1.0f, 0.0f, 1.0f)},
+                       {0, 1, 2, 0, 2, 3});
+  auto baker = SdfBakerCpu();
+  auto exact = baker.bake(mesh, 8, SdfBakeMode::EXACT);
+  auto narrow = baker.bake(mesh, 8, SdfBakeMode::NARROW_BAND);
+  return all_finite(exact) && all_finite(narrow) &&
+         SdfBakerCpu::max_error(exact, narrow) < 1e-4f;
+}
+
+// usage: SdfBakeTest, exits with 1 when a case fails
+int main() {
+  ale::logger::init();
+
+  auto cases = vector<pair<string, function<bool()>>>{
+      {"empty mesh", empty_mesh},
+      {"flat mesh", flat_mesh},
+  };
+  int failed = 0;
+  for (auto &[name, run]: cases) {
+    if (run()) {
+      SPDLOG_INFO("{} passed", name);
+    } else {
+      SPDLOG_ERROR("{} failed", name);
+      ++failed;
+    }
+  }
+  return failed == 0 ? 0 : 1;
+}
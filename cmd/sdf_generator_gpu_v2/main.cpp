@@ -21,6 +21,7 @@ import model;
 import mesh;
 import sdf_generator_gpu;
 import sdf_generator_gpu_v2;
+import sdf_bvh;
 import sdf_model;
 import basic_renderer;
 import line_renderer;
@@ -85,7 +86,8 @@ int main() {
   int resolution = 16;
   auto texture = std::move(sdfgen.generate_gpu(*model, resolution).at(0));
   auto texture_data = texture.retrieve_data_from_gpu();
-  auto sdf_mesh = SdfModel(model->meshes.at(0), std::move(texture), resolution);
+  auto sdf_mesh = SdfModel(model->meshes.at(0), std::move(texture), resolution,
+                           texture_data);
 
   window.attach_cursor_pos_callback(
       [&](double xpos, double ypos, double xoffset, double yoffset) {
@@ -122,9 +124,11 @@ int main() {
     } else if (key == GLFW_KEY_ENTER && action == GLFW_PRESS) {
       auto &m = model->meshes[0];
       auto outer_bb = m.boundingBox.apply_scale(Transform{.scale = vec3(1.1f)});
-      generate_sdf(ivec3(sx, sy, sz), m.vertices.size(), m.indices.size(),
-                   outer_bb.min, outer_bb.max, ivec3(8), m.vertices, m.indices,
-                   image, closest_normal);
+      auto bvh = SdfBvh(m);
+      generate_sdf(ivec3(sx, sy, sz), bvh.vertices.size(), bvh.indices.size(),
+                   bvh.nodes.size(), outer_bb.min, outer_bb.max, ivec3(8),
+                   bvh.vertices, bvh.indices, bvh.nodes, image,
+                   closest_normal);
       auto result = image[sx][sy][sz];
       closest_point = vec3(result[1], result[2], result[3]);
     }
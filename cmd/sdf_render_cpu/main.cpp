@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <chrono>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <string>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+// clang-format off
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+// clang-format on
+
+import data;
+import graphics;
+
+using namespace std;
+using namespace ale;
+using namespace ale::data;
+using namespace ale::graphics;
+using namespace ale::graphics::sdf;
+using namespace glm;
+
+long long elapsed_ms(chrono::high_resolution_clock::time_point start) {
+  auto elapsed = chrono::high_resolution_clock::now() - start;
+  return chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+}
+
+// Renders the sdfs of a model on the cpu into an image, reading the sdf
+// cache SdfBake writes and baking what is missing. No window or gl context
+// is created. Outputs ending in .hdr keep the floats, anything else is png.
+//
+// usage: SdfRenderCpu [model] [output] [width] [height]
+int main(int argc, char **argv) {
+  ale::logger::init();
+
+  string path = argc > 1
+                    ? argv[1]
+                    : afs::root("resources/models/content_browser/monkey.obj");
+  string output = argc > 2 ? argv[2] : "sdf_render_cpu.png";
+  int width = argc > 3 ? stoi(argv[3]) : 640;
+  int height = argc > 4 ? stoi(argv[4]) : 480;
+
+  auto start = chrono::high_resolution_clock::now();
+  auto model = Model(path, false, false);
+  auto cache = SdfCache(afs::root("caches/sdf"), SdfGeneratorGPUV2::VERSION);
+  auto baker = SdfBakerCpu();
+  auto sdfs = vector<SdfBricked>();
+  auto bounds = BoundingBox(vec3(INFINITY), vec3(-INFINITY));
+  for (auto &mesh: model.meshes) {
+    int resolution = choose_sdf_resolution(mesh);
+    auto distances = cache.load(mesh, resolution);
+    if (!distances) {
+      distances = baker.bake(mesh, resolution);
+      cache.save(mesh, resolution, *distances);
+    }
+    auto outer_bb = mesh.boundingBox.apply_scale(Transform{
+        .scale = vec3(1.1, 1.1, 1.1),
+    });
+    sdfs.emplace_back(*distances, resolution, outer_bb, INFINITY);
+    bounds.min = min(bounds.min, mesh.boundingBox.min);
+    bounds.max = max(bounds.max, mesh.boundingBox.max);
+  }
+  SPDLOG_INFO("{} meshes ready in {}ms", sdfs.size(), elapsed_ms(start));
+
+  auto objects = vector<SdfRendererCpu::Object>();
+  for (auto &sdf: sdfs) {
+    objects.push_back(SdfRendererCpu::Object{mat4(1.0f), &sdf});
+  }
+
+  // looks at the model from the front and a bit above
+  vec3 center = (bounds.min + bounds.max) * 0.5f;
+  float radius = length(bounds.getSize()) * 0.5f;
+  auto view = lookAt(center + normalize(vec3(0.0f, 0.4f, 1.0f)) * radius * 2.5f,
+                     center, vec3(0.0f, 1.0f, 0.0f));
+  auto projection =
+      perspective(radians(45.0f), (float) width / height, 0.1f, 100.0f);
+
+  start = chrono::high_resolution_clock::now();
+  auto renderer = SdfRendererCpu();
+  auto image = renderer.render(objects, view, projection, width, height);
+  SPDLOG_INFO("rendered {}x{} in {}ms", width, height, elapsed_ms(start));
+
+  bool saved = output.ends_with(".hdr") ? image.save_hdr(output)
+                                        : image.save_png(output);
+  if (!saved) {
+    SPDLOG_ERROR("could not write {}", output);
+    return 1;
+  }
+  SPDLOG_INFO("saved {}", output);
+  return 0;
+}
@@ -7,20 +7,10 @@ in VS_OUT {
     vec2 TexCoords;
 } fs_in;
 
-struct Light {
-    vec3 position;
-    vec3 color;
+#include "resources/shaders/renderer/camera_partial.glsl"
 
-    // used for soft shadows, not for color calculation (yet)
-    float radius;
+#include "resources/shaders/renderer/lights_partial.glsl"
 
-    // for point lights
-    vec3 attenuation;
-};
-uniform int numLights;
-uniform Light lights[20];
-
-uniform vec3 viewPos;
 uniform vec4 diffuseColor;
 
 #include "resources/shaders/sdf/sdf_atlas_partial.fs"
@@ -0,0 +1,10 @@
+// uniform buffer, so 420 core is required
+// written once per frame by FrameConstants, keep the layouts the same
+
+#include "src/graphics/gpu_bindings.h"
+
+layout (std140, binding = CAMERA_BINDING) uniform CameraBlock {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
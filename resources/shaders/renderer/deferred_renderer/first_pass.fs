@@ -10,9 +10,9 @@ in VS_OUT {
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
+    flat int EntityId;
 } fs_in;
 
-uniform int entityId;
 uniform vec3 diffuseColor;
 uniform float specularColor;
 
@@ -26,5 +26,5 @@ void main()
     gNormal = normalize(fs_in.Normal);
     gAlbedoSpec.rgb = texture(diffuseTexture, fs_in.TexCoords).rgb + diffuseColor;
     gAlbedoSpec.a = texture(specularTexture, fs_in.TexCoords).r + specularColor;
-    gEntityId.r = entityId;
+    gEntityId.r = fs_in.EntityId;
 }
\ No newline at end of file
@@ -1,24 +1,32 @@
-#version 330 core
+#version 430 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec3 aTangent;
 layout (location = 4) in vec3 aBitTangent;
+// per instance, used when instanced is set
+layout (location = 7) in mat4 aInstanceModel;
+layout (location = 11) in int aInstanceEntityId;
 
 out VS_OUT {
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
+    flat int EntityId;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
+#include "resources/shaders/renderer/camera_partial.glsl"
+
 uniform mat4 model;
+uniform int entityId;
+uniform bool instanced;
 
 void main()
 {
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
-    vs_out.Normal = transpose(inverse(mat3(model))) * aNormal;
+    mat4 m = instanced ? aInstanceModel : model;
+    vs_out.FragPos = vec3(m * vec4(aPos, 1.0));
+    vs_out.Normal = transpose(inverse(mat3(m))) * aNormal;
     vs_out.TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vs_out.EntityId = instanced ? aInstanceEntityId : entityId;
+    gl_Position = projection * view * m * vec4(aPos, 1.0);
 }
\ No newline at end of file
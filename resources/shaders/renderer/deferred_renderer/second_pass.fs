@@ -3,23 +3,13 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
-struct Light {
-    vec3 position;
-    vec3 color;
+#include "resources/shaders/renderer/camera_partial.glsl"
 
-    // used for soft shadows, not for color calculation (yet)
-    float radius;
-
-    // for point lights
-    vec3 attenuation;
-};
-uniform int numLights;
-uniform Light lights[20];
+#include "resources/shaders/renderer/lights_partial.glsl"
 
 uniform vec3 ambientColor;
 uniform float ambientIntensity;
 
-uniform vec3 viewPos;
 uniform sampler2D gPosition;
 uniform sampler2D gNormal;
 uniform sampler2D gAlbedoSpec;
@@ -0,0 +1,21 @@
+// SSBO, so 430 core is required
+// written once per frame by FrameConstants, keep the layouts the same
+
+#include "src/graphics/gpu_bindings.h"
+
+struct Light {
+    vec3 position;
+
+    // used for soft shadows, not for color calculation (yet)
+    float radius;
+
+    vec3 color;
+
+    // for point lights
+    vec3 attenuation;
+};
+
+layout (std430, binding = LIGHT_BINDING) readonly buffer LightBuffer {
+    int numLights;
+    Light lights[];
+};
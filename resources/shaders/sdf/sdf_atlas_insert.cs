@@ -0,0 +1,23 @@
+#version 430 core
+
+// Copies a baked sdf into its box of an atlas page without leaving the gpu,
+// quantizing it on the way. The page is writeonly so one shader covers
+// r32f, r16_snorm and r8_snorm pages, imageStore converts to the format.
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+layout (binding = 0) writeonly uniform image3D atlasPage;
+
+uniform sampler3D source;
+uniform ivec3 origin; // first voxel of the box in the page
+uniform vec2 scaleBias; // distance = normalized * scale + bias
+
+void main() {
+    ivec3 voxel = ivec3(gl_GlobalInvocationID.xyz);
+    if (any(greaterThanEqual(voxel, textureSize(source, 0)))) {
+        return;
+    }
+
+    // snorm pages clamp to [-1, 1] on store
+    float value = texelFetch(source, voxel, 0).r;
+    float normalized = (value - scaleBias.y) / scaleBias.x;
+    imageStore(atlasPage, origin + voxel, vec4(normalized, 0.0, 0.0, 0.0));
+}
@@ -1,8 +1,11 @@
 // SSBO, so 430 core is required
 
-uniform sampler2D atlas[6];
+#include "src/graphics/gpu_bindings.h"
+
+uniform sampler3D atlas[6];
 uniform int atlasSize;
 uniform int atlasStartIndex;
+uniform sampler2D brickAtlas;
 
 struct PackedSdfOffsetDetail {
     mat4 modelMat;
@@ -11,41 +14,97 @@ struct PackedSdfOffsetDetail {
     vec4 innerBBMax;
     vec4 outerBBMin;
     vec4 outerBBMax;
-    int atlasIndex;
-    int atlasOffset;
+    ivec4 atlasOrigin; // xyz = first voxel in the page, w = page
+    int brickCellOffset; // -1 when dense
+    int resolution; // voxels per axis
+    // atlas values are normalized * scale + bias
+    float distanceScale;
+    float distanceBias;
 };
 
-layout (std430, binding = 0) buffer PackedSdfOffsetDetailBuffer {
+layout (std430, binding = SDF_OBJECT_BINDING) buffer PackedSdfOffsetDetailBuffer {
     int offsetSize;
     PackedSdfOffsetDetail offsets[];
 };
 
-vec2 convert_world_to_texture(vec3 worldPos, vec3 boxMin, vec3 boxSize, int atlasOffset)
+// sparse sdfs, one cell per 8^3 voxels
+struct BrickCell {
+    int brickIndex; // -1 when the cell only keeps a distance
+    float distance;
+};
+
+layout (std430, binding = SDF_BRICK_CELL_BINDING) buffer BrickCellBuffer {
+    BrickCell brickCells[];
+};
+
+// keep in sync with sdf_generator_gpu_v2_shared.h
+const int SDF_BVH_MAX_DEPTH = 32;
+
+// top level bvh over the world boxes of the offsets, see SdfInstanceBvh.
+// data.x/y = children (inner) or data.x = offset (leaf), data.z = 1 on leaves
+// bb_min.w = smallest distance scale of the offsets below
+struct BvhNode {
+    vec4 bb_min;
+    vec4 bb_max;
+    ivec4 data;
+};
+
+layout (std430, binding = SDF_SHADOW_BVH_BINDING) buffer SdfBvhBuffer {
+    BvhNode sdfBvhNodes[];
+};
+uniform int sdfBvhNodeCount; // 0 tests every offset
+
+// one hardware trilinear fetch. Coordinates stay within the voxel centers of
+// the object so filtering never reads its neighbours in the page
+float distance_from_atlas(vec3 p, ivec4 atlasOrigin, int resolution, vec3 outerBBMin, vec3 outerBBMax)
 {
-    float textureWidth = 4096;
-    float textureHeight = 4096;
-
-    int cubeCount = 64;
-    vec3 texturePos3D = (worldPos - boxMin) / (boxSize / vec3(cubeCount));
-//    float x = clamp(texturePos3D.x, 0, 63);
-//    float y = clamp(texturePos3D.y, 0, 63);
-//    float z = clamp(floor(texturePos3D.z), 0, 63);
-    float x = texturePos3D.x;
-    float y = texturePos3D.y;
-    float z = floor(texturePos3D.z);
-
-    vec2 texturePos2D = vec2(
-        (x / textureWidth) + (z * 64.0 / textureWidth),
-        (y / textureHeight) + (atlasOffset * 64.0 / textureHeight)// Y coordinate
-    );
+    vec3 coord = (p - outerBBMin) / (outerBBMax - outerBBMin) * float(resolution);
+    coord = clamp(coord, vec3(0.5), vec3(float(resolution) - 0.5));
+    vec3 pageSize = vec3(textureSize(atlas[atlasOrigin.w], 0));
+    return texture(atlas[atlasOrigin.w], (vec3(atlasOrigin.xyz) + coord) / pageSize).r;
+}
+
+float brick_voxel(ivec3 v, int cellOffset, int resolution, vec2 scaleBias)
+{
+    v = clamp(v, ivec3(0), ivec3(resolution - 1));
+    int gridSize = (resolution + 7) / 8;
+    ivec3 cell = v / 8;
+    BrickCell brickCell = brickCells[cellOffset + (cell.z * gridSize + cell.y) * gridSize + cell.x];
+    if (brickCell.brickIndex < 0) {
+        return brickCell.distance;
+    }
 
-    return texturePos2D;
+    // 64 bricks per row, the 8 z slices of a brick are side by side
+    ivec3 local = v - cell * 8;
+    ivec2 texel = ivec2(
+        (brickCell.brickIndex % 64) * 64 + local.z * 8 + local.x,
+        (brickCell.brickIndex / 64) * 8 + local.y
+    );
+    return texelFetch(brickAtlas, texel, 0).r * scaleBias.x + scaleBias.y;
 }
 
-float distance_from_texture3D(vec3 p, int atlasIndex, int atlasOffset, vec3 outerBBMin, vec3 outerBBMax)
+// same as SdfBricked::sample
+float distance_from_bricks(vec3 p, int cellOffset, int resolution, vec2 scaleBias, vec3 outerBBMin, vec3 outerBBMax)
 {
-    vec2 uvCoord = convert_world_to_texture(p, outerBBMin, outerBBMax-outerBBMin, atlasOffset);
-    return texture(atlas[atlasIndex], uvCoord).r;
+    vec3 coord = (p - outerBBMin) / (outerBBMax - outerBBMin) * float(resolution) - vec3(0.5);
+    vec3 base = floor(coord);
+    vec3 t = coord - base;
+    ivec3 v = ivec3(base);
+
+    float c000 = brick_voxel(v, cellOffset, resolution, scaleBias);
+    float c100 = brick_voxel(v + ivec3(1, 0, 0), cellOffset, resolution, scaleBias);
+    float c010 = brick_voxel(v + ivec3(0, 1, 0), cellOffset, resolution, scaleBias);
+    float c110 = brick_voxel(v + ivec3(1, 1, 0), cellOffset, resolution, scaleBias);
+    float c001 = brick_voxel(v + ivec3(0, 0, 1), cellOffset, resolution, scaleBias);
+    float c101 = brick_voxel(v + ivec3(1, 0, 1), cellOffset, resolution, scaleBias);
+    float c011 = brick_voxel(v + ivec3(0, 1, 1), cellOffset, resolution, scaleBias);
+    float c111 = brick_voxel(v + ivec3(1, 1, 1), cellOffset, resolution, scaleBias);
+
+    float c00 = mix(c000, c100, t.x);
+    float c10 = mix(c010, c110, t.x);
+    float c01 = mix(c001, c101, t.x);
+    float c11 = mix(c011, c111, t.x);
+    return mix(mix(c00, c10, t.y), mix(c01, c11, t.y), t.z);
 }
 
 float distance_from_box_minmax(vec3 p, vec3 bbMin, vec3 bbMax) {
@@ -65,6 +124,81 @@ float get_scale_factor(mat4 invTransform, vec3 dir) {
     return (length(mat3(invTransform) * dir) + 0.00001);
 }
 
+// world space distance to offset j along rayWd, the sdf inside its outer
+// box and the inner box outside of it. Only offsets p is inside of cast
+// shadows
+void offset_distance(int j, vec3 p, vec3 rayWd, inout float closestDist, inout float shadowDist) {
+    mat4 invModelMat = offsets[j].invModelMat;
+    vec3 innerBBMin = vec3(offsets[j].innerBBMin);
+    vec3 innerBBMax = vec3(offsets[j].innerBBMax);
+    vec3 outerBBMin = vec3(offsets[j].outerBBMin);
+    vec3 outerBBMax = vec3(offsets[j].outerBBMax);
+    ivec4 atlasOrigin = offsets[j].atlasOrigin;
+    int brickCellOffset = offsets[j].brickCellOffset;
+    int resolution = offsets[j].resolution;
+    vec2 scaleBias = vec2(offsets[j].distanceScale, offsets[j].distanceBias);
+    float scaleFactor = get_scale_factor(invModelMat, rayWd);
+
+    vec3 rayLo = vec3(invModelMat * vec4(p, 1.0));
+
+    float dist = distance_from_box_minmax(rayLo, innerBBMin, innerBBMax);
+    float outerDist = distance_from_box_minmax(rayLo, outerBBMin, outerBBMax);
+    if(outerDist < 0.0) {
+        // inside the sdf
+        if (brickCellOffset >= 0) {
+            dist = distance_from_bricks(rayLo, brickCellOffset, resolution, scaleBias, outerBBMin, outerBBMax);
+        } else {
+            dist = distance_from_atlas(rayLo, atlasOrigin, resolution, outerBBMin, outerBBMax) * scaleBias.x + scaleBias.y;
+        }
+    }
+
+    // transform dist to world space
+    dist = dist / scaleFactor;
+    if (outerDist < 0.0) {
+        shadowDist = min(shadowDist, dist);
+    }
+    closestDist = min(closestDist, dist);
+}
+
+// least distance an offset below node can report, its box distance shrunk
+// by how much a non-uniform scale can stretch the local distance
+float bvh_node_distance(BvhNode node, vec3 p) {
+    return distance_from_box_minmax(p, vec3(node.bb_min), vec3(node.bb_max)) * node.bb_min.w;
+}
+
+// only visits offsets that can report less than the closest distance found
+// so far, which gives what testing every offset gives
+void bvh_distance(vec3 p, vec3 rayWd, inout float closestDist, inout float shadowDist) {
+    // at most one pending sibling per level, plus the two children just pushed
+    int stack[SDF_BVH_MAX_DEPTH + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        BvhNode node = sdfBvhNodes[stack[--stackSize]];
+        if (bvh_node_distance(node, p) > closestDist) {
+            continue;
+        }
+
+        if (node.data.z > 0) {
+            offset_distance(node.data.x, p, rayWd, closestDist, shadowDist);
+        } else {
+            BvhNode left = sdfBvhNodes[node.data.x];
+            BvhNode right = sdfBvhNodes[node.data.y];
+            float leftDist = bvh_node_distance(left, p);
+            float rightDist = bvh_node_distance(right, p);
+
+            // push the far child first, so the near one tightens the bound earlier
+            if (leftDist < rightDist) {
+                stack[stackSize++] = node.data.y;
+                stack[stackSize++] = node.data.x;
+            } else {
+                stack[stackSize++] = node.data.x;
+                stack[stackSize++] = node.data.y;
+            }
+        }
+    }
+}
+
 float raymarch(vec3 rayWo, vec3 rayWd, float maxTraceDist, out vec3 isectPos, out vec3 objectCenter) {
     const int NUMBER_OF_STEPS = 128;
     const float MINIMUM_HIT_DISTANCE = 0.001;
@@ -84,36 +218,11 @@ float raymarch(vec3 rayWo, vec3 rayWd, float maxTraceDist, out vec3 isectPos, ou
     {
         float shadowDist = 100000;
         float closestDist = 1000000;
-        int closestDistIndex = -1;
-        for(int j = 0; j < offsetSize; ++j)
-        {
-            mat4 invModelMat = offsets[j].invModelMat;
-            vec3 innerBBMin = vec3(offsets[j].innerBBMin);
-            vec3 innerBBMax = vec3(offsets[j].innerBBMax);
-            vec3 outerBBMin = vec3(offsets[j].outerBBMin);
-            vec3 outerBBMax = vec3(offsets[j].outerBBMax);
-            int atlasIndex = offsets[j].atlasIndex;
-            int atlasOffset = offsets[j].atlasOffset;
-            float scaleFactor = get_scale_factor(invModelMat, rayWd);
-
-            vec3 rayLo = vec3(invModelMat * vec4(rayWo, 1.0));
-            vec3 rayLd = vec3(normalize(invModelMat * vec4(rayWd, 0.0)));
-
-            float dist = distance_from_box_minmax(rayLo, innerBBMin, innerBBMax);
-            float outerDist = distance_from_box_minmax(rayLo, outerBBMin, outerBBMax);
-            if(outerDist < 0.0) {
-                // inside the sdf
-                dist = distance_from_texture3D(rayLo, atlasIndex, atlasOffset, outerBBMin, outerBBMax);
-            }
-
-            // transform dist to world space
-            dist = dist / scaleFactor;
-            if(dist < closestDist) {
-                if(outerDist < 0.0) {
-                    shadowDist = dist;
-                }
-                closestDist = dist;
-                closestDistIndex = j;
+        if (sdfBvhNodeCount > 0) {
+            bvh_distance(rayWo, rayWd, closestDist, shadowDist);
+        } else {
+            for (int j = 0; j < offsetSize; ++j) {
+                offset_distance(j, rayWo, rayWd, closestDist, shadowDist);
             }
         }
 
@@ -2,38 +2,53 @@
 
 #define GLSL 1
 
+#include "src/graphics/gpu_bindings.h"
+
 layout (local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
 layout (r32f, binding = 0) uniform image3D imgOutput;
 
-struct Vertex {
+// keep in sync with sdf_generator_gpu_v2_shared.h
+const int SDF_BVH_MAX_DEPTH = 32;
+
+struct SdfVertex {
     vec4 position;
-    vec4 normal;
-    vec2 tex_coords;
-    vec4 tangent;
-    vec4 bitangent;
-    ivec4 bone_ids;
-    vec4 weights;
 };
-layout (std430, binding = 2) buffer VertexBuffer {
-    Vertex vertices[];
+struct BvhNode {
+    vec4 bb_min;
+    vec4 bb_max;
+    ivec4 data;
+};
+struct ClosestTriangle {
+    float check_distance;
+    float distance;
+    vec3 point;
+    vec3 normal;
 };
-layout (std430, binding = 3) buffer IndexBuffer {
+
+layout (std430, binding = SDF_GEN_VERTEX_BINDING) buffer VertexBuffer {
+    SdfVertex vertices[];
+};
+layout (std430, binding = SDF_GEN_INDEX_BINDING) buffer IndexBuffer {
     uint indices[];
 };
-layout (std140, binding = 4) uniform BoundingBox {
+layout (std140, binding = SDF_GEN_BOUNDS_BINDING) uniform BoundingBox {
     ivec4 buffer_size;
     vec4 inner_bb_min;
     vec4 inner_bb_max;
     vec4 outer_bb_min;
     vec4 outer_bb_max;
 };
+layout (std430, binding = SDF_GEN_BVH_BINDING) buffer BvhBuffer {
+    BvhNode bvh_nodes[];
+};
 
 #include "src/graphics/sdf/sdf_generator_gpu_v2_shared.cpp"
 
 void main() {
     int vertices_size = buffer_size.x;
     int indices_size = buffer_size.y;
+    int bvh_nodes_size = buffer_size.z;
     ivec3 image_size = imageSize(imgOutput);
     generate_sdf(ivec3(gl_GlobalInvocationID.xyz), vertices_size, indices_size,
-        vec3(outer_bb_min), vec3(outer_bb_max), image_size);
+        bvh_nodes_size, vec3(outer_bb_min), vec3(outer_bb_max), image_size);
 }
\ No newline at end of file
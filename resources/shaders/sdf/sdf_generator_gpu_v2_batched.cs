@@ -0,0 +1,79 @@
+#version 430 core
+
+#define GLSL 1
+#define SDF_BUFFER_OUTPUT 1
+
+#include "src/graphics/gpu_bindings.h"
+
+// Bakes every mesh of a batch in one dispatch. Each mesh owns
+// gl_NumWorkGroups.x groups along z, so the dispatch is
+// (groups, groups, groups * mesh count) with groups = ceil(max res / 8).
+// Voxels past the resolution of their mesh return early.
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+
+// keep in sync with sdf_generator_gpu_v2_shared.h
+const int SDF_BVH_MAX_DEPTH = 32;
+
+struct SdfVertex {
+    vec4 position;
+};
+struct BvhNode {
+    vec4 bb_min;
+    vec4 bb_max;
+    ivec4 data;
+};
+struct SdfBatchMesh {
+    vec4 outer_bb_min;
+    vec4 outer_bb_max;
+    ivec4 data;
+};
+struct ClosestTriangle {
+    float check_distance;
+    float distance;
+    vec3 point;
+    vec3 normal;
+};
+
+// indices and nodes are already rebased onto the concatenated buffers
+layout (std430, binding = SDF_GEN_VERTEX_BINDING) buffer VertexBuffer {
+    SdfVertex vertices[];
+};
+layout (std430, binding = SDF_GEN_INDEX_BINDING) buffer IndexBuffer {
+    uint indices[];
+};
+layout (std430, binding = SDF_GEN_BVH_BINDING) buffer BvhBuffer {
+    BvhNode bvh_nodes[];
+};
+layout (std430, binding = SDF_GEN_MESH_BINDING) buffer MeshBuffer {
+    SdfBatchMesh meshes[];
+};
+// (z * res + y) * res + x, from the first voxel of every mesh
+layout (std430, binding = SDF_GEN_DISTANCE_BINDING) buffer DistanceBuffer {
+    float distances[];
+};
+
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.cpp"
+
+void main() {
+    int groups = int(gl_NumWorkGroups.x);
+    int mesh_index = int(gl_WorkGroupID.z) / groups;
+    SdfBatchMesh mesh = meshes[mesh_index];
+
+    int resolution = mesh.data.y;
+    ivec3 texel_coord = ivec3(gl_GlobalInvocationID.xyz);
+    texel_coord.z -= mesh_index * groups * int(gl_WorkGroupSize.z);
+    if (any(greaterThanEqual(texel_coord, ivec3(resolution)))) {
+        return;
+    }
+
+    float shortest_distance = no_triangle().distance;
+    if (mesh.data.w > 0) {
+        vec3 p = voxel_center(texel_coord, vec3(mesh.outer_bb_min),
+            vec3(mesh.outer_bb_max), ivec3(resolution));
+        shortest_distance =
+            signed_distance(p, closest_triangle_bvh(p, mesh.data.x));
+    }
+    int voxel = (texel_coord.z * resolution + texel_coord.y) * resolution +
+        texel_coord.x;
+    distances[mesh.data.z + voxel] = shortest_distance;
+}
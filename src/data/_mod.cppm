@@ -7,6 +7,7 @@ export module data;
 export import :bounding_box;
 export import :color;
 export import :file_system;
+export import :frustum;
 export import :logger;
 export import :operation;
 export import :scene_node;
@@ -3,6 +3,7 @@
 //
 module;
 
+#include <cmath>
 #include <glm/glm.hpp>
 
 export module data:bounding_box;
@@ -28,6 +29,20 @@ public:
     return BoundingBox(newMin, newMax);
   }
 
+  // box around the 8 corners moved by m
+  BoundingBox transform(const mat4 &m) const {
+    vec3 newMin = vec3(INFINITY);
+    vec3 newMax = vec3(-INFINITY);
+    for (int i = 0; i < 8; ++i) {
+      vec3 corner = vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y,
+                         i & 4 ? max.z : min.z);
+      vec3 moved = vec3(m * vec4(corner, 1.0));
+      newMin = glm::min(newMin, moved);
+      newMax = glm::max(newMax, moved);
+    }
+    return BoundingBox(newMin, newMax);
+  }
+
   vec3 getCenter() const { return this->center; }
 
   vec3 getSize() const { return this->max - this->min; }
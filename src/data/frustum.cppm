@@ -0,0 +1,66 @@
+module;
+
+#include <glm/glm.hpp>
+
+export module data:frustum;
+import :bounding_box;
+
+using namespace glm;
+
+export namespace ale::data {
+
+enum class FrustumTest { OUTSIDE, INTERSECT, INSIDE };
+
+// The 6 planes of a view frustum, pulled out of a projection * view matrix
+// (Gribb and Hartmann). Normals point inside, a point p is inside a plane
+// when dot(plane.xyz, p) + plane.w >= 0.
+class Frustum {
+public:
+  enum Plane { LEFT, RIGHT, BOTTOM, TOP, Z_NEAR, Z_FAR, PLANE_COUNT };
+
+  vec4 planes[PLANE_COUNT];
+
+  Frustum() = default;
+
+  explicit Frustum(const mat4 &view_projection) {
+    mat4 m = transpose(view_projection);
+    planes[LEFT] = m[3] + m[0];
+    planes[RIGHT] = m[3] - m[0];
+    planes[BOTTOM] = m[3] + m[1];
+    planes[TOP] = m[3] - m[1];
+    planes[Z_NEAR] = m[3] + m[2];
+    planes[Z_FAR] = m[3] - m[2];
+    for (auto &plane: planes) {
+      plane /= length(vec3(plane));
+    }
+  }
+
+  // Conservative, a box near a corner of the frustum can pass while being
+  // outside of it. INSIDE means every corner is inside every plane
+  FrustumTest test(vec3 min, vec3 max) const {
+    auto result = FrustumTest::INSIDE;
+    for (auto &plane: planes) {
+      vec3 normal = vec3(plane);
+      // the corners furthest along and against the normal
+      vec3 positive = mix(min, max, greaterThanEqual(normal, vec3(0.0f)));
+      vec3 negative = mix(max, min, greaterThanEqual(normal, vec3(0.0f)));
+      if (dot(normal, positive) + plane.w < 0.0f) {
+        return FrustumTest::OUTSIDE;
+      }
+      if (dot(normal, negative) + plane.w < 0.0f) {
+        result = FrustumTest::INTERSECT;
+      }
+    }
+    return result;
+  }
+
+  FrustumTest test(const BoundingBox &box) const {
+    return test(box.min, box.max);
+  }
+
+  bool intersects(const BoundingBox &box) const {
+    return test(box) != FrustumTest::OUTSIDE;
+  }
+};
+
+} // namespace ale::data
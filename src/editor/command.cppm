@@ -38,8 +38,13 @@ struct LoadWorldCmd {
 struct CameraLookAtEntityCmd {
   entt::entity entity;
 };
+// a loaded mesh changed on disk
+struct ReloadStaticMeshCmd {
+  std::string path;
+};
 
 using Cmd = std::variant<ExitCmd, NewWorldCmd, NewObjectCmd, ItemInspector::Cmd,
                          TransformChangeNotif, UndoCmd, RedoCmd, SaveWorldCmd,
-                         LoadWorldCmd, CameraLookAtEntityCmd>;
+                         LoadWorldCmd, CameraLookAtEntityCmd,
+                         ReloadStaticMeshCmd>;
 } // namespace ale::editor
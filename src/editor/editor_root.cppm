@@ -7,6 +7,7 @@ module;
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 // clang-format on
+#include <chrono>
 #include <entt/entt.hpp>
 #include <filesystem>
 #include <glm/glm.hpp>
@@ -76,6 +77,11 @@ private:
   history::HistoryStack history_stack;
   vector<Cmd> callback_cmds;
 
+  // loaded meshes are checked for changes on disk this often, so a mesh
+  // saved from a modelling tool shows up in the scene
+  static constexpr auto MESH_POLL_INTERVAL = chrono::seconds(1);
+  chrono::steady_clock::time_point last_mesh_poll;
+
 public:
   entt::registry new_world(StaticMeshLoader &sm_loader) {
     // Create world
@@ -116,12 +122,15 @@ public:
   }
 
 public:
-  EditorRoot(StaticMeshLoader &sm_loader,
-             shared_ptr<Stash<Texture>> texture_stash,
-             ivec2 initial_window_size) :
+  // world_bounds is shared with the renderer of the edited world
+  EditorRoot(
+      StaticMeshLoader &sm_loader, shared_ptr<Stash<Texture>> texture_stash,
+      ivec2 initial_window_size,
+      shared_ptr<WorldBounds> world_bounds = make_shared<WorldBounds>()) :
       gizmo_frame(Framebuffer::Meta{.width = initial_window_size.x,
                                     .height = initial_window_size.y,
                                     .color_space = Framebuffer::LINEAR}),
+      gizmo(std::move(world_bounds)),
       content_browser_ui(sm_loader, texture_stash,
                          afs::root("resources/models/content_browser")),
       scene_viewport_ui(initial_window_size),
@@ -321,6 +330,14 @@ public:
     cmds.insert(cmds.end(), callback_cmds.begin(), callback_cmds.end());
     callback_cmds.clear();
 
+    auto now = chrono::steady_clock::now();
+    if (now - last_mesh_poll >= MESH_POLL_INTERVAL) {
+      last_mesh_poll = now;
+      for (auto &path: sm_loader.poll_changed_files()) {
+        cmds.emplace_back(ReloadStaticMeshCmd{path});
+      }
+    }
+
     handle_editor_cmds(cmds, window, sm_loader, world, camera);
 
     camera.set_handle_input(get_scene_has_focus());
@@ -429,6 +446,13 @@ public:
             if (transform != nullptr) {
               camera.set_look_at(transform->translation);
             }
+          },
+          [&](ReloadStaticMeshCmd &arg) {
+            try {
+              sm_loader.reload_static_mesh(arg.path, world);
+            } catch (const std::exception &e) {
+              std::cout << "Reload static mesh error, " << e.what();
+            }
           });
     }
   }
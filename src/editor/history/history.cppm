@@ -31,14 +31,14 @@ public:
     if (transform == nullptr) {
       return;
     }
-    *transform = after;
+    world.replace<Transform>(entity, after);
   }
   void undo(entt::registry &world) override {
     auto transform = world.try_get<Transform>(entity);
     if (transform == nullptr) {
       return;
     }
-    *transform = before;
+    world.replace<Transform>(entity, before);
   }
 };
 
@@ -64,9 +64,12 @@ public:
         inspect_text("Name", scene_node->name);
       }
       if (create_section("Transform", transform)) {
-        inspect_vec3f("Pos", transform->translation);
-        inspect_vec3f("Scale", transform->scale);
+        bool changed = inspect_vec3f("Pos", transform->translation);
+        changed |= inspect_vec3f("Scale", transform->scale);
         inspect_quat("Rot", transform->rotation);
+        if (changed) {
+          world.patch<Transform>(*entity);
+        }
       }
       if (create_section("Basic Material", basic_material)) {
         inspect_vec3f("Diffuse Color", basic_material->diffuse_color);
@@ -110,10 +113,13 @@ private:
     ImGui::Columns(1);
   }
 
-  void inspect_vec3f(std::string name, glm::vec3 &v) {
+  // true when v was edited
+  bool inspect_vec3f(std::string name, glm::vec3 &v) {
+    bool changed = false;
     separate_two(name, [&]() {
-      ImGui::InputFloat3(std::format("##{}", name).c_str(), &v[0]);
+      changed = ImGui::InputFloat3(std::format("##{}", name).c_str(), &v[0]);
     });
+    return changed;
   }
 
   // void inspect_vec4(std::string name, glm::vec4 &v);
@@ -1,5 +1,6 @@
 export module graphics;
 
+export import :aabb_tree;
 export import :camera;
 export import :compute_shader;
 export import :framebuffer;
@@ -17,8 +18,24 @@ export import :static_mesh;
 export import :texture;
 export import :thumbnail_generator;
 export import :window;
+export import :world_bounds;
+export import :world_tracker;
+export import :sdf.sdf_atlas_packer;
+export import :sdf.sdf_baker_cpu;
+export import :sdf.sdf_bricked;
+export import :sdf.sdf_bvh;
+export import :sdf.sdf_cache;
 export import :sdf.sdf_generator_gpu;
 export import :sdf.sdf_generator_gpu_v2;
+export import :sdf.sdf_instance_bvh;
+export import :sdf.sdf_quantize;
+export import :sdf.sdf_renderer_cpu;
+export import :sdf.sdf_resolution;
+export import :sdf.sdf_shadow_casters;
+export import :sdf.sdf_shadow_cpu;
+export import :sdf.sdf_winding_number;
 export import :renderer.basic_renderer;
 export import :renderer.deferred_renderer;
+export import :renderer.frame_constants;
+export import :renderer.render_queue;
 export import :font;
@@ -0,0 +1,427 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <utility>
+#include <vector>
+
+export module graphics:aabb_tree;
+import data;
+import :ray;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+
+export namespace ale::graphics {
+
+// Dynamic bounding volume tree over world space boxes, for objects that
+// come, go and move one at a time. Leaves hold a box grown by a margin so
+// small moves refit without touching the tree; inserts pick the sibling
+// that adds the least surface area and rotations keep the tree balanced
+// like an avl tree (the scheme of Box2D's b2DynamicTree).
+//
+// A proxy is the index of its leaf node and stays valid until removed.
+template <typename T> class AabbTree {
+public:
+  static constexpr int NONE = -1;
+  // leaves grow by this much of their size on every side, plus FAT_MIN
+  static constexpr float FAT_RATIO = 0.1f;
+  static constexpr float FAT_MIN = 0.05f;
+
+  int insert(const BoundingBox &box, T item) {
+    int proxy = allocate();
+    auto &leaf = nodes[proxy];
+    fatten(box, leaf.min, leaf.max);
+    leaf.item = std::move(item);
+    insert_leaf(proxy);
+    ++leaf_count;
+    return proxy;
+  }
+
+  void remove(int proxy) {
+    remove_leaf(proxy);
+    release(proxy);
+    --leaf_count;
+  }
+
+  // Moves proxy to box. The tree is left alone while box stays inside the
+  // fat box, and that did not grow much bigger than box needs. Returns
+  // whether the leaf was reinserted
+  bool refit(int proxy, const BoundingBox &box) {
+    auto &leaf = nodes[proxy];
+    vec3 fat_min, fat_max;
+    fatten(box, fat_min, fat_max);
+    vec3 loose = (fat_max - fat_min) * 2.0f;
+    bool inside = all(lessThanEqual(leaf.min, box.min)) &&
+                  all(greaterThanEqual(leaf.max, box.max));
+    bool tight = all(greaterThanEqual(leaf.min, fat_min - loose)) &&
+                 all(lessThanEqual(leaf.max, fat_max + loose));
+    if (inside && tight) {
+      return false;
+    }
+
+    remove_leaf(proxy);
+    leaf.min = fat_min;
+    leaf.max = fat_max;
+    insert_leaf(proxy);
+    return true;
+  }
+
+  void clear() {
+    nodes.clear();
+    free_nodes.clear();
+    root = NONE;
+    leaf_count = 0;
+  }
+
+  const T &get(int proxy) const { return nodes[proxy].item; }
+
+  BoundingBox get_fat_box(int proxy) const {
+    return BoundingBox(nodes[proxy].min, nodes[proxy].max);
+  }
+
+  int size() const { return leaf_count; }
+
+  int height() const { return root == NONE ? 0 : nodes[root].height; }
+
+  // visit(item) for every leaf whose fat box overlaps box
+  template <typename F>
+  void query_box(const BoundingBox &box, F &&visit) const {
+    if (root == NONE) {
+      return;
+    }
+    vector<int> stack = {root};
+    while (!stack.empty()) {
+      auto &node = nodes[stack.back()];
+      stack.pop_back();
+      if (any(lessThan(node.max, box.min)) ||
+          any(greaterThan(node.min, box.max))) {
+        continue;
+      }
+      if (node.is_leaf()) {
+        visit(node.item);
+      } else {
+        stack.push_back(node.left);
+        stack.push_back(node.right);
+      }
+    }
+  }
+
+  // Splits the tree into at least count disjoint subtrees that cover every
+  // leaf, fewer when it has fewer leaves, for spreading a query over
+  // threads. The roots are only good until the tree changes
+  vector<int> subtrees(int count) const {
+    vector<int> roots;
+    if (root != NONE) {
+      roots.push_back(root);
+    }
+    // split the tallest until there are enough
+    while ((int) roots.size() < count) {
+      auto tallest = max_element(roots.begin(), roots.end(), [&](int a, int b) {
+        return nodes[a].height < nodes[b].height;
+      });
+      if (tallest == roots.end() || nodes[*tallest].is_leaf()) {
+        break;
+      }
+      int index = *tallest;
+      *tallest = nodes[index].left;
+      roots.push_back(nodes[index].right);
+    }
+    return roots;
+  }
+
+  // visit(item) for every leaf whose fat box may be in the frustum, subtrees
+  // fully inside are handed out without testing their nodes. subtree limits
+  // the query to one of the roots from subtrees()
+  template <typename F>
+  void query_frustum(const Frustum &frustum, F &&visit,
+                     int subtree = NONE) const {
+    int start = subtree == NONE ? root : subtree;
+    if (start == NONE) {
+      return;
+    }
+    vector<pair<int, bool>> stack = {{start, false}};
+    while (!stack.empty()) {
+      auto [index, inside] = stack.back();
+      stack.pop_back();
+      auto &node = nodes[index];
+      if (!inside) {
+        auto test = frustum.test(node.min, node.max);
+        if (test == FrustumTest::OUTSIDE) {
+          continue;
+        }
+        inside = test == FrustumTest::INSIDE;
+      }
+      if (node.is_leaf()) {
+        visit(node.item);
+      } else {
+        stack.emplace_back(node.left, inside);
+        stack.emplace_back(node.right, inside);
+      }
+    }
+  }
+
+  // Leaves whose fat box the ray enters before t_max, nearest subtree first.
+  // visit(item, t) gets where the ray enters the box, in units of ray.dir,
+  // and returns the new t_max, so boxes starting behind the closest hit so
+  // far are skipped. Return t_max unchanged to see every box
+  template <typename F>
+  void query_ray(const Ray &ray, float t_max, F &&visit) const {
+    if (root == NONE) {
+      return;
+    }
+    vec3 inv_dir = 1.0f / ray.dir;
+    float t = enter(nodes[root], ray.origin, inv_dir, t_max);
+    if (t == INFINITY) {
+      return;
+    }
+
+    vector<pair<int, float>> stack = {{root, t}};
+    while (!stack.empty()) {
+      auto [index, t_enter] = stack.back();
+      stack.pop_back();
+      // t_max may have dropped since this was pushed
+      if (t_enter > t_max) {
+        continue;
+      }
+      auto &node = nodes[index];
+      if (node.is_leaf()) {
+        t_max = std::min(t_max, (float) visit(node.item, t_enter));
+        continue;
+      }
+
+      float t_left = enter(nodes[node.left], ray.origin, inv_dir, t_max);
+      float t_right = enter(nodes[node.right], ray.origin, inv_dir, t_max);
+      pair<int, float> closer = {node.left, t_left};
+      pair<int, float> further = {node.right, t_right};
+      if (t_right < t_left) {
+        swap(closer, further);
+      }
+      if (further.second < INFINITY) {
+        stack.push_back(further);
+      }
+      if (closer.second < INFINITY) {
+        stack.push_back(closer);
+      }
+    }
+  }
+
+private:
+  struct Node {
+    vec3 min = vec3(0.0f);
+    vec3 max = vec3(0.0f);
+    int parent = NONE;
+    int left = NONE; // NONE for leaves
+    int right = NONE;
+    int height = 0; // leaves are 0
+    T item{};
+
+    bool is_leaf() const { return left == NONE; }
+  };
+
+  vector<Node> nodes;
+  vector<int> free_nodes;
+  int root = NONE;
+  int leaf_count = 0;
+
+  static void fatten(const BoundingBox &box, vec3 &min, vec3 &max) {
+    vec3 margin = (box.max - box.min) * FAT_RATIO + FAT_MIN;
+    min = box.min - margin;
+    max = box.max + margin;
+  }
+
+  static float area(vec3 min, vec3 max) {
+    vec3 size = max - min;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+  }
+
+  // t where the ray enters node, clamped to 0, INFINITY when it misses it
+  // before t_max. nan from a ray in the plane of a slab leaves that slab out
+  static float enter(const Node &node, vec3 origin, vec3 inv_dir,
+                     float t_max) {
+    float t_near = 0.0f;
+    float t_far = t_max;
+    for (int axis = 0; axis < 3; ++axis) {
+      float t1 = (node.min[axis] - origin[axis]) * inv_dir[axis];
+      float t2 = (node.max[axis] - origin[axis]) * inv_dir[axis];
+      t_near = std::max(t_near, std::min(t1, t2));
+      t_far = std::min(t_far, std::max(t1, t2));
+    }
+    return t_near <= t_far ? t_near : INFINITY;
+  }
+
+  int allocate() {
+    if (free_nodes.empty()) {
+      nodes.emplace_back();
+      return nodes.size() - 1;
+    }
+    int index = free_nodes.back();
+    free_nodes.pop_back();
+    nodes[index] = Node{};
+    return index;
+  }
+
+  void release(int index) {
+    nodes[index] = Node{};
+    free_nodes.push_back(index);
+  }
+
+  void fit(int index) {
+    auto &node = nodes[index];
+    auto &left = nodes[node.left];
+    auto &right = nodes[node.right];
+    node.min = glm::min(left.min, right.min);
+    node.max = glm::max(left.max, right.max);
+    node.height = 1 + std::max(left.height, right.height);
+  }
+
+  void insert_leaf(int leaf) {
+    if (root == NONE) {
+      root = leaf;
+      nodes[leaf].parent = NONE;
+      return;
+    }
+
+    // walk down to the sibling that costs the least area, a node pays for
+    // the growth of every ancestor on the way
+    vec3 leaf_min = nodes[leaf].min;
+    vec3 leaf_max = nodes[leaf].max;
+    int sibling = root;
+    while (!nodes[sibling].is_leaf()) {
+      auto &node = nodes[sibling];
+      float node_area = area(node.min, node.max);
+      float combined = area(glm::min(node.min, leaf_min),
+                            glm::max(node.max, leaf_max));
+      // a new parent here, or pushing the leaf further down
+      float cost = 2.0f * combined;
+      float inherited = 2.0f * (combined - node_area);
+
+      auto child_cost = [&](int index) {
+        auto &child = nodes[index];
+        float grown = area(glm::min(child.min, leaf_min),
+                           glm::max(child.max, leaf_max));
+        if (child.is_leaf()) {
+          return grown + inherited;
+        }
+        return grown - area(child.min, child.max) + inherited;
+      };
+      float cost_left = child_cost(node.left);
+      float cost_right = child_cost(node.right);
+
+      if (cost < cost_left && cost < cost_right) {
+        break;
+      }
+      sibling = cost_left < cost_right ? node.left : node.right;
+    }
+
+    int old_parent = nodes[sibling].parent;
+    int parent = allocate();
+    nodes[parent].parent = old_parent;
+    nodes[parent].left = sibling;
+    nodes[parent].right = leaf;
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+    if (old_parent == NONE) {
+      root = parent;
+    } else if (nodes[old_parent].left == sibling) {
+      nodes[old_parent].left = parent;
+    } else {
+      nodes[old_parent].right = parent;
+    }
+
+    refit_ancestors(parent);
+  }
+
+  void remove_leaf(int leaf) {
+    if (leaf == root) {
+      root = NONE;
+      return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grand_parent = nodes[parent].parent;
+    int sibling = nodes[parent].left == leaf ? nodes[parent].right
+                                             : nodes[parent].left;
+    nodes[sibling].parent = grand_parent;
+    release(parent);
+    nodes[leaf].parent = NONE;
+    if (grand_parent == NONE) {
+      root = sibling;
+      return;
+    }
+
+    if (nodes[grand_parent].left == parent) {
+      nodes[grand_parent].left = sibling;
+    } else {
+      nodes[grand_parent].right = sibling;
+    }
+    refit_ancestors(grand_parent);
+  }
+
+  void refit_ancestors(int index) {
+    while (index != NONE) {
+      index = balance(index);
+      fit(index);
+      index = nodes[index].parent;
+    }
+  }
+
+  // Rotates the taller child of a up when the heights of its children are
+  // more than 1 apart. Returns the node now at the place of a
+  int balance(int a) {
+    if (nodes[a].is_leaf() || nodes[a].height < 2) {
+      return a;
+    }
+    int b = nodes[a].left;
+    int c = nodes[a].right;
+    int difference = nodes[c].height - nodes[b].height;
+    if (difference > 1) {
+      return rotate(a, c, b, false);
+    }
+    if (difference < -1) {
+      return rotate(a, b, c, true);
+    }
+    return a;
+  }
+
+  // up is the taller child of a, other the shorter one. up takes the place
+  // of a, a keeps other and the shorter child of up
+  int rotate(int a, int up, int other, bool up_is_left) {
+    int f = nodes[up].left;
+    int g = nodes[up].right;
+    if (nodes[f].height < nodes[g].height) {
+      swap(f, g);
+    }
+    // f is the taller grandchild and stays under up, g moves to a
+
+    int parent = nodes[a].parent;
+    nodes[up].parent = parent;
+    nodes[a].parent = up;
+    if (parent == NONE) {
+      root = up;
+    } else if (nodes[parent].left == a) {
+      nodes[parent].left = up;
+    } else {
+      nodes[parent].right = up;
+    }
+
+    nodes[up].left = a;
+    nodes[up].right = f;
+    if (up_is_left) {
+      nodes[a].left = g;
+      nodes[a].right = other;
+    } else {
+      nodes[a].left = other;
+      nodes[a].right = g;
+    }
+    nodes[g].parent = a;
+
+    fit(a);
+    fit(up);
+    return up;
+  }
+};
+
+} // namespace ale::graphics
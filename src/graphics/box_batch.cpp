@@ -0,0 +1,446 @@
+#include "box_batch.h"
+
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+BoxBatch::BoxBatch() { clear(); }
+
+void BoxBatch::add(vec3 min, vec3 max) {
+  for (auto &field: fields) {
+    field.resize(size + 1 + PADDING, 0.0f);
+  }
+  ++size;
+  set(size - 1, min, max);
+}
+
+void BoxBatch::set(int i, vec3 min, vec3 max) {
+  for (int axis = 0; axis < 3; ++axis) {
+    fields[MIN_X + axis][i] = min[axis];
+    fields[MAX_X + axis][i] = max[axis];
+  }
+}
+
+void BoxBatch::clear() {
+  size = 0;
+  for (auto &field: fields) {
+    field.assign(PADDING, 0.0f);
+  }
+}
+
+// -- scalar --------------------------------------------------------------
+
+// min and max the way _mm_min_ps and _mm_max_ps pick, the second operand
+// when either is nan, so every level handles 0 * inf alike
+static inline float min_ps(float a, float b) { return a < b ? a : b; }
+static inline float max_ps(float a, float b) { return a > b ? a : b; }
+
+// t where the ray hits box i, INFINITY when it misses
+static float hit_scalar(const BoxBatch &batch, vec3 origin, vec3 inv_dir,
+                        int i, float t_min, float t_max) {
+  using F = BoxBatch;
+  float t_near = -INFINITY;
+  float t_far = INFINITY;
+  for (int axis = 0; axis < 3; ++axis) {
+    float t1 = (batch.get(F::Field(F::MIN_X + axis))[i] - origin[axis]) *
+               inv_dir[axis];
+    float t2 = (batch.get(F::Field(F::MAX_X + axis))[i] - origin[axis]) *
+               inv_dir[axis];
+    t_near = max_ps(min_ps(t1, t2), t_near);
+    t_far = min_ps(max_ps(t1, t2), t_far);
+  }
+  float t = t_near > t_min ? t_near : t_far;
+  bool hit = t_far >= t_near && t > t_min && t < t_max;
+  return hit ? t : INFINITY;
+}
+
+static BoxHit nearest_scalar(const BoxBatch &batch, vec3 origin,
+                             vec3 inv_dir, float t_min, float t_max) {
+  BoxHit best;
+  for (int i = 0; i < batch.size; ++i) {
+    float t = hit_scalar(batch, origin, inv_dir, i, t_min, t_max);
+    if (t < best.t) {
+      best = BoxHit{i, t};
+    }
+  }
+  return best;
+}
+
+// lanes hold t and box index, the smallest t wins and ties go to the lower
+// index
+static BoxHit reduce_lanes(const float *t, const int *index, int lanes) {
+  BoxHit best;
+  for (int i = 0; i < lanes; ++i) {
+    if (t[i] < best.t || (t[i] == best.t && t[i] < INFINITY &&
+                          index[i] < best.index)) {
+      best = BoxHit{index[i], t[i]};
+    }
+  }
+  return best;
+}
+
+#if ALE_X86
+
+// -- sse -----------------------------------------------------------------
+
+struct Ray4 {
+  __m128 ox, oy, oz, ix, iy, iz;
+};
+
+// t of 4 rays against 4 boxes lane by lane, INFINITY for misses. min_*
+// and max_* are the box bounds
+static inline __m128 hit_sse(const Ray4 &ray, __m128 min_x, __m128 min_y,
+                             __m128 min_z, __m128 max_x, __m128 max_y,
+                             __m128 max_z, __m128 t_min, __m128 t_max) {
+  __m128 tx1 = _mm_mul_ps(_mm_sub_ps(min_x, ray.ox), ray.ix);
+  __m128 tx2 = _mm_mul_ps(_mm_sub_ps(max_x, ray.ox), ray.ix);
+  __m128 ty1 = _mm_mul_ps(_mm_sub_ps(min_y, ray.oy), ray.iy);
+  __m128 ty2 = _mm_mul_ps(_mm_sub_ps(max_y, ray.oy), ray.iy);
+  __m128 tz1 = _mm_mul_ps(_mm_sub_ps(min_z, ray.oz), ray.iz);
+  __m128 tz2 = _mm_mul_ps(_mm_sub_ps(max_z, ray.oz), ray.iz);
+
+  // same order as hit_scalar
+  __m128 t_near = _mm_set1_ps(-INFINITY);
+  __m128 t_far = _mm_set1_ps(INFINITY);
+  t_near = _mm_max_ps(_mm_min_ps(tx1, tx2), t_near);
+  t_far = _mm_min_ps(_mm_max_ps(tx1, tx2), t_far);
+  t_near = _mm_max_ps(_mm_min_ps(ty1, ty2), t_near);
+  t_far = _mm_min_ps(_mm_max_ps(ty1, ty2), t_far);
+  t_near = _mm_max_ps(_mm_min_ps(tz1, tz2), t_near);
+  t_far = _mm_min_ps(_mm_max_ps(tz1, tz2), t_far);
+
+  __m128 use_near = _mm_cmpgt_ps(t_near, t_min);
+  __m128 t = _mm_or_ps(_mm_and_ps(use_near, t_near),
+                       _mm_andnot_ps(use_near, t_far));
+  __m128 hit = _mm_and_ps(_mm_cmpge_ps(t_far, t_near),
+                          _mm_and_ps(_mm_cmpgt_ps(t, t_min),
+                                     _mm_cmplt_ps(t, t_max)));
+  return _mm_or_ps(_mm_and_ps(hit, t),
+                   _mm_andnot_ps(hit, _mm_set1_ps(INFINITY)));
+}
+
+static inline Ray4 broadcast_sse(vec3 origin, vec3 inv_dir) {
+  return Ray4{_mm_set1_ps(origin.x),  _mm_set1_ps(origin.y),
+              _mm_set1_ps(origin.z),  _mm_set1_ps(inv_dir.x),
+              _mm_set1_ps(inv_dir.y), _mm_set1_ps(inv_dir.z)};
+}
+
+// boxes [i, i + 4), lanes past the last box miss
+static inline __m128 boxes_sse(const BoxBatch &batch, const Ray4 &ray, int i,
+                               __m128 t_min, __m128 t_max) {
+  using F = BoxBatch;
+  __m128 t = hit_sse(ray, _mm_loadu_ps(batch.get(F::MIN_X) + i),
+                     _mm_loadu_ps(batch.get(F::MIN_Y) + i),
+                     _mm_loadu_ps(batch.get(F::MIN_Z) + i),
+                     _mm_loadu_ps(batch.get(F::MAX_X) + i),
+                     _mm_loadu_ps(batch.get(F::MAX_Y) + i),
+                     _mm_loadu_ps(batch.get(F::MAX_Z) + i), t_min, t_max);
+  __m128i index = _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+  __m128 inside =
+      _mm_castsi128_ps(_mm_cmplt_epi32(index, _mm_set1_epi32(batch.size)));
+  return _mm_or_ps(_mm_and_ps(inside, t),
+                   _mm_andnot_ps(inside, _mm_set1_ps(INFINITY)));
+}
+
+static BoxHit nearest_sse(const BoxBatch &batch, vec3 origin, vec3 inv_dir,
+                          float t_min, float t_max) {
+  Ray4 ray = broadcast_sse(origin, inv_dir);
+  __m128 t_min4 = _mm_set1_ps(t_min);
+  __m128 t_max4 = _mm_set1_ps(t_max);
+  __m128 best_t = _mm_set1_ps(INFINITY);
+  __m128i best_index = _mm_set1_epi32(-1);
+  __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+  for (int i = 0; i < batch.size; i += 4) {
+    __m128 t = boxes_sse(batch, ray, i, t_min4, t_max4);
+    // strictly closer, so every lane keeps its lowest index on ties
+    __m128i closer = _mm_castps_si128(_mm_cmplt_ps(t, best_t));
+    best_t = _mm_min_ps(t, best_t);
+    best_index = _mm_or_si128(_mm_and_si128(closer, index),
+                              _mm_andnot_si128(closer, best_index));
+    index = _mm_add_epi32(index, _mm_set1_epi32(4));
+  }
+  alignas(16) float lanes_t[4];
+  alignas(16) int lanes_index[4];
+  _mm_store_ps(lanes_t, best_t);
+  _mm_store_si128((__m128i *) lanes_index, best_index);
+  return reduce_lanes(lanes_t, lanes_index, 4);
+}
+
+static void all_sse(const BoxBatch &batch, vec3 origin, vec3 inv_dir,
+                    float t_min, float t_max, vector<BoxHit> &hits) {
+  Ray4 ray = broadcast_sse(origin, inv_dir);
+  __m128 t_min4 = _mm_set1_ps(t_min);
+  __m128 t_max4 = _mm_set1_ps(t_max);
+  alignas(16) float lanes[4];
+  for (int i = 0; i < batch.size; i += 4) {
+    __m128 t = boxes_sse(batch, ray, i, t_min4, t_max4);
+    int mask = _mm_movemask_ps(_mm_cmplt_ps(t, _mm_set1_ps(INFINITY)));
+    if (mask == 0) {
+      continue;
+    }
+    _mm_store_ps(lanes, t);
+    for (int lane = 0; lane < 4; ++lane) {
+      if (mask & (1 << lane)) {
+        hits.push_back(BoxHit{i + lane, lanes[lane]});
+      }
+    }
+  }
+}
+
+// 4 rays at a time against every box, one box per iteration
+static void packet_sse(const BoxBatch &batch, const vec3 *origins,
+                       const vec3 *inv_dirs, int count, BoxHit *out,
+                       float t_min, float t_max) {
+  using F = BoxBatch;
+  __m128 t_min4 = _mm_set1_ps(t_min);
+  __m128 t_max4 = _mm_set1_ps(t_max);
+  for (int first = 0; first < count; first += 4) {
+    // the last packet repeats its last ray in the lanes past count
+    alignas(16) float lanes[6][4];
+    for (int lane = 0; lane < 4; ++lane) {
+      int ray = std::min(first + lane, count - 1);
+      for (int axis = 0; axis < 3; ++axis) {
+        lanes[axis][lane] = origins[ray][axis];
+        lanes[3 + axis][lane] = inv_dirs[ray][axis];
+      }
+    }
+    Ray4 ray = Ray4{_mm_load_ps(lanes[0]), _mm_load_ps(lanes[1]),
+                    _mm_load_ps(lanes[2]), _mm_load_ps(lanes[3]),
+                    _mm_load_ps(lanes[4]), _mm_load_ps(lanes[5])};
+
+    __m128 best_t = _mm_set1_ps(INFINITY);
+    __m128i best_index = _mm_set1_epi32(-1);
+    for (int i = 0; i < batch.size; ++i) {
+      __m128 t = hit_sse(ray, _mm_set1_ps(batch.get(F::MIN_X)[i]),
+                         _mm_set1_ps(batch.get(F::MIN_Y)[i]),
+                         _mm_set1_ps(batch.get(F::MIN_Z)[i]),
+                         _mm_set1_ps(batch.get(F::MAX_X)[i]),
+                         _mm_set1_ps(batch.get(F::MAX_Y)[i]),
+                         _mm_set1_ps(batch.get(F::MAX_Z)[i]), t_min4, t_max4);
+      __m128i closer = _mm_castps_si128(_mm_cmplt_ps(t, best_t));
+      best_t = _mm_min_ps(t, best_t);
+      best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)),
+                                _mm_andnot_si128(closer, best_index));
+    }
+
+    alignas(16) float lanes_t[4];
+    alignas(16) int lanes_index[4];
+    _mm_store_ps(lanes_t, best_t);
+    _mm_store_si128((__m128i *) lanes_index, best_index);
+    for (int lane = 0; lane < std::min(4, count - first); ++lane) {
+      out[first + lane] = BoxHit{lanes_index[lane], lanes_t[lane]};
+    }
+  }
+}
+
+// -- avx2 ----------------------------------------------------------------
+
+struct Ray8 {
+  __m256 ox, oy, oz, ix, iy, iz;
+};
+
+ALE_TARGET_AVX2
+static inline __m256 hit_avx2(const Ray8 &ray, __m256 min_x, __m256 min_y,
+                              __m256 min_z, __m256 max_x, __m256 max_y,
+                              __m256 max_z, __m256 t_min, __m256 t_max) {
+  __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(min_x, ray.ox), ray.ix);
+  __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(max_x, ray.ox), ray.ix);
+  __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(min_y, ray.oy), ray.iy);
+  __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(max_y, ray.oy), ray.iy);
+  __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(min_z, ray.oz), ray.iz);
+  __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(max_z, ray.oz), ray.iz);
+
+  __m256 t_near = _mm256_set1_ps(-INFINITY);
+  __m256 t_far = _mm256_set1_ps(INFINITY);
+  t_near = _mm256_max_ps(_mm256_min_ps(tx1, tx2), t_near);
+  t_far = _mm256_min_ps(_mm256_max_ps(tx1, tx2), t_far);
+  t_near = _mm256_max_ps(_mm256_min_ps(ty1, ty2), t_near);
+  t_far = _mm256_min_ps(_mm256_max_ps(ty1, ty2), t_far);
+  t_near = _mm256_max_ps(_mm256_min_ps(tz1, tz2), t_near);
+  t_far = _mm256_min_ps(_mm256_max_ps(tz1, tz2), t_far);
+
+  __m256 t = _mm256_blendv_ps(t_far, t_near,
+                              _mm256_cmp_ps(t_near, t_min, _CMP_GT_OQ));
+  __m256 hit = _mm256_and_ps(
+      _mm256_cmp_ps(t_far, t_near, _CMP_GE_OQ),
+      _mm256_and_ps(_mm256_cmp_ps(t, t_min, _CMP_GT_OQ),
+                    _mm256_cmp_ps(t, t_max, _CMP_LT_OQ)));
+  return _mm256_blendv_ps(_mm256_set1_ps(INFINITY), t, hit);
+}
+
+ALE_TARGET_AVX2
+static inline Ray8 broadcast_avx2(vec3 origin, vec3 inv_dir) {
+  return Ray8{_mm256_set1_ps(origin.x),  _mm256_set1_ps(origin.y),
+              _mm256_set1_ps(origin.z),  _mm256_set1_ps(inv_dir.x),
+              _mm256_set1_ps(inv_dir.y), _mm256_set1_ps(inv_dir.z)};
+}
+
+ALE_TARGET_AVX2
+static inline __m256 boxes_avx2(const BoxBatch &batch, const Ray8 &ray, int i,
+                                __m256 t_min, __m256 t_max) {
+  using F = BoxBatch;
+  __m256 t = hit_avx2(ray, _mm256_loadu_ps(batch.get(F::MIN_X) + i),
+                      _mm256_loadu_ps(batch.get(F::MIN_Y) + i),
+                      _mm256_loadu_ps(batch.get(F::MIN_Z) + i),
+                      _mm256_loadu_ps(batch.get(F::MAX_X) + i),
+                      _mm256_loadu_ps(batch.get(F::MAX_Y) + i),
+                      _mm256_loadu_ps(batch.get(F::MAX_Z) + i), t_min, t_max);
+  __m256i index = _mm256_add_epi32(_mm256_set1_epi32(i),
+                                   _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  __m256 inside = _mm256_castsi256_ps(
+      _mm256_cmpgt_epi32(_mm256_set1_epi32(batch.size), index));
+  return _mm256_blendv_ps(_mm256_set1_ps(INFINITY), t, inside);
+}
+
+ALE_TARGET_AVX2
+static BoxHit nearest_avx2(const BoxBatch &batch, vec3 origin, vec3 inv_dir,
+                           float t_min, float t_max) {
+  Ray8 ray = broadcast_avx2(origin, inv_dir);
+  __m256 t_min8 = _mm256_set1_ps(t_min);
+  __m256 t_max8 = _mm256_set1_ps(t_max);
+  __m256 best_t = _mm256_set1_ps(INFINITY);
+  __m256i best_index = _mm256_set1_epi32(-1);
+  __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  for (int i = 0; i < batch.size; i += 8) {
+    __m256 t = boxes_avx2(batch, ray, i, t_min8, t_max8);
+    __m256 closer = _mm256_cmp_ps(t, best_t, _CMP_LT_OQ);
+    best_t = _mm256_min_ps(t, best_t);
+    best_index = _mm256_castps_si256(
+        _mm256_blendv_ps(_mm256_castsi256_ps(best_index),
+                         _mm256_castsi256_ps(index), closer));
+    index = _mm256_add_epi32(index, _mm256_set1_epi32(8));
+  }
+  alignas(32) float lanes_t[8];
+  alignas(32) int lanes_index[8];
+  _mm256_store_ps(lanes_t, best_t);
+  _mm256_store_si256((__m256i *) lanes_index, best_index);
+  return reduce_lanes(lanes_t, lanes_index, 8);
+}
+
+ALE_TARGET_AVX2
+static void all_avx2(const BoxBatch &batch, vec3 origin, vec3 inv_dir,
+                     float t_min, float t_max, vector<BoxHit> &hits) {
+  Ray8 ray = broadcast_avx2(origin, inv_dir);
+  __m256 t_min8 = _mm256_set1_ps(t_min);
+  __m256 t_max8 = _mm256_set1_ps(t_max);
+  alignas(32) float lanes[8];
+  for (int i = 0; i < batch.size; i += 8) {
+    __m256 t = boxes_avx2(batch, ray, i, t_min8, t_max8);
+    int mask = _mm256_movemask_ps(
+        _mm256_cmp_ps(t, _mm256_set1_ps(INFINITY), _CMP_LT_OQ));
+    if (mask == 0) {
+      continue;
+    }
+    _mm256_store_ps(lanes, t);
+    for (int lane = 0; lane < 8; ++lane) {
+      if (mask & (1 << lane)) {
+        hits.push_back(BoxHit{i + lane, lanes[lane]});
+      }
+    }
+  }
+}
+
+ALE_TARGET_AVX2
+static void packet_avx2(const BoxBatch &batch, const vec3 *origins,
+                        const vec3 *inv_dirs, int count, BoxHit *out,
+                        float t_min, float t_max) {
+  using F = BoxBatch;
+  __m256 t_min8 = _mm256_set1_ps(t_min);
+  __m256 t_max8 = _mm256_set1_ps(t_max);
+  for (int first = 0; first < count; first += 8) {
+    alignas(32) float lanes[6][8];
+    for (int lane = 0; lane < 8; ++lane) {
+      int ray = std::min(first + lane, count - 1);
+      for (int axis = 0; axis < 3; ++axis) {
+        lanes[axis][lane] = origins[ray][axis];
+        lanes[3 + axis][lane] = inv_dirs[ray][axis];
+      }
+    }
+    Ray8 ray = Ray8{_mm256_load_ps(lanes[0]), _mm256_load_ps(lanes[1]),
+                    _mm256_load_ps(lanes[2]), _mm256_load_ps(lanes[3]),
+                    _mm256_load_ps(lanes[4]), _mm256_load_ps(lanes[5])};
+
+    __m256 best_t = _mm256_set1_ps(INFINITY);
+    __m256i best_index = _mm256_set1_epi32(-1);
+    for (int i = 0; i < batch.size; ++i) {
+      __m256 t = hit_avx2(ray, _mm256_set1_ps(batch.get(F::MIN_X)[i]),
+                          _mm256_set1_ps(batch.get(F::MIN_Y)[i]),
+                          _mm256_set1_ps(batch.get(F::MIN_Z)[i]),
+                          _mm256_set1_ps(batch.get(F::MAX_X)[i]),
+                          _mm256_set1_ps(batch.get(F::MAX_Y)[i]),
+                          _mm256_set1_ps(batch.get(F::MAX_Z)[i]), t_min8,
+                          t_max8);
+      __m256 closer = _mm256_cmp_ps(t, best_t, _CMP_LT_OQ);
+      best_t = _mm256_min_ps(t, best_t);
+      best_index = _mm256_castps_si256(
+          _mm256_blendv_ps(_mm256_castsi256_ps(best_index),
+                           _mm256_castsi256_ps(_mm256_set1_epi32(i)), closer));
+    }
+
+    alignas(32) float lanes_t[8];
+    alignas(32) int lanes_index[8];
+    _mm256_store_ps(lanes_t, best_t);
+    _mm256_store_si256((__m256i *) lanes_index, best_index);
+    for (int lane = 0; lane < std::min(8, count - first); ++lane) {
+      out[first + lane] = BoxHit{lanes_index[lane], lanes_t[lane]};
+    }
+  }
+}
+
+#endif
+
+// -- dispatch ------------------------------------------------------------
+
+BoxHit intersect_nearest(const BoxBatch &batch, vec3 origin, vec3 inv_dir,
+                         float t_min, float t_max, SimdLevel level) {
+#if ALE_X86
+  // a handful of boxes wastes most of an 8 wide register
+  if (level == SimdLevel::AVX2 && batch.size > 4) {
+    return nearest_avx2(batch, origin, inv_dir, t_min, t_max);
+  }
+  if (level != SimdLevel::SCALAR) {
+    return nearest_sse(batch, origin, inv_dir, t_min, t_max);
+  }
+#endif
+  return nearest_scalar(batch, origin, inv_dir, t_min, t_max);
+}
+
+void intersect_all(const BoxBatch &batch, vec3 origin, vec3 inv_dir,
+                   vector<BoxHit> &hits, float t_min, float t_max,
+                   SimdLevel level) {
+#if ALE_X86
+  if (level == SimdLevel::AVX2 && batch.size > 4) {
+    all_avx2(batch, origin, inv_dir, t_min, t_max, hits);
+    return;
+  }
+  if (level != SimdLevel::SCALAR) {
+    all_sse(batch, origin, inv_dir, t_min, t_max, hits);
+    return;
+  }
+#endif
+  for (int i = 0; i < batch.size; ++i) {
+    float t = hit_scalar(batch, origin, inv_dir, i, t_min, t_max);
+    if (t < INFINITY) {
+      hits.push_back(BoxHit{i, t});
+    }
+  }
+}
+
+void intersect_nearest_packet(const BoxBatch &batch, const vec3 *origins,
+                              const vec3 *inv_dirs, int count, BoxHit *out,
+                              float t_min, float t_max, SimdLevel level) {
+#if ALE_X86
+  if (level == SimdLevel::AVX2 && count > 4) {
+    packet_avx2(batch, origins, inv_dirs, count, out, t_min, t_max);
+    return;
+  }
+  if (level != SimdLevel::SCALAR) {
+    packet_sse(batch, origins, inv_dirs, count, out, t_min, t_max);
+    return;
+  }
+#endif
+  for (int i = 0; i < count; ++i) {
+    out[i] = nearest_scalar(batch, origins[i], inv_dirs[i], t_min, t_max);
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef BOX_BATCH_H
+#define BOX_BATCH_H
+
+#include <cmath>
+#include <vector>
+#include "glm/glm.hpp"
+#include "simd_level.h"
+
+// Axis aligned boxes as structure of arrays, for testing rays against many
+// boxes at once. Each array is padded by a full vector width so kernels can
+// read past the last box.
+class BoxBatch {
+public:
+  enum Field { MIN_X, MIN_Y, MIN_Z, MAX_X, MAX_Y, MAX_Z, FIELD_COUNT };
+
+  static constexpr int PADDING = 8;
+
+  int size = 0;
+
+  BoxBatch();
+
+  void add(glm::vec3 min, glm::vec3 max);
+  void set(int i, glm::vec3 min, glm::vec3 max);
+  void clear();
+
+  const float *get(Field field) const { return fields[field].data(); }
+
+private:
+  std::vector<float> fields[FIELD_COUNT];
+};
+
+struct BoxHit {
+  int index = -1; // -1 when no box was hit
+  float t = INFINITY;
+};
+
+// Slab tests follow Ray::intersect: a ray starting inside a box hits it
+// where it leaves, and only t in (t_min, t_max) counts. inv_dir is 1 / dir,
+// infinite components are fine. Ties go to the lower index, every level
+// gives the same result.
+
+// Nearest box along one ray.
+BoxHit intersect_nearest(const BoxBatch &batch, glm::vec3 origin,
+                         glm::vec3 inv_dir, float t_min = 0.0f,
+                         float t_max = INFINITY,
+                         SimdLevel level = simd_level());
+
+// Every box along one ray appended to hits, in index order.
+void intersect_all(const BoxBatch &batch, glm::vec3 origin, glm::vec3 inv_dir,
+                   std::vector<BoxHit> &hits, float t_min = 0.0f,
+                   float t_max = INFINITY, SimdLevel level = simd_level());
+
+// Nearest box along each of count rays, written to out[0 .. count). Rays
+// go through 4 (sse) or 8 (avx2) at a time against every box, which pays
+// off for coherent packets such as a tile of camera rays.
+void intersect_nearest_packet(const BoxBatch &batch, const glm::vec3 *origins,
+                              const glm::vec3 *inv_dirs, int count,
+                              BoxHit *out, float t_min = 0.0f,
+                              float t_max = INFINITY,
+                              SimdLevel level = simd_level());
+
+#endif // BOX_BATCH_H
@@ -6,6 +6,7 @@ module;
 #include <glm/gtc/quaternion.hpp>
 
 export module graphics:camera;
+import data;
 import input;
 
 export namespace ale::graphics {
@@ -126,6 +127,11 @@ public:
     return get_projection_matrix(this->Width, this->Height);
   }
 
+  // planes of what the view and projection matrix above see, for culling
+  ale::data::Frustum get_frustum() const {
+    return ale::data::Frustum(get_projection_matrix() * get_view_matrix());
+  }
+
   // processes input received from any keyboard-like input system. Accepts input
   // parameter in the form of camera defined ENUM (to abstract it from windowing
   // systems)
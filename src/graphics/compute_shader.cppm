@@ -2,6 +2,7 @@ module;
 
 #include <fstream>
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 #include <iostream>
 #include <string>
 #include "shader_common.h"
@@ -39,7 +40,7 @@ public:
   ComputeShader(const ComputeShader &other) = delete;
   ComputeShader &operator=(const ComputeShader &other) = delete;
 
-  ComputeShader(ComputeShader &&other) { other.id = 0; }
+  ComputeShader(ComputeShader &&other) : id(other.id) { other.id = 0; }
   ComputeShader &operator=(ComputeShader &&other) {
     if (this != &other) {
       swap(this->id, other.id);
@@ -71,6 +72,27 @@ public:
                     GL_TEXTURE_UPDATE_BARRIER_BIT);
   }
 
+  // uniforms, the program has to be in use
+  void setInt(const std::string &name, int value) const {
+    glUniform1i(glGetUniformLocation(id, name.c_str()), value);
+  }
+  void setVec2(const std::string &name, const glm::vec2 &value) const {
+    glUniform2fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
+  }
+  void setIVec3(const std::string &name, const glm::ivec3 &value) const {
+    glUniform3iv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
+  }
+
+  void use() { glUseProgram(this->id); }
+
+  // work group counts, the shader binds its own buffers. barriers is what
+  // the results are read through next
+  void execute(int x, int y, int z, GLbitfield barriers) {
+    glUseProgram(this->id);
+    glDispatchCompute(x, y, z);
+    glMemoryBarrier(barriers);
+  }
+
 private:
   // utility function for checking shader compilation/linking errors.
   // ------------------------------------------------------------------------
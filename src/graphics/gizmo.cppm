@@ -5,8 +5,10 @@ module;
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include <memory>
 #include <optional>
 #include <vector>
+#include "src/graphics/box_batch.h"
 
 export module graphics:gizmo;
 import data;
@@ -14,6 +16,7 @@ import :shader;
 import :model;
 import :static_mesh;
 import :camera;
+import :world_bounds;
 
 using namespace ale::data;
 using namespace ale::graphics;
@@ -65,6 +68,13 @@ typedef struct Gizmo_GrabAxis {
   Gizmo_ActiveAxis activeAxis;
 } Gizmo_GrabAxis;
 
+// Handle boxes of one gizmo type in the order grab_axis prefers them, with
+// the axis each one grabs
+typedef struct Gizmo_Handles {
+  BoxBatch boxes;
+  std::vector<Gizmo_ActiveAxis> axes;
+} Gizmo_Handles;
+
 class Gizmo {
 #define MODELS_LEN 13
 public:
@@ -100,10 +110,13 @@ public:
   // not supported yet
   bool isLocalSpace;
 
-  Gizmo() :
+  // world_bounds can be shared with the renderer of the same world
+  Gizmo(std::shared_ptr<WorldBounds> world_bounds =
+            std::make_shared<WorldBounds>()) :
       gizmo_shader(afs::root("resources/shaders/gizmo/gizmo.vs").c_str(),
                    afs::root("resources/shaders/gizmo/gizmo.fs").c_str()),
-      isLocalSpace(false) {
+      isLocalSpace(false),
+      world_bounds(std::move(world_bounds)) {
 
     // load a flat shader here ?
     // the default raylib shader is flat though
@@ -142,6 +155,39 @@ public:
         afs::root("resources/models/gizmo/Scale_Z+.glb")); // ArrowY
     this->models.emplace_back(
         afs::root("resources/models/gizmo/Scale_All.glb"));
+
+    add_handle(Translate, ArrowX, X);
+    add_handle(Translate, ArrowY, Y);
+    add_handle(Translate, ArrowZ, Z);
+    add_handle(Translate, PlaneYZ, YZ);
+    add_handle(Translate, PlaneXZ, XZ);
+    add_handle(Translate, PlaneXY, XY);
+
+    add_handle(Scale, ScaleX, X);
+    add_handle(Scale, ScaleY, Y);
+    add_handle(Scale, ScaleZ, Z);
+    add_handle(Scale, PlaneYZ, YZ);
+    add_handle(Scale, PlaneXZ, XZ);
+    add_handle(Scale, PlaneXY, XY);
+    add_handle(Scale, ScaleAll, All);
+
+    add_handle(Rotate, RotationYZ, YZ);
+    add_handle(Rotate, RotationXZ, XZ);
+    add_handle(Rotate, RotationXY, XY);
+  }
+
+private:
+  Gizmo_Handles handles[3]; // per Gizmo_Type
+
+  std::vector<BoxHit> hits; // kept to reuse its memory
+
+  std::shared_ptr<WorldBounds> world_bounds;
+
+  void add_handle(Gizmo_Type type, Gizmo_ModelType model,
+                  Gizmo_ActiveAxis axis) {
+    auto &box = this->models[model].meshes[0].boundingBox;
+    handles[type].boxes.add(box.min, box.max);
+    handles[type].axes.push_back(axis);
   }
 
 private:
@@ -257,20 +303,31 @@ public:
       }
     }
 
-    // Find some object to click into.
+    // Find some object to click into. The tree hands out the entities whose
+    // world box the ray crosses, nearest first, and skips the ones starting
+    // behind the closest hit so far. Hits are compared in world space, the
+    // object space t of a scaled object is stretched.
     selected_entity = nullopt;
-    auto view = world.view<Transform, StaticMesh>();
     float dist = INFINITY;
-    for (auto [entity, obj_transform, static_mesh]: view.each()) {
+    auto &tree = world_bounds->sync(world);
+    tree.query_ray(mouse_ray, INFINITY, [&](entt::entity entity, float) {
+      auto &obj_transform = world.get<Transform>(entity);
+      auto model = obj_transform.get_model_matrix();
       auto ray = mouse_ray.apply_transform_inversed(obj_transform);
-      for (auto &mesh: static_mesh.get_model()->meshes) {
+      for (auto &mesh: world.get<StaticMesh>(entity).get_model()->meshes) {
         auto isect_t = ray.intersect(mesh.boundingBox);
-        if (isect_t.has_value() && isect_t < dist) {
+        if (!isect_t.has_value()) {
+          continue;
+        }
+        vec3 hit = model * vec4(ray.resolve(*isect_t), 1.0);
+        float hit_dist = distance(mouse_ray.origin, hit);
+        if (hit_dist < dist) {
           selected_entity = entity;
-          dist = *isect_t;
+          dist = hit_dist;
         }
       }
-    }
+      return dist;
+    });
 
     // nothing is clicked
     if (!selected_entity.has_value()) {
@@ -311,6 +368,8 @@ public:
         if (is_dragging) {
           try_hold(transform, camera, mouse_pos, mouse_ray);
           last_moved_entity = selected_entity;
+          // edited in place, let the listeners know
+          world.patch<Transform>(*selected_entity);
         }
 
         auto scale = glm::clamp(
@@ -382,93 +441,16 @@ private:
   optional<Gizmo_GrabAxis> grab_axis(Ray ray) {
 
     auto tray = ray.apply_transform_inversed(transform);
-    if (this->gizmoType == Translate) {
-      auto coll = tray.intersect(this->models[ArrowX].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = X};
-      }
-      coll = tray.intersect(this->models[ArrowY].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = Y};
-      }
-      coll = tray.intersect(this->models[ArrowZ].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = Z};
-      }
-      coll = tray.intersect(this->models[PlaneYZ].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = YZ};
-      }
-      coll = tray.intersect(this->models[PlaneXZ].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = XZ};
-      }
-      coll = tray.intersect(this->models[PlaneXY].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = XY};
-      }
-    } else if (this->gizmoType == Scale) {
-      auto coll = tray.intersect(this->models[ScaleX].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = X};
-      }
-      coll = tray.intersect(this->models[ScaleY].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = Y};
-      }
-      coll = tray.intersect(this->models[ScaleZ].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = Z};
-      }
-      coll = tray.intersect(this->models[PlaneYZ].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = YZ};
-      }
-      coll = tray.intersect(this->models[PlaneXZ].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = XZ};
-      }
-      coll = tray.intersect(this->models[PlaneXY].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = XY};
-      }
-      coll = tray.intersect(this->models[ScaleAll].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = All};
-      }
-    } else if (this->gizmoType == Rotate) {
-      auto coll =
-          tray.intersect(this->models[RotationYZ].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = YZ};
-      }
-      coll = tray.intersect(this->models[RotationXZ].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = XZ};
-      }
-      coll = tray.intersect(this->models[RotationXY].meshes[0].boundingBox);
-      if (coll.has_value()) {
-        return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(coll.value()),
-                              .activeAxis = XY};
-      }
+    auto &handles = this->handles[this->gizmoType];
+    // every handle in one go, hits come in handle order so the first one
+    // wins like it did when they were tried one by one
+    hits.clear();
+    tray.intersect_all(handles.boxes, hits);
+    if (hits.empty()) {
+      return nullopt;
     }
-
-    return nullopt;
+    return Gizmo_GrabAxis{.rayCollisionPosition = ray.resolve(hits[0].t),
+                          .activeAxis = handles.axes[hits[0].index]};
   }
   /// This returns the hit point position of ONLY the activeAxis (all else will
   /// be 0)
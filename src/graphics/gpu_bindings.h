@@ -0,0 +1,29 @@
+#ifndef ALETHERENGINE_GPU_BINDINGS_H
+#define ALETHERENGINE_GPU_BINDINGS_H
+
+// Buffer binding points, included by the C++ side and by the shaders so
+// both read the same numbers. Bindings are global gl state, a bake can run
+// between the upload of the frame buffers and the draws (reloading a mesh in
+// the editor), so the renderer and the sdf generators never share an index.
+// Only plain defines here, the file is valid GLSL too.
+
+// shader storage buffers of the renderers
+#define SDF_OBJECT_BINDING 0 // SdfModelPacked / SdfShadowCasters objects
+#define SDF_BRICK_CELL_BINDING 1 // SdfModelPacked brick cells
+#define SDF_SHADOW_BVH_BINDING 4 // SdfShadowCasters instance bvh
+// past the 8 bindings gl 4.3 guarantees, 9 storage buffers are in use
+// between the two. Desktop drivers report more
+#define LIGHT_BINDING 8 // FrameConstants lights
+
+// shader storage buffers of sdf_generator_gpu_v2(_batched).cs
+#define SDF_GEN_VERTEX_BINDING 2
+#define SDF_GEN_INDEX_BINDING 3
+#define SDF_GEN_BVH_BINDING 5
+#define SDF_GEN_MESH_BINDING 6
+#define SDF_GEN_DISTANCE_BINDING 7
+
+// uniform buffers
+#define CAMERA_BINDING 0 // FrameConstants camera
+#define SDF_GEN_BOUNDS_BINDING 4 // sdf_generator_gpu_v2.cs bounding box
+
+#endif
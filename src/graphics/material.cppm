@@ -2,6 +2,7 @@ module;
 
 #include <glm/glm.hpp>
 #include <memory>
+#include <tuple>
 
 export module graphics:material;
 import :texture;
@@ -27,6 +28,13 @@ public:
     this->specular_texture = texture;
     this->specular_color = 0.0f;
   }
+
+  // what the renderers bind, entities with equal keys share instanced draws
+  auto batch_key() const {
+    return std::tuple(diffuse_texture.get(), specular_texture.get(),
+                      diffuse_color.x, diffuse_color.y, diffuse_color.z,
+                      specular_color);
+  }
 };
 
 struct PBRMaterial {
@@ -45,6 +53,14 @@ public:
 
   float ao = 0.0f;
   std::shared_ptr<Texture> ao_texture = nullptr;
+
+  // see BasicMaterial::batch_key
+  auto batch_key() const {
+    return std::tuple(albedo_texture.get(), normal_texture.get(),
+                      metallic_texture.get(), roughness_texture.get(),
+                      ao_texture.get(), albedo.x, albedo.y, albedo.z, normal.x,
+                      normal.y, normal.z, metallic, roughness, ao);
+  }
 };
 
 }; // namespace ale::graphics
@@ -31,6 +31,14 @@ struct Vertex {
   alignas(16) float m_Weights[MAX_BONE_INFLUENCE] = {0};
 };
 
+// Per instance data of Mesh::DrawInstanced, at attribute locations 7 to 10
+// (the model matrix columns) and 11
+struct MeshInstance {
+  mat4 model;
+  int entity_id;
+  int padding[3];
+};
+
 struct BoneInfo {
   int id;
   mat4 offset;
@@ -48,11 +56,13 @@ public:
   std::vector<unsigned int> indices;
   PendingTexturePath textures;
   BoundingBox boundingBox;
-  unsigned int VAO;
+  unsigned int VAO = 0; // 0 when not uploaded
 
-  // constructor
+  // constructor, upload_to_gpu = false keeps the mesh cpu only so it can be
+  // created without a gl context
   Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
-       PendingTexturePath pending_texture_path, BoundingBox boundingBox) :
+       PendingTexturePath pending_texture_path, BoundingBox boundingBox,
+       bool upload_to_gpu = true) :
       vertices(vertices),
       indices(indices),
       textures(pending_texture_path),
@@ -60,7 +70,21 @@ public:
 
     // now that we have all the required data, set the vertex buffers and its
     // attribute pointers.
-    setupMesh();
+    if (upload_to_gpu) {
+      setupMesh();
+    }
+  }
+
+  // Meshes are copied freely and share their buffers, so they are not freed
+  // on destruction. The owner of the last copy frees them with this
+  void delete_buffers() {
+    if (VAO == 0) {
+      return;
+    }
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+    VAO = VBO = EBO = 0;
   }
 
   // render the mesh
@@ -78,9 +102,45 @@ public:
     glBindVertexArray(0);
   }
 
+  // Draws count instances starting at first of the MeshInstances in
+  // instance_buffer. The instance attributes are switched off again after,
+  // so Draw keeps working with shaders that read them behind a uniform
+  void DrawInstanced(Shader &shader, unsigned int instance_buffer, int first,
+                     int count) {
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    for (int column = 0; column < 4; ++column) {
+      glEnableVertexAttribArray(7 + column);
+      glVertexAttribPointer(7 + column, 4, GL_FLOAT, GL_FALSE,
+                            sizeof(MeshInstance),
+                            (void *) (sizeof(vec4) * column));
+      glVertexAttribDivisor(7 + column, 1);
+    }
+    glEnableVertexAttribArray(11);
+    glVertexAttribIPointer(11, 1, GL_INT, sizeof(MeshInstance),
+                           (void *) offsetof(MeshInstance, entity_id));
+    glVertexAttribDivisor(11, 1);
+
+    // the base instance moves the instance attributes to first
+    if (indices.empty()) {
+      glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, vertices.size(),
+                                        count, first);
+    } else {
+      glDrawElementsInstancedBaseInstance(
+          GL_TRIANGLES, static_cast<unsigned int>(indices.size()),
+          GL_UNSIGNED_INT, 0, count, first);
+    }
+
+    for (int location = 7; location <= 11; ++location) {
+      glDisableVertexAttribArray(location);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+  }
+
 private:
   // render data
-  unsigned int VBO, EBO;
+  unsigned int VBO = 0, EBO = 0;
 
   // initializes all the buffer objects/arrays
   void setupMesh() {
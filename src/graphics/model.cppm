@@ -29,9 +29,13 @@ public:
   string directory;
   std::filesystem::path path;
   bool gammaCorrection;
+  bool upload_to_gpu = true;
 
-  // constructor, expects a filepath to a 3D model.
-  Model(string const &path, bool gamma = false) : gammaCorrection(gamma) {
+  // constructor, expects a filepath to a 3D model. upload_to_gpu = false
+  // skips every gl call, meshes can then only be used on the cpu
+  Model(string const &path, bool gamma = false, bool upload_to_gpu = true) :
+      gammaCorrection(gamma),
+      upload_to_gpu(upload_to_gpu) {
     loadModel(path);
   }
 
@@ -43,6 +47,14 @@ public:
       meshes[i].Draw(shader);
   }
 
+  // draws count instances of every mesh, see Mesh::DrawInstanced
+  void draw_instanced(Shader &shader, unsigned int instance_buffer, int first,
+                      int count) {
+    for (auto &mesh: meshes) {
+      mesh.DrawInstanced(shader, instance_buffer, first, count);
+    }
+  }
+
 private:
   // loads a model with supported ASSIMP extensions from file and stores the
   // resulting meshes in the meshes vector.
@@ -212,7 +224,8 @@ private:
         glm::vec3(mesh->mAABB.mMax.x, mesh->mAABB.mMax.y, mesh->mAABB.mMax.z));
 
     // return a mesh object created from the extracted mesh data
-    return Mesh(vertices, indices, pending_texture_paths, boundingBox);
+    return Mesh(vertices, indices, pending_texture_paths, boundingBox,
+                upload_to_gpu);
   }
 
   // names
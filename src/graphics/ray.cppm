@@ -6,6 +6,8 @@ module;
 #include <glm/glm.hpp>
 #include <optional>
 #include <string>
+#include <vector>
+#include "src/graphics/box_batch.h"
 
 export module graphics:ray;
 import data;
@@ -56,6 +58,18 @@ public:
     return nullopt;
   }
 
+  // Float slab tests against many boxes at once, simd where the cpu has it.
+  // Same hit rules as intersect
+  BoxHit intersect_nearest(const BoxBatch &boxes, float limitTMin = 0,
+                           float limitTMax = INFINITY) const {
+    return ::intersect_nearest(boxes, origin, invDir, limitTMin, limitTMax);
+  }
+
+  void intersect_all(const BoxBatch &boxes, std::vector<BoxHit> &hits,
+                     float limitTMin = 0, float limitTMax = INFINITY) const {
+    ::intersect_all(boxes, origin, invDir, hits, limitTMin, limitTMax);
+  }
+
   glm::vec3 resolve(float t) { return this->origin + t * this->dir; }
 
   Ray apply_transform_inversed(Transform t) {
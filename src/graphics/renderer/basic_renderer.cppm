@@ -1,9 +1,9 @@
 module;
 
 #include <entt/entt.hpp>
-#include <format>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <string>
 
@@ -17,6 +17,10 @@ import :static_mesh;
 import :sdf.sdf_generator_gpu_v2;
 import :sdf.sdf_model;
 import :sdf.sdf_model_packed;
+import :sdf.sdf_shadow_casters;
+import :world_bounds;
+import :renderer.frame_constants;
+import :renderer.render_queue;
 import input;
 
 
@@ -38,74 +42,56 @@ class BasicRenderer {
 private:
   Shader color_shader;
   Texture single_black_pixel_texture;
+  SdfShadowCasters shadow_casters;
+  RenderQueue render_queue;
+  InstanceBuffer instances;
+  FrameConstants frame_constants;
   WindowEventProducer *event_producer = nullptr;
 
   bool debug_mode = true;
 
 public:
-  BasicRenderer() :
+  // world_bounds can be shared with the other users of the rendered world
+  BasicRenderer(
+      shared_ptr<WorldBounds> world_bounds = make_shared<WorldBounds>()) :
       color_shader(
           afs::root("resources/shaders/renderer/basic_renderer.vs").c_str(),
           afs::root("resources/shaders/renderer/basic_renderer.fs").c_str()),
       single_black_pixel_texture(
-          afs::root("resources/textures/default/black1x1.png")) {}
+          afs::root("resources/textures/default/black1x1.png")),
+      render_queue(std::move(world_bounds)) {}
 
   void render(Camera &camera, entt::registry &world) {
     glClearColor(135.0 / 255, 206.0 / 255, 235.0 / 255, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     color_shader.use();
-    color_shader.setMat4("projection", camera.get_projection_matrix());
-    color_shader.setMat4("view", camera.get_view_matrix());
-    color_shader.setVec3("viewPos", camera.Position);
-
-    auto light_view = world.view<Transform, Light>();
-    int light_index = 0;
-    for (const auto &[entity, transform, light]: light_view.each()) {
-      color_shader.setVec3(format("lights[{}].position", light_index),
-                           transform.translation);
-      color_shader.setVec3(format("lights[{}].color", light_index),
-                           light.color);
-      color_shader.setFloat(format("lights[{}].radius", light_index),
-                            light.radius);
-      color_shader.setVec3(format("lights[{}].attenuation", light_index),
-                           light.attenuation);
-      light_index += 1;
-    }
-    color_shader.setInt("numLights", light_index);
+    // camera and lights
+    frame_constants.upload(camera, world);
 
     // Handle shadows, can only handle 1 sdf model packed for now.
-    auto sdf_model_packed = std::shared_ptr<SdfModelPacked>(nullptr);
-    auto entries = vector<pair<Transform, vector<unsigned int>>>();
-    auto shadow_view = world.view<Transform, StaticMesh>();
-    for (auto [entity, transform, static_mesh]: shadow_view.each()) {
-      auto [packed, packed_index] = static_mesh.get_model_shadow();
-      if (static_mesh.get_cast_shadow() && packed != nullptr) {
-        if (sdf_model_packed != nullptr &&
-            sdf_model_packed.get() != packed.get()) {
-          throw BasicRendererException("multiple different sdf model packed on "
-                                       "basic renderer not supported");
-        }
-        sdf_model_packed = packed;
-        entries.emplace_back(transform, packed_index);
-      }
-    }
-    if (sdf_model_packed != nullptr) {
-      sdf_model_packed->bind_to_shader(color_shader, entries, 5);
-    }
+    shadow_casters.bind_to_shader(color_shader, world, 5);
     // End handle shadows
 
-    // Render static mesh
-    const auto view = world.view<Transform, StaticMesh, BasicMaterial>();
-    for (auto [entity, transform, static_mesh, material]: view.each()) {
-      color_shader.setMat4("model", transform.get_model_matrix());
-
+    // Render static mesh, only what the camera sees, one instanced draw per
+    // model and material
+    render_queue.build(camera, world);
+    instances.upload(render_queue.basic);
+    color_shader.setBool("instanced", true);
+    for (auto &batch: render_queue.basic_batches) {
+      auto &item = render_queue.basic[batch.first];
       color_shader.setVec4("diffuseColor", vec4(1.0, 1.0, 1.0, 0.0));
       set_texture_with_default("diffuseTexture", 0,
-                               material.diffuse_texture.get());
+                               item.material->diffuse_texture.get());
 
-      static_mesh.get_model()->draw(color_shader);
+      item.geometry->draw_instanced(color_shader, instances.id, batch.first,
+                                    batch.count);
     }
+    color_shader.setBool("instanced", false);
+  }
+
+  const RenderStats &get_render_stats() const {
+    return render_queue.get_stats();
   }
 
   void set_texture_with_default(string name, int location,
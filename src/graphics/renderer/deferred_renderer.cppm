@@ -1,7 +1,6 @@
 module;
 
 #include <entt/entt.hpp>
-#include <format>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <memory>
@@ -20,6 +19,10 @@ import :framebuffer;
 import :sdf.sdf_generator_gpu_v2;
 import :sdf.sdf_model;
 import :sdf.sdf_model_packed;
+import :sdf.sdf_shadow_casters;
+import :world_bounds;
+import :renderer.frame_constants;
+import :renderer.render_queue;
 
 using namespace ale::graphics::sdf;
 using namespace std;
@@ -36,12 +39,6 @@ public:
 
 class DeferredRenderer : public WindowEventListener {
 
-
-  struct FirstPassData {
-    shared_ptr<SdfModelPacked> sdf_model_packed = nullptr;
-    vector<pair<Transform, vector<unsigned int>>> entries;
-  };
-
 private:
   Shader first_pass;
   Shader second_pass;
@@ -51,10 +48,17 @@ private:
   TextureRenderer texture_renderer;
   WindowEventProducer *event_producer = nullptr;
 
-  FirstPassData first_pass_data;
+  SdfShadowCasters shadow_casters;
+  RenderQueue render_queue;
+  InstanceBuffer basic_instances;
+  InstanceBuffer pbr_instances;
+  FrameConstants frame_constants;
 
 public:
-  DeferredRenderer(glm::ivec2 screen_size) :
+  // world_bounds can be shared with the other users of the rendered world
+  DeferredRenderer(
+      glm::ivec2 screen_size,
+      shared_ptr<WorldBounds> world_bounds = make_shared<WorldBounds>()) :
       first_pass(
           afs::root(
               "resources/shaders/renderer/deferred_renderer/first_pass.vs")
@@ -73,7 +77,8 @@ public:
           afs::root("resources/textures/default/black1x1.png")),
       deferred_framebuffer(Framebuffer::Meta{.width = screen_size.x,
                                              .height = screen_size.y,
-                                             .depthbuffer_texture = true}) {
+                                             .depthbuffer_texture = true}),
+      render_queue(std::move(world_bounds)) {
 
     // position buffer
     deferred_framebuffer.create_extra_color_attachment(make_shared<Texture>(
@@ -145,30 +150,40 @@ public:
 
   void render_first_pass(Camera &camera, entt::registry &world) {
     using namespace std;
-    // can only accommodate 1 sdf_model_packed for now
-    first_pass_data.sdf_model_packed = nullptr;
-    first_pass_data.entries = vector<pair<Transform, vector<unsigned int>>>();
     deferred_framebuffer.start_capture();
     first_pass.use();
 
-    first_pass.setMat4("projection", camera.get_projection_matrix());
-    first_pass.setMat4("view", camera.get_view_matrix());
-    const auto view = world.view<Transform, StaticMesh, BasicMaterial>();
-    for (auto [entity, transform, static_mesh, material]: view.each()) {
-
-      pass_basic_material(first_pass, entity, transform, material);
-      pass_shadow(first_pass, transform, static_mesh);
+    // camera and lights, the second pass reads the same buffers
+    frame_constants.upload(camera, world);
+
+    // only what the camera sees, one instanced draw per model and material,
+    // the entity ids come from the instance buffer
+    render_queue.build(camera, world);
+    first_pass.setBool("instanced", true);
+    basic_instances.upload(render_queue.basic);
+    for (auto &batch: render_queue.basic_batches) {
+      auto &item = render_queue.basic[batch.first];
+      pass_basic_material(first_pass, *item.material);
+      item.geometry->draw_instanced(first_pass, basic_instances.id,
+                                    batch.first, batch.count);
     }
 
-    const auto pbrs = world.view<Transform, StaticMesh, PBRMaterial>();
-    for (auto [entity, transform, static_mesh, material]: pbrs.each()) {
-      pass_pbr_material(first_pass, entity, material);
-      pass_shadow(first_pass, transform, static_mesh);
+    pbr_instances.upload(render_queue.pbr);
+    for (auto &batch: render_queue.pbr_batches) {
+      auto &item = render_queue.pbr[batch.first];
+      pass_pbr_material(first_pass, *item.material);
+      item.geometry->draw_instanced(first_pass, pbr_instances.id, batch.first,
+                                    batch.count);
     }
 
     deferred_framebuffer.end_capture();
   }
 
+  // counts of the last first pass
+  const RenderStats &get_render_stats() const {
+    return render_queue.get_stats();
+  }
+
   void render_second_pass(Camera &camera, entt::registry &world) {
     // clear color with ambient light
     auto ambient_view = world.view<AmbientLight>();
@@ -186,23 +201,9 @@ public:
                  1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    second_pass.setVec3("viewPos", camera.Position);
     second_pass.setVec3("ambientColor", ambient_color);
     second_pass.setFloat("ambientIntensity", ambient_intensity);
-
-    auto light_view = world.view<Transform, Light>();
-    int light_index = 0;
-    for (const auto &[entity, transform, light]: light_view.each()) {
-      second_pass.setVec3(format("lights[{}].position", light_index),
-                          transform.translation);
-      second_pass.setVec3(format("lights[{}].color", light_index), light.color);
-      second_pass.setFloat(format("lights[{}].radius", light_index),
-                           light.radius);
-      second_pass.setVec3(format("lights[{}].attenuation", light_index),
-                          light.attenuation);
-      light_index += 1;
-    }
-    second_pass.setInt("numLights", light_index);
+    frame_constants.bind();
 
     const auto &attachments = deferred_framebuffer.get_color_attachments();
     second_pass.setTexture2D("gPosition", 0, attachments.at(0)->id);
@@ -212,10 +213,8 @@ public:
     second_pass.setTexture2D("gDepth", 4,
                              deferred_framebuffer.get_depth_attachment()->id);
 
-    if (first_pass_data.sdf_model_packed != nullptr) {
-      first_pass_data.sdf_model_packed->bind_to_shader(
-          second_pass, first_pass_data.entries, 5);
-    }
+    // can only accommodate 1 sdf_model_packed for now
+    shadow_casters.bind_to_shader(second_pass, world, 5);
 
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
@@ -225,11 +224,7 @@ public:
   }
 
 private:
-  void pass_basic_material(Shader &first_pass, entt::entity &entity,
-                           Transform &transform, BasicMaterial &material) {
-    first_pass.setMat4("model", transform.get_model_matrix());
-    first_pass.setInt("entityId", to_integral(entity));
-
+  void pass_basic_material(Shader &first_pass, BasicMaterial &material) {
     pass_vec3("diffuse", material.diffuse_color, material.diffuse_texture);
     pass_float("specular", material.specular_color, material.specular_texture);
 
@@ -245,24 +240,7 @@ private:
     //                             : material.specular_texture->id);
   }
 
-  void pass_pbr_material(Shader &first_pass, entt::entity &entity,
-                         PBRMaterial &material) {}
-
-  void pass_shadow(Shader &first_pass, Transform &transform,
-                   StaticMesh &static_mesh) {
-    static_mesh.get_model()->draw(first_pass);
-    auto [packed, packed_index] = static_mesh.get_model_shadow();
-    if (static_mesh.get_cast_shadow() && packed != nullptr) {
-      if (first_pass_data.sdf_model_packed != nullptr &&
-          first_pass_data.sdf_model_packed.get() != packed.get()) {
-        throw DeferredRendererException(
-            "multiple different sdf model packed on "
-            "deferred renderer not supported");
-      }
-      first_pass_data.sdf_model_packed = packed;
-      first_pass_data.entries.emplace_back(transform, packed_index);
-    }
-  }
+  void pass_pbr_material(Shader &first_pass, PBRMaterial &material) {}
 
   void pass_float(string name, float color, shared_ptr<Texture> texture) {
     first_pass.setFloat(name + "Color", color);
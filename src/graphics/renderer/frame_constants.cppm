@@ -0,0 +1,123 @@
+module;
+
+#include <algorithm>
+#include <entt/entt.hpp>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "src/graphics/gpu_bindings.h"
+
+export module graphics:renderer.frame_constants;
+import data;
+import :camera;
+import :light;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+
+export namespace ale::graphics::renderer {
+
+// Constants the renderer shaders share for a frame, uploaded once per frame
+// instead of uniform by uniform. The camera goes to the CameraBlock uniform
+// buffer and the lights of the world to the LightBuffer ssbo, which grows
+// with the world so there is no cap on the light count. The layouts are
+// declared in resources/shaders/renderer/camera_partial.glsl and
+// lights_partial.glsl, the bindings in gpu_bindings.h.
+class FrameConstants {
+public:
+  // std140 CameraBlock
+  struct GPUCamera {
+    mat4 projection;
+    mat4 view;
+    vec3 view_position;
+    float padding;
+  };
+
+  // std430 Light, a vec3 is 16 aligned so the floats fill the gaps
+  struct GPULight {
+    vec3 position;
+    float radius;
+    vec3 color;
+    float padding0;
+    vec3 attenuation;
+    float padding1;
+  };
+
+  FrameConstants() = default;
+  ~FrameConstants() {
+    glDeleteBuffers(1, &camera_ubo);
+    glDeleteBuffers(1, &light_ssbo);
+  }
+
+  FrameConstants(FrameConstants &other) = delete;
+  FrameConstants &operator=(FrameConstants &other) = delete;
+
+  // writes both buffers and binds them, before the draws of a frame
+  void upload(const Camera &camera, entt::registry &world) {
+    if (camera_ubo == 0) {
+      glGenBuffers(1, &camera_ubo);
+      glBindBuffer(GL_UNIFORM_BUFFER, camera_ubo);
+      glBufferData(GL_UNIFORM_BUFFER, sizeof(GPUCamera), nullptr,
+                   GL_DYNAMIC_DRAW);
+      glGenBuffers(1, &light_ssbo);
+    }
+
+    auto gpu_camera = GPUCamera{
+        .projection = camera.get_projection_matrix(),
+        .view = camera.get_view_matrix(),
+        .view_position = camera.Position,
+    };
+    glBindBuffer(GL_UNIFORM_BUFFER, camera_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GPUCamera), &gpu_camera);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    lights.clear();
+    for (const auto &[entity, transform, light]:
+         world.view<Transform, Light>().each()) {
+      lights.push_back(GPULight{
+          .position = transform.translation,
+          .radius = light.radius,
+          .color = light.color,
+          .attenuation = light.attenuation,
+      });
+    }
+
+    int count = lights.size();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, light_ssbo);
+    if (capacity == 0 || count > capacity) {
+      capacity = std::max({count, capacity * 2, LIGHTS_INITIAL_SIZE});
+      glBufferData(GL_SHADER_STORAGE_BUFFER,
+                   HEADER_BYTES + sizeof(GPULight) * capacity, nullptr,
+                   GL_DYNAMIC_DRAW);
+    }
+    int header[4] = {count};
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, HEADER_BYTES, header);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, HEADER_BYTES,
+                    sizeof(GPULight) * count, lights.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    bind();
+  }
+
+  // the buffers of the last upload, for a pass that comes after another
+  // user of the bindings
+  void bind() const {
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, camera_ubo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, light_ssbo);
+  }
+
+  int light_count() const { return lights.size(); }
+
+private:
+  static constexpr int LIGHTS_INITIAL_SIZE = 16;
+  // numLights, padded to the 16 byte alignment of the array after it
+  static constexpr int HEADER_BYTES = sizeof(int) * 4;
+
+  unsigned int camera_ubo = 0;
+  unsigned int light_ssbo = 0;
+  int capacity = 0;
+  vector<GPULight> lights;
+};
+
+} // namespace ale::graphics::renderer
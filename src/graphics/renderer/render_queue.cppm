@@ -0,0 +1,233 @@
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <entt/entt.hpp>
+#include <functional>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+export module graphics:renderer.render_queue;
+import data;
+import :camera;
+import :material;
+import :mesh;
+import :model;
+import :static_mesh;
+import :world_bounds;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+
+export namespace ale::graphics::renderer {
+
+// per frame, from the last RenderQueue::build
+struct RenderStats {
+  int tested = 0; // entities with a StaticMesh and a Transform
+  int culled = 0; // outside the frustum
+  int drawn = 0; // queued for a pass, once per material
+  int batches = 0; // instanced draws of a Model the queue asks for
+};
+
+template <typename Material> struct RenderItem {
+  entt::entity entity;
+  mat4 model;
+  Model *geometry; // what gets drawn
+  StaticMesh *static_mesh;
+  Material *material;
+
+  // items drawing the same Model with an equal material end up next to
+  // each other, the entity keeps the order the same from frame to frame
+  bool operator<(const RenderItem &other) const {
+    if (geometry != other.geometry) {
+      return less<Model *>()(geometry, other.geometry);
+    }
+    auto key = material->batch_key();
+    auto other_key = other.material->batch_key();
+    if (key != other_key) {
+      return key < other_key;
+    }
+    return entity < other.entity;
+  }
+
+  bool same_batch(const RenderItem &other) const {
+    return geometry == other.geometry &&
+           material->batch_key() == other.material->batch_key();
+  }
+};
+
+// a run of items of a list that share one instanced draw
+struct RenderBatch {
+  int first;
+  int count;
+};
+
+// Instance buffer of a queue list, refilled every frame. Batches of the
+// list draw from it with Model::draw_instanced.
+class InstanceBuffer {
+public:
+  unsigned int id = 0;
+
+  InstanceBuffer() = default;
+  ~InstanceBuffer() { glDeleteBuffers(1, &id); }
+
+  InstanceBuffer(InstanceBuffer &other) = delete;
+  InstanceBuffer &operator=(InstanceBuffer &other) = delete;
+
+  template <typename Item> void upload(const vector<Item> &items) {
+    instances.resize(items.size());
+    for (int i = 0; i < items.size(); ++i) {
+      instances[i].model = items[i].model;
+      instances[i].entity_id = (int) to_integral(items[i].entity);
+    }
+
+    if (id == 0) {
+      glGenBuffers(1, &id);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    // a new store every frame, the draws of the last one can still read it
+    glBufferData(GL_ARRAY_BUFFER, sizeof(MeshInstance) * instances.size(),
+                 instances.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+private:
+  vector<MeshInstance> instances;
+};
+
+// What a camera sees of a world, one sorted list per material for the
+// passes to draw. The frustum is tested against a WorldBounds tree, so
+// whole regions behind the camera go in one test. Big worlds split the tree
+// into subtrees that worker threads cull, each filling its own arena with
+// model matrices and material pointers, which are merged at the end.
+// Pointers into the registry are good until its pools change, build once
+// per frame before drawing.
+class RenderQueue {
+public:
+  // below this many entities one thread is faster than starting workers
+  static constexpr int PARALLEL_MIN = 4096;
+
+  vector<RenderItem<BasicMaterial>> basic;
+  vector<RenderItem<PBRMaterial>> pbr;
+  vector<RenderBatch> basic_batches;
+  vector<RenderBatch> pbr_batches;
+
+  // bounds can be shared with other users of the same world (the gizmo)
+  RenderQueue(shared_ptr<WorldBounds> bounds = make_shared<WorldBounds>(),
+              int thread_count = thread::hardware_concurrency()) :
+      thread_count(std::max(1, thread_count)),
+      bounds(std::move(bounds)) {}
+
+  void build(const Camera &camera, entt::registry &world) {
+    auto &tree = bounds->sync(world);
+    auto frustum = camera.get_frustum();
+
+    // asking for a pool that does not exist creates it, which is not safe
+    // from several threads, so every pool is looked up here
+    auto &transforms = world.storage<Transform>();
+    auto &static_meshes = world.storage<StaticMesh>();
+    auto &basic_materials = world.storage<BasicMaterial>();
+    auto &pbr_materials = world.storage<PBRMaterial>();
+
+    int threads = tree.size() < PARALLEL_MIN ? 1 : thread_count;
+    // a few subtrees per thread so uneven ones even out
+    auto subtrees = tree.subtrees(threads * 4);
+    threads = std::max(1, std::min(threads, (int) subtrees.size()));
+    arenas.resize(std::max((int) arenas.size(), threads));
+    for (auto &arena: arenas) {
+      arena.basic.clear();
+      arena.pbr.clear();
+      arena.visible = 0;
+    }
+
+    atomic<int> next = 0;
+    auto worker = [&](Arena &arena) {
+      auto visit = [&](entt::entity entity) {
+        ++arena.visible;
+        auto model = transforms.get(entity).get_model_matrix();
+        auto &static_mesh = static_meshes.get(entity);
+        auto geometry = static_mesh.get_model().get();
+        if (basic_materials.contains(entity)) {
+          arena.basic.push_back({entity, model, geometry, &static_mesh,
+                                 &basic_materials.get(entity)});
+        }
+        if (pbr_materials.contains(entity)) {
+          arena.pbr.push_back({entity, model, geometry, &static_mesh,
+                               &pbr_materials.get(entity)});
+        }
+      };
+      for (int i = next.fetch_add(1); i < (int) subtrees.size();
+           i = next.fetch_add(1)) {
+        tree.query_frustum(frustum, visit, subtrees[i]);
+      }
+      sort(arena.basic.begin(), arena.basic.end());
+      sort(arena.pbr.begin(), arena.pbr.end());
+    };
+
+    {
+      auto workers = vector<jthread>();
+      for (int i = 1; i < threads; ++i) {
+        workers.emplace_back(worker, ref(arenas[i]));
+      }
+      worker(arenas[0]);
+    }
+
+    merge(&Arena::basic, basic);
+    merge(&Arena::pbr, pbr);
+    batch(basic, basic_batches);
+    batch(pbr, pbr_batches);
+
+    int visible = 0;
+    for (auto &arena: arenas) {
+      visible += arena.visible;
+    }
+    stats.tested = tree.size();
+    stats.drawn = basic.size() + pbr.size();
+    stats.culled = stats.tested - visible;
+    stats.batches = basic_batches.size() + pbr_batches.size();
+  }
+
+  const RenderStats &get_stats() const { return stats; }
+
+private:
+  // what one thread found, kept between frames to reuse the memory
+  struct Arena {
+    vector<RenderItem<BasicMaterial>> basic;
+    vector<RenderItem<PBRMaterial>> pbr;
+    int visible = 0;
+  };
+
+  int thread_count;
+  shared_ptr<WorldBounds> bounds;
+  vector<Arena> arenas;
+  RenderStats stats;
+
+  // the arenas are sorted already, so merging them sorts the whole list
+  template <typename Item>
+  void merge(vector<Item> Arena::*list, vector<Item> &out) {
+    out.clear();
+    for (auto &arena: arenas) {
+      auto &items = arena.*list;
+      int middle = out.size();
+      out.insert(out.end(), items.begin(), items.end());
+      inplace_merge(out.begin(), out.begin() + middle, out.end());
+    }
+  }
+
+  template <typename Item>
+  static void batch(const vector<Item> &items, vector<RenderBatch> &batches) {
+    batches.clear();
+    for (int i = 0; i < items.size(); ++i) {
+      if (i == 0 || !items[i - 1].same_batch(items[i])) {
+        batches.push_back(RenderBatch{i, 0});
+      }
+      ++batches.back().count;
+    }
+  }
+};
+
+} // namespace ale::graphics::renderer
@@ -0,0 +1,105 @@
+module;
+
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+
+export module graphics:sdf.sdf_atlas_packer;
+
+using namespace std;
+using namespace glm;
+
+export namespace ale::graphics::sdf {
+
+// Places boxes of any size into 3d atlas pages. Free space is kept as a list
+// of disjoint boxes (guillotine packing): a box goes into the smallest free
+// box it fits in, and the rest of that free box is cut into up to three new
+// free boxes, the largest leftover axis first so big holes stay big.
+class SdfAtlasPacker {
+public:
+  struct Allocation {
+    int page;
+    ivec3 origin;
+  };
+
+  SdfAtlasPacker(ivec3 page_size, int max_pages) :
+      page_size(page_size),
+      max_pages(max_pages) {}
+
+  // nullopt when size does not fit anywhere, even on a new page
+  optional<Allocation> insert(ivec3 size) {
+    if (any(greaterThan(size, page_size)) ||
+        any(lessThanEqual(size, ivec3(0)))) {
+      return nullopt;
+    }
+
+    auto best = free_boxes.end();
+    for (auto it = free_boxes.begin(); it != free_boxes.end(); ++it) {
+      if (all(lessThanEqual(size, it->size)) &&
+          (best == free_boxes.end() || volume(it->size) < volume(best->size))) {
+        best = it;
+      }
+    }
+    if (best == free_boxes.end()) {
+      if (pages >= max_pages) {
+        return nullopt;
+      }
+      free_boxes.push_back(FreeBox{pages++, ivec3(0), page_size});
+      best = free_boxes.end() - 1;
+    }
+
+    auto box = *best;
+    free_boxes.erase(best);
+    split(box, size);
+    used_volume += volume(size);
+    return Allocation{box.page, box.origin};
+  }
+
+  int page_count() { return pages; }
+
+  // used part of the pages created so far, 1 is a perfect fit
+  float occupancy() {
+    return pages == 0 ? 0.0f
+                      : float(used_volume) / (float(volume(page_size)) * pages);
+  }
+
+private:
+  struct FreeBox {
+    int page;
+    ivec3 origin;
+    ivec3 size;
+  };
+
+  ivec3 page_size;
+  int max_pages;
+  int pages = 0;
+  long long used_volume = 0;
+  vector<FreeBox> free_boxes;
+
+  static long long volume(ivec3 size) {
+    return (long long) size.x * size.y * size.z;
+  }
+
+  // size sits in the min corner of box
+  void split(FreeBox box, ivec3 size) {
+    ivec3 leftover = box.size - size;
+    int axes[3] = {0, 1, 2};
+    sort(axes, axes + 3,
+         [&](int a, int b) { return leftover[a] > leftover[b]; });
+
+    // every cut spans what is left of the box along the axes not cut yet
+    ivec3 remaining = box.size;
+    for (int axis: axes) {
+      if (leftover[axis] > 0) {
+        auto cut = FreeBox{box.page, box.origin, remaining};
+        cut.origin[axis] += size[axis];
+        cut.size[axis] = leftover[axis];
+        free_boxes.push_back(cut);
+      }
+      remaining[axis] = size[axis];
+    }
+  }
+};
+
+} // namespace ale::graphics::sdf
@@ -0,0 +1,485 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
+#include "src/graphics/sdf/triangle_batch.h"
+
+export module graphics:sdf.sdf_baker_cpu;
+import data;
+import :mesh;
+import :sdf.sdf_bvh;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+
+export namespace ale::graphics::sdf {
+
+enum class SdfBakeMode {
+  // closest triangle query for every voxel
+  EXACT,
+  // closest triangle query only near the surface, the rest is filled by
+  // sweeping closest points outwards and flood filling the sign
+  NARROW_BAND,
+};
+
+// Bakes sdfs on the cpu with the same shared code as sdf_generator_gpu_v2.cs,
+// bvh leaves are screened with the simd kernels from triangle_batch.h first.
+// The grid is cut into tiles, every worker owns a queue of them and steals
+// from the back of the others once its own queue runs dry. No gl calls are
+// made here, so this works without a context.
+class SdfBakerCpu {
+  int thread_count;
+  int narrow_band; // in voxels
+
+  struct TileQueue {
+    mutex lock;
+    deque<int> tiles;
+  };
+
+public:
+  static constexpr int TILE_SIZE = 8;
+
+  SdfBakerCpu(int thread_count = thread::hardware_concurrency(),
+              int narrow_band = 2) :
+      thread_count(std::max(1, thread_count)),
+      narrow_band(std::max(1, narrow_band)) {}
+
+  // distances are laid out like Texture3D (x fastest, then y, then z)
+  vector<float> bake(Mesh &mesh, int resolution,
+                     SdfBakeMode mode = SdfBakeMode::EXACT) {
+    auto bvh = SdfBvh(mesh);
+    auto outer_bb = mesh.boundingBox.apply_scale(Transform{
+        .scale = vec3(1.1, 1.1, 1.1),
+    });
+    return bake(bvh, outer_bb, resolution, mode);
+  }
+
+  vector<float> bake(SdfBvh &bvh, BoundingBox outer_bb, int resolution,
+                     SdfBakeMode mode = SdfBakeMode::EXACT) {
+    if (mode == SdfBakeMode::NARROW_BAND) {
+      return bake_narrow_band(bvh, outer_bb, resolution);
+    }
+
+    auto distances = vector<float>(resolution * resolution * resolution);
+    auto batch = TriangleBatch(bvh.vertices, bvh.indices);
+    for_each_tile(resolution, [&](ivec3 start, ivec3 end) {
+      for (int z = start.z; z < end.z; ++z) {
+        for (int y = start.y; y < end.y; ++y) {
+          for (int x = start.x; x < end.x; ++x) {
+            vec3 p = voxel_center(ivec3(x, y, z), outer_bb.min, outer_bb.max,
+                                  ivec3(resolution));
+            auto closest = closest_triangle_bvh_batched(
+                p, bvh.vertices, bvh.indices, bvh.nodes, batch);
+            distances[(z * resolution + y) * resolution + x] =
+                signed_distance(p, closest);
+          }
+        }
+      }
+    });
+    return distances;
+  }
+
+  struct Rebake {
+    vector<float> distances;
+    bool full; // everything was baked again
+    // tiles (TILE_SIZE^3, same as sdf bricks) whose distances changed, in
+    // tile coordinates. Empty when full
+    vector<ivec3> dirty_tiles;
+  };
+
+  // Bakes new_mesh reusing old_distances, the exact bake of old_mesh at the
+  // same resolution. Only voxels whose closest triangle could have changed
+  // are queried again: a voxel keeps its distance unless a removed or added
+  // triangle is at least as close as the old distance. Meshes whose bounding
+  // box moved are baked fully since every voxel center moves with it.
+  Rebake rebake(Mesh &old_mesh, Mesh &new_mesh,
+                const vector<float> &old_distances, int resolution) {
+    auto changed = changed_triangles(old_mesh, new_mesh);
+    auto same_bb = [](BoundingBox &a, BoundingBox &b) {
+      return a.min == b.min && a.max == b.max;
+    };
+    int triangle_count = triangles(new_mesh).size() / 3;
+    if (old_distances.size() != resolution * resolution * resolution ||
+        !same_bb(old_mesh.boundingBox, new_mesh.boundingBox) ||
+        changed.size() / 3 > triangle_count / 2) {
+      return Rebake{
+          .distances = bake(new_mesh, resolution),
+          .full = true,
+      };
+    }
+
+    auto distances = old_distances;
+    auto dirty_tiles = vector<ivec3>();
+    if (changed.empty()) {
+      return Rebake{.distances = distances, .full = false};
+    }
+
+    auto changed_vertices = vector<SdfVertex>();
+    auto changed_indices = vector<unsigned int>();
+    vec3 changed_min = vec3(INFINITY);
+    vec3 changed_max = vec3(-INFINITY);
+    for (auto &p: changed) {
+      changed_indices.push_back(changed_vertices.size());
+      changed_vertices.push_back(SdfVertex{vec4(p, 1.0f)});
+      changed_min = min(changed_min, p);
+      changed_max = max(changed_max, p);
+    }
+    auto changed_batch = TriangleBatch(changed_vertices, changed_indices);
+
+    auto bvh = SdfBvh(new_mesh);
+    auto batch = TriangleBatch(bvh.vertices, bvh.indices);
+    auto outer_bb = new_mesh.boundingBox.apply_scale(Transform{
+        .scale = vec3(1.1, 1.1, 1.1),
+    });
+    ivec3 image_size = ivec3(resolution);
+    mutex dirty_lock;
+    for_each_tile(resolution, [&](ivec3 start, ivec3 end) {
+      // skip the whole tile when the changes are further away than every
+      // distance in it
+      float farthest = 0.0f;
+      for (int z = start.z; z < end.z; ++z) {
+        for (int y = start.y; y < end.y; ++y) {
+          for (int x = start.x; x < end.x; ++x) {
+            int i = (z * resolution + y) * resolution + x;
+            farthest = std::max(farthest, abs(distances[i]));
+          }
+        }
+      }
+      vec3 tile_min = voxel_center(start, outer_bb.min, outer_bb.max,
+                                   image_size);
+      vec3 tile_max = voxel_center(end - ivec3(1), outer_bb.min, outer_bb.max,
+                                   image_size);
+      vec3 gap = max(max(changed_min - tile_max, tile_min - changed_max),
+                     vec3(0.0f));
+      if (length(gap) > farthest * 1.0001f + 0.0001f) {
+        return;
+      }
+
+      bool dirty = false;
+      for (int z = start.z; z < end.z; ++z) {
+        for (int y = start.y; y < end.y; ++y) {
+          for (int x = start.x; x < end.x; ++x) {
+            int i = (z * resolution + y) * resolution + x;
+            vec3 p = voxel_center(ivec3(x, y, z), outer_bb.min, outer_bb.max,
+                                  image_size);
+            // same slack as the bvh pruning, ties have to be recomputed
+            float bound = abs(distances[i]) * 1.0001f + 0.0001f;
+            if (min_triangle_distance2(changed_batch, p, 0,
+                                       changed_batch.size) > bound * bound) {
+              continue;
+            }
+            auto closest = closest_triangle_bvh_batched(
+                p, bvh.vertices, bvh.indices, bvh.nodes, batch);
+            float d = signed_distance(p, closest);
+            dirty |= d != distances[i];
+            distances[i] = d;
+          }
+        }
+      }
+      if (dirty) {
+        lock_guard guard(dirty_lock);
+        dirty_tiles.push_back(start / TILE_SIZE);
+      }
+    });
+
+    return Rebake{
+        .distances = std::move(distances),
+        .full = false,
+        .dirty_tiles = std::move(dirty_tiles),
+    };
+  }
+
+  // largest absolute difference between two bakes of the same size
+  static float max_error(const vector<float> &expected,
+                         const vector<float> &actual) {
+    float error = 0.0f;
+    for (int i = 0; i < expected.size(); ++i) {
+      error = std::max(error, abs(expected[i] - actual[i]));
+    }
+    return error;
+  }
+
+private:
+  vector<float> bake_narrow_band(SdfBvh &bvh, BoundingBox outer_bb,
+                                 int resolution) {
+    int voxel_count = resolution * resolution * resolution;
+    ivec3 image_size = ivec3(resolution);
+    // a flat mesh keeps a zero extent on that axis, every voxel sits at the
+    // same coordinate there so any size does
+    vec3 voxel_size = max(outer_bb.getSize() / vec3(resolution), vec3(1e-6f));
+    auto index = [&](int x, int y, int z) {
+      return (z * resolution + y) * resolution + x;
+    };
+
+    // 1. mark every voxel within the band of a triangle's bounding box
+    auto in_band = vector<char>(voxel_count, 0);
+    vec3 band = voxel_size * float(narrow_band);
+    for (int i = 0; i + 2 < bvh.indices.size(); i += 3) {
+      vec3 a = vec3(bvh.vertices[bvh.indices[i]].position);
+      vec3 b = vec3(bvh.vertices[bvh.indices[i + 1]].position);
+      vec3 c = vec3(bvh.vertices[bvh.indices[i + 2]].position);
+      vec3 bb_min = min(min(a, b), c) - band;
+      vec3 bb_max = max(max(a, b), c) + band;
+      // voxel i covers [i, i + 1) * size, its center sits at + 0.5. Clamped
+      // before the conversion, a float out of the int range is undefined
+      ivec3 from = ivec3(clamp(
+          floor((bb_min - outer_bb.min) / voxel_size - vec3(0.5)), vec3(0.0f),
+          vec3(resolution)));
+      ivec3 to = ivec3(clamp(
+          floor((bb_max - outer_bb.min) / voxel_size - vec3(0.5)) + vec3(1.0f),
+          vec3(-1.0f), vec3(resolution - 1)));
+      for (int z = from.z; z <= to.z; ++z) {
+        for (int y = from.y; y <= to.y; ++y) {
+          for (int x = from.x; x <= to.x; ++x) {
+            in_band[index(x, y, z)] = 1;
+          }
+        }
+      }
+    }
+
+    // 2. exact distances inside the band, keeping the closest point around
+    // for the sweep
+    auto distances = vector<float>(voxel_count, INFINITY);
+    auto closest_points = vector<vec3>(voxel_count);
+    auto has_closest = vector<char>(voxel_count, 0);
+    auto batch = TriangleBatch(bvh.vertices, bvh.indices);
+    for_each_tile(resolution, [&](ivec3 start, ivec3 end) {
+      for (int z = start.z; z < end.z; ++z) {
+        for (int y = start.y; y < end.y; ++y) {
+          for (int x = start.x; x < end.x; ++x) {
+            int i = index(x, y, z);
+            if (!in_band[i]) {
+              continue;
+            }
+            vec3 p = voxel_center(ivec3(x, y, z), outer_bb.min, outer_bb.max,
+                                  image_size);
+            auto closest = closest_triangle_bvh_batched(
+                p, bvh.vertices, bvh.indices, bvh.nodes, batch);
+            distances[i] = signed_distance(p, closest);
+            closest_points[i] = closest.point;
+            has_closest[i] = 1;
+          }
+        }
+      }
+    });
+
+    // 3. fast sweeping, each voxel takes a neighbour's closest point when it
+    // is nearer than its own. 8 sweep orders cover every direction the
+    // information can travel in
+    auto unsigned_distances = vector<float>(voxel_count, INFINITY);
+    for (int i = 0; i < voxel_count; ++i) {
+      if (in_band[i]) {
+        unsigned_distances[i] = abs(distances[i]);
+      }
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int order = 0; order < 8; ++order) {
+        ivec3 dir = ivec3(order & 1 ? -1 : 1, order & 2 ? -1 : 1,
+                          order & 4 ? -1 : 1);
+        for (int zi = 0; zi < resolution; ++zi) {
+          int z = dir.z > 0 ? zi : resolution - 1 - zi;
+          for (int yi = 0; yi < resolution; ++yi) {
+            int y = dir.y > 0 ? yi : resolution - 1 - yi;
+            for (int xi = 0; xi < resolution; ++xi) {
+              int x = dir.x > 0 ? xi : resolution - 1 - xi;
+              int i = index(x, y, z);
+              if (in_band[i]) {
+                continue;
+              }
+              vec3 p = voxel_center(ivec3(x, y, z), outer_bb.min,
+                                    outer_bb.max, image_size);
+              ivec3 neighbours[3] = {ivec3(x - dir.x, y, z),
+                                     ivec3(x, y - dir.y, z),
+                                     ivec3(x, y, z - dir.z)};
+              for (auto n: neighbours) {
+                if (n.x < 0 || n.y < 0 || n.z < 0 || n.x >= resolution ||
+                    n.y >= resolution || n.z >= resolution) {
+                  continue;
+                }
+                int j = index(n.x, n.y, n.z);
+                if (!has_closest[j]) {
+                  continue;
+                }
+                float d = distance(p, closest_points[j]);
+                if (d < unsigned_distances[i]) {
+                  unsigned_distances[i] = d;
+                  closest_points[i] = closest_points[j];
+                  has_closest[i] = 1;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+
+    // 4. sign, every region outside the band is flood filled and takes the
+    // sign most of the band voxels bordering it have
+    auto region = vector<int>(voxel_count, -1);
+    auto queue = vector<int>();
+    for (int seed = 0; seed < voxel_count; ++seed) {
+      if (in_band[seed] || region[seed] != -1) {
+        continue;
+      }
+      int votes = 0;
+      queue.clear();
+      queue.push_back(seed);
+      region[seed] = seed;
+      for (int q = 0; q < queue.size(); ++q) {
+        int i = queue[q];
+        ivec3 v = ivec3(i % resolution, (i / resolution) % resolution,
+                        i / (resolution * resolution));
+        ivec3 neighbours[6] = {v + ivec3(1, 0, 0), v - ivec3(1, 0, 0),
+                               v + ivec3(0, 1, 0), v - ivec3(0, 1, 0),
+                               v + ivec3(0, 0, 1), v - ivec3(0, 0, 1)};
+        for (auto n: neighbours) {
+          if (n.x < 0 || n.y < 0 || n.z < 0 || n.x >= resolution ||
+              n.y >= resolution || n.z >= resolution) {
+            continue;
+          }
+          int j = index(n.x, n.y, n.z);
+          if (in_band[j]) {
+            votes += distances[j] < 0.0f ? -1 : 1;
+          } else if (region[j] == -1) {
+            region[j] = seed;
+            queue.push_back(j);
+          }
+        }
+      }
+
+      float sign = votes < 0 ? -1.0f : 1.0f;
+      for (int i: queue) {
+        // no triangles at all, same fallback as the exact bake
+        float d = has_closest[i] ? unsigned_distances[i] : 1000000.0f;
+        distances[i] = sign * d;
+      }
+    }
+
+    return distances;
+  }
+
+  // corners of every triangle, 3 per triangle
+  static vector<vec3> triangles(Mesh &mesh) {
+    auto corners = vector<vec3>();
+    int count =
+        mesh.indices.empty() ? mesh.vertices.size() : mesh.indices.size();
+    for (int i = 0; i + 2 < count; i += 3) {
+      for (int c = 0; c < 3; ++c) {
+        int v = mesh.indices.empty() ? i + c : mesh.indices[i + c];
+        corners.push_back(mesh.vertices[v].position);
+      }
+    }
+    return corners;
+  }
+
+  // triangles only in one of the meshes (removed and added), compared by
+  // their corner positions so reindexing does not count as a change
+  static vector<vec3> changed_triangles(Mesh &old_mesh, Mesh &new_mesh) {
+    auto key = [](const vec3 *corners) {
+      // start at the smallest corner so rotations match, winding is kept
+      int first = 0;
+      for (int c = 1; c < 3; ++c) {
+        if (memcmp(&corners[c], &corners[first], sizeof(vec3)) < 0) {
+          first = c;
+        }
+      }
+      string bytes(3 * sizeof(vec3), '\0');
+      for (int c = 0; c < 3; ++c) {
+        memcpy(bytes.data() + c * sizeof(vec3), &corners[(first + c) % 3],
+               sizeof(vec3));
+      }
+      return bytes;
+    };
+
+    // +1 per old triangle, -1 per new one, anything left over changed
+    auto counts = unordered_map<string, int>();
+    auto old_corners = triangles(old_mesh);
+    auto new_corners = triangles(new_mesh);
+    for (int i = 0; i < old_corners.size(); i += 3) {
+      counts[key(&old_corners[i])] += 1;
+    }
+    for (int i = 0; i < new_corners.size(); i += 3) {
+      counts[key(&new_corners[i])] -= 1;
+    }
+
+    auto changed = vector<vec3>();
+    for (auto &[bytes, count]: counts) {
+      if (count == 0) {
+        continue;
+      }
+      vec3 corners[3];
+      memcpy(corners, bytes.data(), sizeof(corners));
+      for (int n = 0; n < abs(count); ++n) {
+        changed.insert(changed.end(), corners, corners + 3);
+      }
+    }
+    return changed;
+  }
+
+  void for_each_tile(int resolution, function<void(ivec3, ivec3)> func) {
+    int tiles_per_axis = (resolution + TILE_SIZE - 1) / TILE_SIZE;
+    int tile_count = tiles_per_axis * tiles_per_axis * tiles_per_axis;
+    int worker_count = std::max(1, std::min(thread_count, tile_count));
+
+    // deal the tiles round robin so neighbouring tiles (similar cost) spread
+    // out over the workers
+    auto queues = vector<TileQueue>(worker_count);
+    for (int tile = 0; tile < tile_count; ++tile) {
+      queues[tile % worker_count].tiles.push_back(tile);
+    }
+
+    auto worker = [&](int id) {
+      while (true) {
+        auto tile = pop(queues[id], false);
+        for (int i = 1; !tile && i < worker_count; ++i) {
+          tile = pop(queues[(id + i) % worker_count], true);
+        }
+        // tiles are never added after the start, so empty means done
+        if (!tile) {
+          return;
+        }
+        ivec3 start = ivec3(*tile % tiles_per_axis,
+                            (*tile / tiles_per_axis) % tiles_per_axis,
+                            *tile / (tiles_per_axis * tiles_per_axis)) *
+                      TILE_SIZE;
+        func(start, min(start + TILE_SIZE, ivec3(resolution)));
+      }
+    };
+
+    auto workers = vector<jthread>();
+    for (int id = 1; id < worker_count; ++id) {
+      workers.emplace_back(worker, id);
+    }
+    worker(0);
+  }
+
+  optional<int> pop(TileQueue &queue, bool steal) {
+    lock_guard guard(queue.lock);
+    if (queue.tiles.empty()) {
+      return nullopt;
+    }
+    int tile;
+    if (steal) {
+      tile = queue.tiles.back();
+      queue.tiles.pop_back();
+    } else {
+      tile = queue.tiles.front();
+      queue.tiles.pop_front();
+    }
+    return tile;
+  }
+};
+
+} // namespace ale::graphics::sdf
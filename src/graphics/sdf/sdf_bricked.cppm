@@ -0,0 +1,153 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <vector>
+
+export module graphics:sdf.sdf_bricked;
+import data;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+
+export namespace ale::graphics::sdf {
+
+constexpr int SDF_BRICK_SIZE = 8;
+constexpr int SDF_BRICK_VOXELS =
+    SDF_BRICK_SIZE * SDF_BRICK_SIZE * SDF_BRICK_SIZE;
+
+// Sparse version of a dense sdf grid. The grid is split into 8^3 cells, only
+// cells close to the surface keep their voxels (a brick), every other cell
+// keeps a single distance: the one of its voxel centers closest to the
+// surface, moved half a voxel diagonal towards it. Every point of the cell
+// is at most that far from a voxel center, so the distance is a lower bound
+// over the whole cell and a raymarcher stepping with it never overshoots.
+class SdfBricked {
+public:
+  static constexpr int EMPTY_CELL = -1;
+
+  int resolution; // dense voxels per axis
+  int grid_size; // cells per axis
+  BoundingBox outer_bb;
+
+  // per cell, laid out like Texture3D (x fastest, then y, then z)
+  vector<int> cells; // brick index or EMPTY_CELL
+  vector<float> far_distances;
+
+  // brick_count * SDF_BRICK_VOXELS, every brick laid out like a Texture3D
+  vector<float> bricks;
+
+  // dense is laid out like Texture3D. Cells whose closest voxel is within
+  // band_cells cell diagonals of the surface get a brick, the default keeps
+  // every cell the surface passes through.
+  SdfBricked(const vector<float> &dense, int resolution, BoundingBox outer_bb,
+             float band_cells = 0.5f) :
+      resolution(resolution),
+      grid_size((resolution + SDF_BRICK_SIZE - 1) / SDF_BRICK_SIZE),
+      outer_bb(outer_bb) {
+    int cell_count = grid_size * grid_size * grid_size;
+    cells.resize(cell_count, EMPTY_CELL);
+    far_distances.resize(cell_count, INFINITY);
+
+    vec3 voxel_size = outer_bb.getSize() / vec3(resolution);
+    float band = length(voxel_size * float(SDF_BRICK_SIZE)) * band_cells +
+                 length(voxel_size);
+    float half_diagonal = length(voxel_size) * 0.5f;
+
+    for (int cz = 0; cz < grid_size; ++cz) {
+      for (int cy = 0; cy < grid_size; ++cy) {
+        for (int cx = 0; cx < grid_size; ++cx) {
+          ivec3 start = ivec3(cx, cy, cz) * SDF_BRICK_SIZE;
+          ivec3 end = min(start + SDF_BRICK_SIZE, ivec3(resolution));
+
+          float closest = INFINITY;
+          for (int z = start.z; z < end.z; ++z) {
+            for (int y = start.y; y < end.y; ++y) {
+              for (int x = start.x; x < end.x; ++x) {
+                float d = dense[(z * resolution + y) * resolution + x];
+                if (abs(d) < abs(closest)) {
+                  closest = d;
+                }
+              }
+            }
+          }
+
+          int cell = (cz * grid_size + cy) * grid_size + cx;
+          if (abs(closest) > band) {
+            // band is more than half a diagonal, the sign is kept
+            far_distances[cell] = closest - sign(closest) * half_diagonal;
+            continue;
+          }
+          far_distances[cell] = closest;
+
+          // cells at the edge of a non multiple of 8 grid repeat their last
+          // voxel
+          cells[cell] = bricks.size() / SDF_BRICK_VOXELS;
+          for (int z = 0; z < SDF_BRICK_SIZE; ++z) {
+            for (int y = 0; y < SDF_BRICK_SIZE; ++y) {
+              for (int x = 0; x < SDF_BRICK_SIZE; ++x) {
+                ivec3 v = min(start + ivec3(x, y, z), ivec3(resolution - 1));
+                bricks.push_back(
+                    dense[(v.z * resolution + v.y) * resolution + v.x]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  int brick_count() const { return bricks.size() / SDF_BRICK_VOXELS; }
+
+  // distance stored for a dense voxel coordinate
+  float voxel(ivec3 v) const {
+    v = clamp(v, ivec3(0), ivec3(resolution - 1));
+    ivec3 cell = v / SDF_BRICK_SIZE;
+    int brick = cells[(cell.z * grid_size + cell.y) * grid_size + cell.x];
+    if (brick == EMPTY_CELL) {
+      return far_distances[(cell.z * grid_size + cell.y) * grid_size + cell.x];
+    }
+    ivec3 local = v - cell * SDF_BRICK_SIZE;
+    return bricks[brick * SDF_BRICK_VOXELS +
+                  (local.z * SDF_BRICK_SIZE + local.y) * SDF_BRICK_SIZE +
+                  local.x];
+  }
+
+  // trilinear distance at p, p is in the sdf's local space
+  float sample(vec3 p) const {
+    // voxel centers sit at + 0.5
+    vec3 coord = (p - outer_bb.min) / outer_bb.getSize() * float(resolution) -
+                 vec3(0.5f);
+    vec3 base = floor(coord);
+    vec3 t = coord - base;
+    ivec3 v = ivec3(base);
+
+    float c000 = voxel(v);
+    float c100 = voxel(v + ivec3(1, 0, 0));
+    float c010 = voxel(v + ivec3(0, 1, 0));
+    float c110 = voxel(v + ivec3(1, 1, 0));
+    float c001 = voxel(v + ivec3(0, 0, 1));
+    float c101 = voxel(v + ivec3(1, 0, 1));
+    float c011 = voxel(v + ivec3(0, 1, 1));
+    float c111 = voxel(v + ivec3(1, 1, 1));
+
+    float c00 = mix(c000, c100, t.x);
+    float c10 = mix(c010, c110, t.x);
+    float c01 = mix(c001, c101, t.x);
+    float c11 = mix(c011, c111, t.x);
+    return mix(mix(c00, c10, t.y), mix(c01, c11, t.y), t.z);
+  }
+
+  size_t memory_bytes() const {
+    return cells.size() * sizeof(int) + far_distances.size() * sizeof(float) +
+           bricks.size() * sizeof(float);
+  }
+
+  size_t dense_memory_bytes() const {
+    return (size_t) resolution * resolution * resolution * sizeof(float);
+  }
+};
+
+} // namespace ale::graphics::sdf
@@ -0,0 +1,131 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <numeric>
+#include <vector>
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
+
+export module graphics:sdf.sdf_bvh;
+import :mesh;
+
+using namespace std;
+using namespace glm;
+
+export namespace ale::graphics::sdf {
+
+// Triangle BVH used by the sdf generators for nearest triangle queries.
+// Triangles are reordered so every leaf owns a contiguous range of indices,
+// which lets the node array be uploaded as is into an SSBO.
+class SdfBvh {
+public:
+  vector<SdfVertex> vertices;
+  vector<unsigned int> indices;
+  vector<BvhNode> nodes;
+
+  SdfBvh(Mesh &mesh, int max_leaf_size = 4) : max_leaf_size(max_leaf_size) {
+    vertices.reserve(mesh.vertices.size());
+    for (auto &v: mesh.vertices) {
+      vertices.push_back(SdfVertex{.position = vec4(v.position, 1.0)});
+    }
+
+    // meshes drawn without an EBO still need triangles
+    auto mesh_indices = mesh.indices;
+    if (mesh_indices.empty()) {
+      mesh_indices.resize(mesh.vertices.size());
+      iota(mesh_indices.begin(), mesh_indices.end(), 0);
+    }
+
+    int triangle_count = mesh_indices.size() / 3;
+    triangles.resize(triangle_count);
+    iota(triangles.begin(), triangles.end(), 0);
+    centroids.reserve(triangle_count);
+    for (int i = 0; i < triangle_count; ++i) {
+      centroids.push_back((position(mesh_indices[i * 3]) +
+                           position(mesh_indices[i * 3 + 1]) +
+                           position(mesh_indices[i * 3 + 2])) /
+                          3.0f);
+    }
+
+    // a full tree has less than 2n nodes
+    nodes.reserve(std::max(1, triangle_count * 2));
+    nodes.push_back(BvhNode{});
+    build(0, 0, triangle_count, 0, mesh_indices);
+
+    indices.reserve(triangle_count * 3);
+    for (int tri: triangles) {
+      indices.push_back(mesh_indices[tri * 3]);
+      indices.push_back(mesh_indices[tri * 3 + 1]);
+      indices.push_back(mesh_indices[tri * 3 + 2]);
+    }
+
+    triangles.clear();
+    centroids.clear();
+  }
+
+private:
+  int max_leaf_size;
+
+  // build scratch, triangle ids are permuted in place while splitting
+  vector<int> triangles;
+  vector<vec3> centroids;
+
+  vec3 position(unsigned int index) { return vec3(vertices[index].position); }
+
+  void build(int node_index, int first, int count, int depth,
+             vector<unsigned int> &mesh_indices) {
+    vec3 bb_min = vec3(INFINITY);
+    vec3 bb_max = vec3(-INFINITY);
+    vec3 centroid_min = vec3(INFINITY);
+    vec3 centroid_max = vec3(-INFINITY);
+    for (int i = first; i < first + count; ++i) {
+      int tri = triangles[i];
+      for (int v = 0; v < 3; ++v) {
+        vec3 p = position(mesh_indices[tri * 3 + v]);
+        bb_min = min(bb_min, p);
+        bb_max = max(bb_max, p);
+      }
+      centroid_min = min(centroid_min, centroids[tri]);
+      centroid_max = max(centroid_max, centroids[tri]);
+    }
+    if (count == 0) {
+      bb_min = vec3(0.0);
+      bb_max = vec3(0.0);
+    }
+    nodes[node_index].bb_min = vec4(bb_min, 0.0);
+    nodes[node_index].bb_max = vec4(bb_max, 0.0);
+
+    vec3 extent = centroid_max - centroid_min;
+    int axis = 0;
+    if (extent.y > extent.x)
+      axis = 1;
+    if (extent.z > extent[axis])
+      axis = 2;
+
+    // all centroids in one spot can't be split any further
+    if (count <= max_leaf_size || depth >= SDF_BVH_MAX_DEPTH ||
+        extent[axis] <= 0.0f) {
+      nodes[node_index].data = ivec4(first, 0, count, 1);
+      return;
+    }
+
+    // median split along the longest centroid axis
+    int half = count / 2;
+    nth_element(triangles.begin() + first, triangles.begin() + first + half,
+                triangles.begin() + first + count, [&](int a, int b) {
+                  return centroids[a][axis] < centroids[b][axis];
+                });
+
+    int left = nodes.size();
+    nodes.push_back(BvhNode{});
+    int right = nodes.size();
+    nodes.push_back(BvhNode{});
+    nodes[node_index].data = ivec4(left, right, 0, 0);
+
+    build(left, first, half, depth + 1, mesh_indices);
+    build(right, first + half, count - half, depth + 1, mesh_indices);
+  }
+};
+
+} // namespace ale::graphics::sdf
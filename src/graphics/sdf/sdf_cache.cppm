@@ -0,0 +1,313 @@
+module;
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <glm/glm.hpp>
+#include <optional>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <vector>
+#include <zstd.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+export module graphics:sdf.sdf_cache;
+import data;
+import :mesh;
+import :sdf.sdf_quantize;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+namespace fs = std::filesystem;
+
+export namespace ale::graphics::sdf {
+
+constexpr uint32_t SDF_CACHE_MAGIC = 0x46445341; // "ASDF"
+constexpr uint32_t SDF_CACHE_VERSION = 1;
+
+// Written as is at the start of every cache file, followed by the zstd
+// compressed distances.
+struct SdfCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t generator_version;
+  int32_t resolution;
+  int32_t format; // SdfAtlasFormat of the payload, always F32 for now
+  uint32_t reserved = 0;
+  float inner_bb_min[3];
+  float inner_bb_max[3];
+  float outer_bb_min[3];
+  float outer_bb_max[3];
+  uint64_t content_hash;
+  uint64_t uncompressed_size; // bytes
+  uint64_t compressed_size; // bytes
+};
+
+// Baked sdfs on disk, addressed by a hash of the mesh data, resolution and
+// generator version, so an edited mesh or a changed generator misses
+// instead of loading a stale sdf. Floats are stored byte plane by byte
+// plane (all first bytes, then all second bytes...) which zstd compresses
+// far better than interleaved floats.
+class SdfCache {
+  fs::path directory;
+  uint32_t generator_version;
+
+public:
+  SdfCache(fs::path directory, uint32_t generator_version) :
+      directory(std::move(directory)),
+      generator_version(generator_version) {}
+
+  // FNV-1a over positions and indices
+  uint64_t content_hash(Mesh &mesh, int resolution) {
+    uint64_t hash = 14695981039346656037ull;
+    auto feed = [&](const void *data, size_t size) {
+      auto bytes = static_cast<const unsigned char *>(data);
+      for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+      }
+    };
+    for (auto &vertex: mesh.vertices) {
+      feed(&vertex.position, sizeof(vec3));
+    }
+    feed(mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+    feed(&resolution, sizeof(resolution));
+    feed(&generator_version, sizeof(generator_version));
+    return hash;
+  }
+
+  fs::path path(uint64_t hash) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.sdf", (unsigned long long) hash);
+    return directory / name;
+  }
+
+  // nullopt on a miss or when the file does not match the mesh
+  optional<vector<float>> load(Mesh &mesh, int resolution) {
+    uint64_t hash = content_hash(mesh, resolution);
+    auto file_path = path(hash);
+    auto file = MappedFile(file_path);
+    if (file.data == nullptr) {
+      return nullopt;
+    }
+
+    SdfCacheHeader header;
+    if (file.size < sizeof(header)) {
+      SPDLOG_WARN("sdf cache {} is truncated", file_path.string());
+      return nullopt;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    size_t voxel_count = (size_t) resolution * resolution * resolution;
+    if (!matches(header, hash, mesh, resolution, file.size)) {
+      SPDLOG_WARN("sdf cache {} does not match its mesh, ignoring it",
+                  file_path.string());
+      return nullopt;
+    }
+
+    auto shuffled = vector<unsigned char>(header.uncompressed_size);
+    size_t size = ZSTD_decompress(shuffled.data(), shuffled.size(),
+                                  file.data + sizeof(header),
+                                  header.compressed_size);
+    if (ZSTD_isError(size) || size != shuffled.size()) {
+      SPDLOG_WARN("sdf cache {} failed to decompress", file_path.string());
+      return nullopt;
+    }
+
+    auto distances = vector<float>(voxel_count);
+    auto bytes = reinterpret_cast<unsigned char *>(distances.data());
+    for (size_t i = 0; i < voxel_count; ++i) {
+      for (size_t b = 0; b < sizeof(float); ++b) {
+        bytes[i * sizeof(float) + b] = shuffled[b * voxel_count + i];
+      }
+    }
+    return distances;
+  }
+
+  // whether load would hit, without decompressing anything: only the header
+  // is read
+  bool contains(Mesh &mesh, int resolution) {
+    uint64_t hash = content_hash(mesh, resolution);
+    auto file_path = path(hash);
+    std::error_code error;
+    auto file_size = fs::file_size(file_path, error);
+    SdfCacheHeader header;
+    if (error || file_size < sizeof(header)) {
+      return false;
+    }
+
+    ifstream in_file(file_path, std::ios::binary);
+    if (!in_file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+      return false;
+    }
+    return matches(header, hash, mesh, resolution, file_size);
+  }
+
+  void save(Mesh &mesh, int resolution, const vector<float> &distances) {
+    uint64_t hash = content_hash(mesh, resolution);
+    auto file_path = path(hash);
+
+    size_t voxel_count = distances.size();
+    auto shuffled = vector<unsigned char>(voxel_count * sizeof(float));
+    auto bytes = reinterpret_cast<const unsigned char *>(distances.data());
+    for (size_t i = 0; i < voxel_count; ++i) {
+      for (size_t b = 0; b < sizeof(float); ++b) {
+        shuffled[b * voxel_count + i] = bytes[i * sizeof(float) + b];
+      }
+    }
+
+    auto compressed = vector<char>(ZSTD_compressBound(shuffled.size()));
+    size_t compressed_size =
+        ZSTD_compress(compressed.data(), compressed.size(), shuffled.data(),
+                      shuffled.size(), ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(compressed_size)) {
+      SPDLOG_WARN("failed to compress sdf {}: {}", file_path.string(),
+                  ZSTD_getErrorName(compressed_size));
+      return;
+    }
+
+    auto outer_bb = mesh.boundingBox.apply_scale(Transform{
+        .scale = vec3(1.1, 1.1, 1.1),
+    });
+    auto header = SdfCacheHeader{
+        .magic = SDF_CACHE_MAGIC,
+        .version = SDF_CACHE_VERSION,
+        .generator_version = generator_version,
+        .resolution = resolution,
+        .format = (int32_t) SdfAtlasFormat::F32,
+        .content_hash = hash,
+        .uncompressed_size = shuffled.size(),
+        .compressed_size = compressed_size,
+    };
+    copy_vec3(mesh.boundingBox.min, header.inner_bb_min);
+    copy_vec3(mesh.boundingBox.max, header.inner_bb_max);
+    copy_vec3(outer_bb.min, header.outer_bb_min);
+    copy_vec3(outer_bb.max, header.outer_bb_max);
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+    ofstream out_file(file_path, std::ios::binary);
+    if (!out_file.is_open()) {
+      SPDLOG_WARN("unable to write sdf cache {}", file_path.string());
+      return;
+    }
+    out_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out_file.write(compressed.data(), compressed_size);
+    SPDLOG_TRACE("saved sdf cache {}, {} -> {} bytes", file_path.string(),
+                 shuffled.size(), compressed_size);
+  }
+
+private:
+  static void copy_vec3(vec3 v, float *out) {
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+  }
+
+  // header of a file of file_size bytes written for mesh at resolution
+  bool matches(const SdfCacheHeader &header, uint64_t hash, Mesh &mesh,
+               int resolution, size_t file_size) {
+    size_t voxel_count = (size_t) resolution * resolution * resolution;
+    return header.magic == SDF_CACHE_MAGIC &&
+           header.version == SDF_CACHE_VERSION &&
+           header.generator_version == generator_version &&
+           header.resolution == resolution &&
+           header.format == (int32_t) SdfAtlasFormat::F32 &&
+           header.content_hash == hash &&
+           header.uncompressed_size == voxel_count * sizeof(float) &&
+           header.compressed_size == file_size - sizeof(header) &&
+           same_bounding_box(header, mesh.boundingBox);
+  }
+
+  static bool same_bounding_box(const SdfCacheHeader &header,
+                                const BoundingBox &bb) {
+    for (int i = 0; i < 3; ++i) {
+      if (header.inner_bb_min[i] != bb.min[i] ||
+          header.inner_bb_max[i] != bb.max[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // read only view of a whole file, data is nullptr when it can't be opened
+  struct MappedFile {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    explicit MappedFile(const fs::path &path) {
+#ifdef _WIN32
+      file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+      if (file == INVALID_HANDLE_VALUE) {
+        return;
+      }
+      LARGE_INTEGER file_size;
+      if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        return;
+      }
+      mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping == nullptr) {
+        return;
+      }
+      data = static_cast<const unsigned char *>(
+          MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      size = data != nullptr ? file_size.QuadPart : 0;
+#else
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return;
+      }
+      struct stat info;
+      if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *mapped =
+            mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+          data = static_cast<const unsigned char *>(mapped);
+          size = info.st_size;
+        }
+      }
+      // the mapping stays valid after the descriptor is closed
+      close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+      if (data != nullptr) {
+        UnmapViewOfFile(data);
+      }
+      if (mapping != nullptr) {
+        CloseHandle(mapping);
+      }
+      if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+      }
+#else
+      if (data != nullptr) {
+        munmap(const_cast<unsigned char *>(data), size);
+      }
+#endif
+    }
+
+    MappedFile(const MappedFile &other) = delete;
+    MappedFile &operator=(const MappedFile &other) = delete;
+  };
+};
+
+} // namespace ale::graphics::sdf
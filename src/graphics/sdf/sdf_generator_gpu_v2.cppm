@@ -3,14 +3,23 @@
 //
 module;
 
+#include <algorithm>
+#include <cstdint>
+#include <format>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <limits>
+#include <stdexcept>
 #include <vector>
+#include "src/graphics/gpu_bindings.h"
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
 
 export module graphics:sdf.sdf_generator_gpu_v2;
 import data;
 import :compute_shader;
 import :model;
+import :sdf.sdf_baker_cpu;
+import :sdf.sdf_bvh;
 
 
 using namespace std;
@@ -18,28 +27,82 @@ using namespace glm;
 
 export namespace ale::graphics::sdf {
 class SdfGeneratorGPUV2 {
+public:
+  // bump whenever the baked distances change, invalidates sdf caches
+  static constexpr uint32_t VERSION = 2;
+
+private:
   ComputeShader sdfgen_v2;
+  ComputeShader sdfgen_v2_batched;
+  SdfBakerCpu sdf_baker_cpu;
 
   struct GpuData {
-    glm::ivec4 size; // [0] = vertices.size, [1] = indices.size, [2] and [3] is
-                     // unused (0)
+    glm::ivec4 size; // [0] = vertices.size, [1] = indices.size,
+                     // [2] = bvh_nodes.size, [3] is unused (0)
     glm::vec4 inner_bb_min;
     glm::vec4 inner_bb_max;
     glm::vec4 outer_bb_min;
     glm::vec4 outer_bb_max;
   };
 
+  // kept between batches, only reallocated when a batch outgrows them
+  struct Buffer {
+    unsigned int id = 0;
+    size_t capacity = 0; // bytes
+  };
   struct Buffers {
-    unsigned int vertex_buffer;
-    unsigned int index_buffer;
-    unsigned int ubo;
+    Buffer vertex_buffer;
+    Buffer index_buffer;
+    Buffer bvh_buffer;
+    Buffer mesh_buffer;
+    Buffer distance_buffer;
   };
+  Buffers batch_buffers;
+  // queried on the first batch, 0 until then
+  size_t block_size_limit = 0;
+  GLint group_count_limit = 0;
 
 public:
+  // voxels per work group axis of the batched shader
+  static constexpr int BATCH_GROUP_SIZE = 8;
+
   SdfGeneratorGPUV2() :
-      sdfgen_v2(afs::root("resources/shaders/sdf/sdf_generator_gpu_v2.cs")) {}
+      sdfgen_v2(afs::root("resources/shaders/sdf/sdf_generator_gpu_v2.cs")),
+      sdfgen_v2_batched(afs::root(
+          "resources/shaders/sdf/sdf_generator_gpu_v2_batched.cs")) {}
+
+  ~SdfGeneratorGPUV2() {
+    for (auto buffer: {&batch_buffers.vertex_buffer,
+                       &batch_buffers.index_buffer, &batch_buffers.bvh_buffer,
+                       &batch_buffers.mesh_buffer,
+                       &batch_buffers.distance_buffer}) {
+      glDeleteBuffers(1, &buffer->id);
+    }
+  }
+
+  SdfGeneratorGPUV2(const SdfGeneratorGPUV2 &other) = delete;
+  SdfGeneratorGPUV2 &operator=(const SdfGeneratorGPUV2 &other) = delete;
+
+  vector<Texture3D> generate_cpu(Model &m, int resolution,
+                                 SdfBakeMode mode = SdfBakeMode::EXACT) {
+    auto sdfs = vector<Texture3D>();
+    for (auto &mesh: m.meshes) {
+      sdfs.emplace_back(generate_cpu(mesh, resolution, mode));
+    }
+    return sdfs;
+  }
 
-  vector<Texture3D> generate_cpu(Model &M, int resolution) { return {}; }
+  Texture3D generate_cpu(Mesh &mesh, int resolution,
+                         SdfBakeMode mode = SdfBakeMode::EXACT) {
+    auto distances = sdf_baker_cpu.bake(mesh, resolution, mode);
+    return Texture3D(Texture3D::Meta{.width = resolution,
+                                     .height = resolution,
+                                     .depth = resolution,
+                                     .internal_format = GL_R32F,
+                                     .input_format = GL_RED,
+                                     .input_type = GL_FLOAT},
+                     distances);
+  }
 
   vector<Texture3D> generate_gpu(Model &m, int resolution) {
     auto sdfs = vector<Texture3D>();
@@ -50,27 +113,35 @@ public:
   }
 
   Texture3D generate_gpu(Mesh &mesh, int resolution) {
+    auto bvh = SdfBvh(mesh);
+
     unsigned int vertex_buffer;
     unsigned int index_buffer;
+    unsigned int bvh_buffer;
     unsigned int ubo;
 
     glGenBuffers(1, &vertex_buffer);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, vertex_buffer);
     glBufferData(GL_SHADER_STORAGE_BUFFER,
-                 mesh.vertices.size() * sizeof(Vertex), mesh.vertices.data(),
+                 bvh.vertices.size() * sizeof(SdfVertex), bvh.vertices.data(),
                  GL_STATIC_DRAW);
 
     glGenBuffers(1, &index_buffer);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, index_buffer);
     glBufferData(GL_SHADER_STORAGE_BUFFER,
-                 mesh.indices.size() * sizeof(unsigned int),
-                 mesh.indices.data(), GL_STATIC_DRAW);
+                 bvh.indices.size() * sizeof(unsigned int), bvh.indices.data(),
+                 GL_STATIC_DRAW);
+
+    glGenBuffers(1, &bvh_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvh_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bvh.nodes.size() * sizeof(BvhNode),
+                 bvh.nodes.data(), GL_STATIC_DRAW);
 
     auto outer_bb = mesh.boundingBox.apply_scale(Transform{
         .scale = vec3(1.1, 1.1, 1.1),
     });
     auto gpu_data = GpuData{
-        ivec4(mesh.vertices.size(), mesh.indices.size(), 0, 0),
+        ivec4(bvh.vertices.size(), bvh.indices.size(), bvh.nodes.size(), 0),
         vec4(mesh.boundingBox.min, 0.0), vec4(mesh.boundingBox.max, 0.0),
         vec4(outer_bb.min, 0.0), vec4(outer_bb.max, 0.0)};
 
@@ -89,18 +160,216 @@ public:
                                                   .input_format = GL_RED,
                                                   .input_type = GL_FLOAT},
                                   empty);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, vertex_buffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, index_buffer);
-    glBindBufferBase(GL_UNIFORM_BUFFER, 4, ubo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_GEN_VERTEX_BINDING,
+                     vertex_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_GEN_INDEX_BINDING,
+                     index_buffer);
+    glBindBufferBase(GL_UNIFORM_BUFFER, SDF_GEN_BOUNDS_BINDING, ubo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_GEN_BVH_BINDING, bvh_buffer);
 
     this->sdfgen_v2.execute_3d_save_to_texture_3d(texture);
 
     glDeleteBuffers(1, &vertex_buffer);
     glDeleteBuffers(1, &index_buffer);
+    glDeleteBuffers(1, &bvh_buffer);
     glDeleteBuffers(1, &ubo);
 
     return texture;
   };
+
+  vector<Texture3D> generate_gpu_batched(Model &m, int resolution) {
+    auto meshes = vector<Mesh *>();
+    for (auto &mesh: m.meshes) {
+      meshes.push_back(&mesh);
+    }
+    return generate_gpu_batched(meshes, vector<int>(meshes.size(), resolution));
+  }
+
+  // Same distances as generate_gpu, but the meshes go through one set of
+  // buffers and one dispatch of 8x8x8 groups per batch, instead of a buffer
+  // set and a res^3 dispatch of single invocations per mesh. A batch is cut
+  // where the next mesh would overflow a shader storage block or the group
+  // count along z. The distances are copied into the textures on the gpu,
+  // nothing is read back.
+  vector<Texture3D> generate_gpu_batched(vector<Mesh *> &meshes,
+                                         const vector<int> &resolutions) {
+    auto textures = vector<Texture3D>();
+    auto batch = Batch();
+    for (int i = 0; i < meshes.size(); ++i) {
+      auto bvh = SdfBvh(*meshes[i]);
+      int resolution = resolutions[i];
+      if (!batch.meshes.empty() && !fits(batch, bvh, resolution)) {
+        dispatch(batch, textures);
+        batch = Batch();
+      }
+      if (!fits(batch, bvh, resolution)) {
+        throw runtime_error(
+            format("sdf batch: mesh {} at resolution {} is over the limits "
+                   "of the gpu",
+                   i, resolution));
+      }
+      append(batch, bvh, *meshes[i], resolution);
+    }
+    if (!batch.meshes.empty()) {
+      dispatch(batch, textures);
+    }
+    return textures;
+  }
+
+private:
+  // meshes concatenated into the buffers of one dispatch
+  struct Batch {
+    vector<SdfVertex> vertices;
+    vector<unsigned int> indices;
+    vector<BvhNode> nodes;
+    vector<SdfBatchMesh> meshes;
+    size_t voxel_count = 0;
+    int max_resolution = 0;
+  };
+
+  // bytes of one shader storage block, also kept under INT_MAX floats so
+  // the offsets of SdfBatchMesh stay in an int
+  size_t max_block_size() {
+    if (block_size_limit == 0) {
+      GLint64 size = 0;
+      glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &size);
+      block_size_limit = std::min<size_t>(
+          size, static_cast<size_t>(numeric_limits<int>::max()) *
+                    sizeof(float));
+    }
+    return block_size_limit;
+  }
+
+  int max_group_count_z() {
+    if (group_count_limit == 0) {
+      glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 2, &group_count_limit);
+    }
+    return group_count_limit;
+  }
+
+  bool fits(const Batch &batch, const SdfBvh &bvh, int resolution) {
+    auto block = max_block_size();
+    size_t voxels = static_cast<size_t>(resolution) * resolution * resolution;
+    size_t groups = group_count(std::max(batch.max_resolution, resolution));
+    return (batch.vertices.size() + bvh.vertices.size()) * sizeof(SdfVertex) <=
+               block &&
+           (batch.indices.size() + bvh.indices.size()) *
+                   sizeof(unsigned int) <=
+               block &&
+           (batch.nodes.size() + bvh.nodes.size()) * sizeof(BvhNode) <= block &&
+           (batch.meshes.size() + 1) * sizeof(SdfBatchMesh) <= block &&
+           (batch.voxel_count + voxels) * sizeof(float) <= block &&
+           groups * (batch.meshes.size() + 1) <= max_group_count_z();
+  }
+
+  static int group_count(int resolution) {
+    return (resolution + BATCH_GROUP_SIZE - 1) / BATCH_GROUP_SIZE;
+  }
+
+  static void append(Batch &batch, const SdfBvh &bvh, Mesh &mesh,
+                     int resolution) {
+    int vertex_base = batch.vertices.size();
+    int triangle_base = batch.indices.size() / 3;
+    int node_base = batch.nodes.size();
+
+    // rebase onto the concatenated buffers
+    batch.vertices.insert(batch.vertices.end(), bvh.vertices.begin(),
+                          bvh.vertices.end());
+    for (auto index: bvh.indices) {
+      batch.indices.push_back(index + vertex_base);
+    }
+    for (auto node: bvh.nodes) {
+      if (node.data.w != 0) {
+        node.data.x += triangle_base;
+      } else {
+        node.data.x += node_base;
+        node.data.y += node_base;
+      }
+      batch.nodes.push_back(node);
+    }
+
+    auto outer_bb = mesh.boundingBox.apply_scale(Transform{
+        .scale = vec3(1.1, 1.1, 1.1),
+    });
+    batch.meshes.push_back(SdfBatchMesh{
+        .outer_bb_min = vec4(outer_bb.min, 0.0),
+        .outer_bb_max = vec4(outer_bb.max, 0.0),
+        .data = ivec4(node_base, resolution,
+                      static_cast<int>(batch.voxel_count),
+                      bvh.indices.size() / 3),
+    });
+    batch.voxel_count += static_cast<size_t>(resolution) * resolution *
+                         resolution;
+    batch.max_resolution = std::max(batch.max_resolution, resolution);
+  }
+
+  void dispatch(const Batch &batch, vector<Texture3D> &textures) {
+    upload(batch_buffers.vertex_buffer, batch.vertices);
+    upload(batch_buffers.index_buffer, batch.indices);
+    upload(batch_buffers.bvh_buffer, batch.nodes);
+    upload(batch_buffers.mesh_buffer, batch.meshes);
+    reserve(batch_buffers.distance_buffer, batch.voxel_count * sizeof(float));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_GEN_VERTEX_BINDING,
+                     batch_buffers.vertex_buffer.id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_GEN_INDEX_BINDING,
+                     batch_buffers.index_buffer.id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_GEN_BVH_BINDING,
+                     batch_buffers.bvh_buffer.id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_GEN_MESH_BINDING,
+                     batch_buffers.mesh_buffer.id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_GEN_DISTANCE_BINDING,
+                     batch_buffers.distance_buffer.id);
+
+    // every mesh gets the groups of the largest one along z, the shader
+    // finds its mesh by dividing by the x count
+    int groups = group_count(batch.max_resolution);
+    sdfgen_v2_batched.execute(groups, groups, groups * batch.meshes.size(),
+                              GL_PIXEL_BUFFER_BARRIER_BIT);
+
+    std::vector<float> empty;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, batch_buffers.distance_buffer.id);
+    for (auto &batch_mesh: batch.meshes) {
+      int resolution = batch_mesh.data.y;
+      auto &texture = textures.emplace_back(
+          Texture3D::Meta{.width = resolution,
+                          .height = resolution,
+                          .depth = resolution,
+                          .internal_format = GL_R32F,
+                          .input_format = GL_RED,
+                          .input_type = GL_FLOAT},
+          empty);
+      size_t offset = static_cast<size_t>(batch_mesh.data.z) * sizeof(float);
+      glBindTexture(GL_TEXTURE_3D, texture.id);
+      glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, resolution, resolution,
+                      resolution, GL_RED, GL_FLOAT,
+                      reinterpret_cast<void *>(offset));
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  // grows the buffer to at least size bytes, the contents are not kept
+  void reserve(Buffer &buffer, size_t size) {
+    if (buffer.id == 0) {
+      glGenBuffers(1, &buffer.id);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.id);
+    if (size > buffer.capacity) {
+      // some headroom so slightly bigger batches don't reallocate, but
+      // never past what a storage block can address
+      buffer.capacity = std::max(
+          size, std::min(buffer.capacity * 3 / 2, max_block_size()));
+      glBufferData(GL_SHADER_STORAGE_BUFFER, buffer.capacity, nullptr,
+                   GL_DYNAMIC_DRAW);
+    }
+  }
+
+  template <typename T> void upload(Buffer &buffer, const vector<T> &data) {
+    reserve(buffer, std::max<size_t>(data.size() * sizeof(T), sizeof(T)));
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data.size() * sizeof(T),
+                    data.data());
+  }
 };
 
 } // namespace ale::graphics::sdf
@@ -3,8 +3,6 @@
 #if !(GLSL)
 using namespace glm;
 using namespace std;
-using namespace ale;
-using namespace ale::graphics;
 #endif
 
 float dot2(vec3 v) { return dot(v, v); }
@@ -14,6 +12,12 @@ float distance2(vec3 a, vec3 b) {
   return ff * ff;
 }
 
+// 0 when p is inside the box
+float distance2_to_box(vec3 p, vec3 bb_min, vec3 bb_max) {
+  vec3 d = max(max(bb_min - p, p - bb_max), vec3(0.0));
+  return dot(d, d);
+}
+
 vec3 closest_point_on_segment(vec3 point, vec3 seg_start, vec3 seg_end) {
   vec3 segment = seg_end - seg_start;
   float t = dot(point - seg_start, segment) / dot(segment, segment);
@@ -83,55 +87,169 @@ vec3 closest_point_on_triangle(vec3 A, vec3 v0, vec3 v1, vec3 v2) {
   return closest;
 }
 
-void generate_sdf(ivec3 texel_coord, int vertices_size, int indices_size,
-                  vec3 outer_bb_min, vec3 outer_bb_max, ivec3 image_size
+ClosestTriangle no_triangle() {
+  ClosestTriangle result;
+  result.check_distance = 1000000.0;
+  result.distance = 1000000.0;
+  result.point = vec3(0.0);
+  result.normal = vec3(0.0);
+  return result;
+}
+
+// returns whichever of best and triangle abc is closer to p
+ClosestTriangle closer_triangle(ClosestTriangle best, vec3 p, vec3 a, vec3 b,
+                                vec3 c) {
+  vec3 closest_point = closest_point_on_triangle(p, a, b, c);
+  vec3 normal = normalize(cross(b - a, c - a));
+  float check_dist = distance(closest_point + normal * vec3(0.0001), p);
+  if (check_dist < best.check_distance) {
+    best.check_distance = check_dist;
+    best.distance = distance(closest_point, p);
+    best.point = closest_point;
+    best.normal = normal;
+  }
+  return best;
+}
+
+ClosestTriangle closest_triangle_brute_force(vec3 p, int indices_size
 #if !(GLSL)
-                  ,
-                  vector<Vertex> &vertices, vector<unsigned int> &indices,
-                  vector<vector<vector<vec4>>> &imgOutput, vec3 &chosen_normal
+                                             ,
+                                             const vector<SdfVertex> &vertices,
+                                             const vector<unsigned int> &indices
 #endif
 ) {
+  ClosestTriangle best = no_triangle();
+  for (int i = 0; i < indices_size; i += 3) {
+    best = closer_triangle(best, p, vec3(vertices[indices[i]].position),
+                           vec3(vertices[indices[i + 1]].position),
+                           vec3(vertices[indices[i + 2]].position));
+  }
+  return best;
+}
 
+ClosestTriangle closest_triangle_bvh(vec3 p, int root
+#if !(GLSL)
+                                     ,
+                                     const vector<SdfVertex> &vertices,
+                                     const vector<unsigned int> &indices,
+                                     const vector<BvhNode> &bvh_nodes
+#endif
+) {
+  ClosestTriangle best = no_triangle();
+
+  // at most one pending sibling per level, plus the two children just pushed
+  int stack[SDF_BVH_MAX_DEPTH + 1];
+  int stack_size = 0;
+  stack[stack_size++] = root;
+  while (stack_size > 0) {
+    BvhNode node = bvh_nodes[stack[--stack_size]];
+
+    // the nudged check distance is at most 0.0001 shorter than the real one
+    float box_distance =
+        sqrt(distance2_to_box(p, vec3(node.bb_min), vec3(node.bb_max)));
+    if (box_distance - 0.0001 > best.check_distance)
+      continue;
+
+    if (node.data.w != 0) {
+      int first = node.data.x * 3;
+      int last = first + node.data.z * 3;
+      for (int i = first; i < last; i += 3) {
+        best = closer_triangle(best, p, vec3(vertices[indices[i]].position),
+                               vec3(vertices[indices[i + 1]].position),
+                               vec3(vertices[indices[i + 2]].position));
+      }
+    } else {
+      BvhNode left = bvh_nodes[node.data.x];
+      BvhNode right = bvh_nodes[node.data.y];
+      float left_distance =
+          distance2_to_box(p, vec3(left.bb_min), vec3(left.bb_max));
+      float right_distance =
+          distance2_to_box(p, vec3(right.bb_min), vec3(right.bb_max));
+
+      // push the far child first, so the near one tightens the bound earlier
+      if (left_distance < right_distance) {
+        stack[stack_size++] = node.data.y;
+        stack[stack_size++] = node.data.x;
+      } else {
+        stack[stack_size++] = node.data.x;
+        stack[stack_size++] = node.data.y;
+      }
+    }
+  }
+  return best;
+}
+
+ClosestTriangle closest_triangle(vec3 p, int indices_size, int bvh_nodes_size
+#if !(GLSL)
+                                 ,
+                                 const vector<SdfVertex> &vertices,
+                                 const vector<unsigned int> &indices,
+                                 const vector<BvhNode> &bvh_nodes
+#endif
+) {
+  if (bvh_nodes_size > 0) {
+#if GLSL
+    return closest_triangle_bvh(p, 0);
+#else
+    return closest_triangle_bvh(p, 0, vertices, indices, bvh_nodes);
+#endif
+  }
+#if GLSL
+  return closest_triangle_brute_force(p, indices_size);
+#else
+  return closest_triangle_brute_force(p, indices_size, vertices, indices);
+#endif
+}
+
+// negative when p is behind the face of the closest triangle
+float signed_distance(vec3 p, ClosestTriangle closest) {
+  float t = dot(closest.normal, normalize(p - closest.point));
+  if (t < 0) {
+    return -abs(closest.distance);
+  }
+  return closest.distance;
+}
+
+vec3 voxel_center(ivec3 texel_coord, vec3 outer_bb_min, vec3 outer_bb_max,
+                  ivec3 image_size) {
   vec3 cube_size = vec3((outer_bb_max.x - outer_bb_min.x) / image_size.x,
                         (outer_bb_max.y - outer_bb_min.y) / image_size.y,
                         (outer_bb_max.z - outer_bb_min.z) / image_size.z);
+  return (outer_bb_min + cube_size / vec3(2)) + cube_size * vec3(texel_coord);
+}
+
+// shaders writing to a buffer instead of imgOutput define SDF_BUFFER_OUTPUT
+#ifndef SDF_BUFFER_OUTPUT
+void generate_sdf(ivec3 texel_coord, int vertices_size, int indices_size,
+                  int bvh_nodes_size, vec3 outer_bb_min, vec3 outer_bb_max,
+                  ivec3 image_size
+#if !(GLSL)
+                  ,
+                  const vector<SdfVertex> &vertices,
+                  const vector<unsigned int> &indices,
+                  const vector<BvhNode> &bvh_nodes,
+                  vector<vector<vector<vec4>>> &imgOutput, vec3 &chosen_normal
+#endif
+) {
   vec3 cube_center_pos =
-      (outer_bb_min + cube_size / vec3(2)) + cube_size * vec3(texel_coord);
+      voxel_center(texel_coord, outer_bb_min, outer_bb_max, image_size);
 
-  // float shortest_distance = 1000000.0;
-  float shortest_check_distance = 1000000.0;
-  float shortest_distance = 1000000.0;
-  vec3 shortest_point = vec3(0.0);
-  vec3 shortest_normal = vec3(0.0);
-  for (int i = 0; i < indices_size; i += 3) {
-    Vertex a = vertices[indices[i]];
-    Vertex b = vertices[indices[i + 1]];
-    Vertex c = vertices[indices[i + 2]];
-
-    vec3 closest_point = closest_point_on_triangle(
-        cube_center_pos, vec3(a.position), vec3(b.position), vec3(c.position));
-    vec3 ab = vec3(b.position) - vec3(a.position);
-    vec3 ac = vec3(c.position) - vec3(a.position);
-    vec3 normal = normalize(cross(ab, ac));
-    float check_dist =
-        distance(closest_point + normal * vec3(0.0001), cube_center_pos);
-    if (check_dist < shortest_check_distance) {
-      shortest_check_distance = check_dist;
-      shortest_distance = distance(closest_point, cube_center_pos);
-      shortest_point = closest_point;
-      shortest_normal = normal;
-    }
-  }
-  float t = dot(shortest_normal, normalize(cube_center_pos - shortest_point));
-  if (t < 0) {
-    shortest_distance = -abs(shortest_distance);
-  }
+#if GLSL
+  ClosestTriangle closest =
+      closest_triangle(cube_center_pos, indices_size, bvh_nodes_size);
+#else
+  ClosestTriangle closest =
+      closest_triangle(cube_center_pos, indices_size, bvh_nodes_size, vertices,
+                       indices, bvh_nodes);
+#endif
+  float shortest_distance = signed_distance(cube_center_pos, closest);
 
 #if !(GLSL)
-  chosen_normal = shortest_normal;
+  chosen_normal = closest.normal;
   imgOutput[texel_coord.x][texel_coord.y][texel_coord.z] = vec4(
-      shortest_distance, shortest_point.x, shortest_point.y, shortest_point.z);
+      shortest_distance, closest.point.x, closest.point.y, closest.point.z);
 #else
   imageStore(imgOutput, texel_coord, vec4(shortest_distance, 0.0, 0.0, 0.0));
 #endif
 }
+#endif
@@ -7,12 +7,47 @@
 #include <vector>
 #include "glm/glm.hpp"
 
-import graphics;
+// Nodes deeper than this are turned into leaves, the traversal stack in the
+// shared code is sized after it.
+constexpr int SDF_BVH_MAX_DEPTH = 32;
+
+// Mirrors the std430 layouts in sdf_generator_gpu_v2.cs, keep them in sync.
+struct SdfVertex {
+  glm::vec4 position;
+};
+
+struct BvhNode {
+  glm::vec4 bb_min;
+  glm::vec4 bb_max;
+  // x = left child (inner) or first triangle (leaf)
+  // y = right child (inner)
+  // z = triangle count, 0 for inner nodes
+  // w = 1 for leaves, 0 for inner nodes. The root of an empty mesh is a
+  // leaf without triangles, so the count alone can't tell
+  glm::ivec4 data;
+};
+
+// One mesh of a batched dispatch, see sdf_generator_gpu_v2_batched.cs
+struct SdfBatchMesh {
+  glm::vec4 outer_bb_min;
+  glm::vec4 outer_bb_max;
+  // x = root node, y = resolution, z = first output voxel, w = triangle count
+  glm::ivec4 data;
+};
+
+struct ClosestTriangle {
+  float check_distance; // distance to the point nudged along the face normal
+  float distance;
+  glm::vec3 point;
+  glm::vec3 normal;
+};
 
 float dot2(glm::vec3 v);
 
 float distance2(glm::vec3 a, glm::vec3 b);
 
+float distance2_to_box(glm::vec3 p, glm::vec3 bb_min, glm::vec3 bb_max);
+
 // Helper function to project a point onto a line segment
 glm::vec3 closest_point_on_segment(glm::vec3 point, glm::vec3 seg_start,
                                    glm::vec3 seg_end);
@@ -20,11 +55,41 @@ glm::vec3 closest_point_on_segment(glm::vec3 point, glm::vec3 seg_start,
 glm::vec3 closest_point_on_triangle(glm::vec3 A, glm::vec3 v0, glm::vec3 v1,
                                     glm::vec3 v2);
 
+ClosestTriangle no_triangle();
+
+// returns whichever of best and triangle abc is closer to p
+ClosestTriangle closer_triangle(ClosestTriangle best, glm::vec3 p, glm::vec3 a,
+                                glm::vec3 b, glm::vec3 c);
+
+ClosestTriangle closest_triangle_brute_force(
+    glm::vec3 p, int indices_size, const std::vector<SdfVertex> &vertices,
+    const std::vector<unsigned int> &indices);
+
+// root is the node the traversal starts at, batches keep several trees in one
+// node array
+ClosestTriangle closest_triangle_bvh(glm::vec3 p, int root,
+                                     const std::vector<SdfVertex> &vertices,
+                                     const std::vector<unsigned int> &indices,
+                                     const std::vector<BvhNode> &bvh_nodes);
+
+// bvh_nodes_size = 0 falls back to testing every triangle
+ClosestTriangle closest_triangle(glm::vec3 p, int indices_size,
+                                 int bvh_nodes_size,
+                                 const std::vector<SdfVertex> &vertices,
+                                 const std::vector<unsigned int> &indices,
+                                 const std::vector<BvhNode> &bvh_nodes);
+
+float signed_distance(glm::vec3 p, ClosestTriangle closest);
+
+glm::vec3 voxel_center(glm::ivec3 texel_coord, glm::vec3 outer_bb_min,
+                       glm::vec3 outer_bb_max, glm::ivec3 image_size);
+
 void generate_sdf(glm::ivec3 texel_coord, int vertices_size, int indices_size,
-                  glm::vec3 outer_bb_min, glm::vec3 outer_bb_max,
-                  glm::ivec3 image_size,
-                  std::vector<ale::graphics::Vertex> &vertices,
-                  std::vector<unsigned int> &indices,
+                  int bvh_nodes_size, glm::vec3 outer_bb_min,
+                  glm::vec3 outer_bb_max, glm::ivec3 image_size,
+                  const std::vector<SdfVertex> &vertices,
+                  const std::vector<unsigned int> &indices,
+                  const std::vector<BvhNode> &bvh_nodes,
                   std::vector<std::vector<std::vector<glm::vec4>>> &imgOutput,
                   glm::vec3 &closest_normal);
 
@@ -0,0 +1,203 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <numbers>
+#include <numeric>
+#include <vector>
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
+
+export module graphics:sdf.sdf_instance_bvh;
+import data;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+
+export namespace ale::graphics::sdf {
+
+// Top level BVH over the world space boxes of sdf instances, one instance
+// per leaf. Nodes use the BvhNode layout of the triangle bvh so they can be
+// uploaded as is: inner nodes keep their children in data.x and data.y,
+// leaves keep their instance in data.x and a count of 1 in data.z.
+// Moving instances are refit in place, the tree is only rebuilt when the
+// number of instances changes or refits made it much worse.
+//
+// An instance divides its local distance by the stretch of its model matrix
+// along the ray, so under non-uniform scale it can report less than the
+// distance to its world box. bb_min.w keeps the smallest distance_scale of
+// the instances below a node, the box distance times it is what a traversal
+// may prune with.
+class SdfInstanceBvh {
+public:
+  // refits may let the summed node area grow this much before a rebuild
+  static constexpr float MAX_DEGRADATION = 2.0f;
+
+  vector<BvhNode> nodes; // root at 0, empty without instances
+
+  // Smallest over largest singular value of the linear part of model, 1
+  // under uniform scale. An instance never reports less than its world box
+  // distance times this, whatever the ray direction.
+  static float distance_scale(const mat4 &model) {
+    // the singular values are the square roots of the eigenvalues of a
+    mat3 m = mat3(model);
+    mat3 a = transpose(m) * m;
+    float off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+    float q = (a[0][0] + a[1][1] + a[2][2]) / 3.0f;
+    float p2 = (a[0][0] - q) * (a[0][0] - q) + (a[1][1] - q) * (a[1][1] - q) +
+               (a[2][2] - q) * (a[2][2] - q) + 2.0f * off;
+    if (q <= 0.0f) {
+      return 0.0f;
+    }
+    if (p2 <= q * q * 1e-12f) {
+      return 1.0f;
+    }
+
+    float p = sqrt(p2 / 6.0f);
+    float r = std::clamp(determinant((a - mat3(q)) / p) / 2.0f, -1.0f, 1.0f);
+    float phi = acos(r) / 3.0f;
+    float largest = q + 2.0f * p * cos(phi);
+    float third = 2.0f * numbers::pi_v<float> / 3.0f;
+    float smallest = q + 2.0f * p * cos(phi + third);
+    // a hair under, rounding must not make the bound optimistic
+    return sqrt(std::max(smallest, 0.0f) / largest) * 0.999f;
+  }
+
+  // distance_scales holds distance_scale of every instance
+  void build(const vector<BoundingBox> &boxes,
+             const vector<float> &distance_scales) {
+    int count = boxes.size();
+    nodes.clear();
+    parents.clear();
+    leaves.assign(count, -1);
+    if (count == 0) {
+      built_cost = 0.0f;
+      return;
+    }
+
+    instances.resize(count);
+    iota(instances.begin(), instances.end(), 0);
+    centroids.clear();
+    for (auto &box: boxes) {
+      centroids.push_back((box.min + box.max) * 0.5f);
+    }
+
+    // one leaf per instance, a full tree has 2n - 1 nodes
+    nodes.reserve(count * 2 - 1);
+    parents.reserve(count * 2 - 1);
+    nodes.push_back(BvhNode{});
+    parents.push_back(-1);
+    build(0, 0, count, boxes, distance_scales);
+    built_cost = cost();
+
+    instances.clear();
+    centroids.clear();
+  }
+
+  // Moves the leaves of the given instances to their boxes and fixes up
+  // their ancestors. Every node that changed is appended to dirty_nodes
+  void refit(const vector<int> &moved, const vector<BoundingBox> &boxes,
+             const vector<float> &distance_scales, vector<int> &dirty_nodes) {
+    for (int instance: moved) {
+      int node = leaves.at(instance);
+      auto &box = boxes[instance];
+      nodes[node].bb_min = vec4(box.min, distance_scales[instance]);
+      nodes[node].bb_max = vec4(box.max, 0.0);
+      dirty_nodes.push_back(node);
+
+      // ancestors that come out the same stop the walk
+      for (node = parents[node]; node >= 0; node = parents[node]) {
+        auto &left = nodes[nodes[node].data.x];
+        auto &right = nodes[nodes[node].data.y];
+        vec4 bb_min = min(left.bb_min, right.bb_min);
+        vec4 bb_max = max(left.bb_max, right.bb_max);
+        if (bb_min == nodes[node].bb_min && bb_max == nodes[node].bb_max) {
+          break;
+        }
+        nodes[node].bb_min = bb_min;
+        nodes[node].bb_max = bb_max;
+        dirty_nodes.push_back(node);
+      }
+    }
+  }
+
+  // summed node area against the last build, 1 right after it
+  float degradation() {
+    return built_cost > 0.0f ? cost() / built_cost : 1.0f;
+  }
+
+  int size() { return leaves.size(); }
+
+private:
+  vector<int> parents; // per node, -1 for the root
+  vector<int> leaves; // per instance, its leaf node
+  float built_cost = 0.0f;
+
+  // build scratch, instance ids are permuted in place while splitting
+  vector<int> instances;
+  vector<vec3> centroids;
+
+  // summed surface area of every node, what a traversal pays for
+  float cost() {
+    float area = 0.0f;
+    for (auto &node: nodes) {
+      vec3 size = vec3(node.bb_max - node.bb_min);
+      area += size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+    return area;
+  }
+
+  void build(int node_index, int first, int count,
+             const vector<BoundingBox> &boxes,
+             const vector<float> &distance_scales) {
+    float scale = INFINITY;
+    vec3 bb_min = vec3(INFINITY);
+    vec3 bb_max = vec3(-INFINITY);
+    vec3 centroid_min = vec3(INFINITY);
+    vec3 centroid_max = vec3(-INFINITY);
+    for (int i = first; i < first + count; ++i) {
+      int instance = instances[i];
+      scale = std::min(scale, distance_scales[instance]);
+      bb_min = min(bb_min, boxes[instance].min);
+      bb_max = max(bb_max, boxes[instance].max);
+      centroid_min = min(centroid_min, centroids[instance]);
+      centroid_max = max(centroid_max, centroids[instance]);
+    }
+    nodes[node_index].bb_min = vec4(bb_min, scale);
+    nodes[node_index].bb_max = vec4(bb_max, 0.0);
+
+    if (count == 1) {
+      nodes[node_index].data = ivec4(instances[first], 0, 1, 0);
+      leaves[instances[first]] = node_index;
+      return;
+    }
+
+    vec3 extent = centroid_max - centroid_min;
+    int axis = 0;
+    if (extent.y > extent.x)
+      axis = 1;
+    if (extent.z > extent[axis])
+      axis = 2;
+
+    // median split along the longest centroid axis, depth stays log2(n)
+    int half = count / 2;
+    nth_element(instances.begin() + first, instances.begin() + first + half,
+                instances.begin() + first + count, [&](int a, int b) {
+                  return centroids[a][axis] < centroids[b][axis];
+                });
+
+    int left = nodes.size();
+    nodes.push_back(BvhNode{});
+    parents.push_back(node_index);
+    int right = nodes.size();
+    nodes.push_back(BvhNode{});
+    parents.push_back(node_index);
+    nodes[node_index].data = ivec4(left, right, 0, 0);
+
+    build(left, first, half, boxes, distance_scales);
+    build(right, first + half, count - half, boxes, distance_scales);
+  }
+};
+
+} // namespace ale::graphics::sdf
@@ -4,6 +4,8 @@
 
 module;
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <functional>
 #include <glad/glad.h>
@@ -15,12 +17,15 @@ module;
 #include <utility>
 #include <vector>
 #include "src/data/util.h"
+#include "src/graphics/sdf/triangle_batch.h"
 
 export module graphics:sdf.sdf_model;
 import data;
 import :texture;
 import :mesh;
 import :ray;
+import :sdf.sdf_bvh;
+import :sdf.sdf_winding_number;
 
 using namespace std;
 using namespace ale::data;
@@ -30,6 +35,72 @@ using namespace glm;
 
 export namespace ale::graphics::sdf {
 
+enum class SdfSignMode {
+  // odd number of +Y ray hits is inside, needs a watertight mesh
+  RAY_PARITY,
+  // fast generalized winding number, O(log n) per voxel and tolerates holes
+  WINDING_NUMBER,
+};
+
+enum class SdfTraceMode {
+  // steps exactly the distance, never misses a surface
+  SPHERE,
+  // over-relaxed steps that fall back to SPHERE when they overshoot
+  ENHANCED,
+};
+
+struct SdfTraceSettings {
+  SdfTraceMode mode = SdfTraceMode::SPHERE;
+  int max_steps = 100;
+  float hit_distance = 0.01f;
+  // step scale in ENHANCED mode, in [1, 2)
+  float relaxation = 1.6f;
+  float max_distance = INFINITY;
+};
+
+struct SdfTraceResult {
+  bool hit = false;
+  float t = 0.0f;
+  glm::vec3 position = glm::vec3(0.0f);
+  int steps = 0; // distance queries made
+};
+
+// step counts of many traces, to tune the step limit and hit distance
+struct SdfTraceStats {
+  long long rays = 0;
+  long long hits = 0;
+  long long steps = 0;
+  int max_steps = 0;
+  // rays that took i steps, ray misses included
+  std::vector<long long> histogram;
+
+  void add(const SdfTraceResult &result) {
+    rays += 1;
+    hits += result.hit;
+    steps += result.steps;
+    max_steps = std::max(max_steps, result.steps);
+    if (histogram.size() <= result.steps) {
+      histogram.resize(result.steps + 1);
+    }
+    histogram[result.steps] += 1;
+  }
+
+  float mean_steps() const { return rays == 0 ? 0.0f : (float) steps / rays; }
+
+  // fewest steps that percentile (0 to 1) of the rays finished within
+  int percentile_steps(float percentile) const {
+    long long needed = (long long) std::ceil(percentile * rays);
+    long long seen = 0;
+    for (int i = 0; i < histogram.size(); ++i) {
+      seen += histogram[i];
+      if (seen >= needed) {
+        return i;
+      }
+    }
+    return max_steps;
+  }
+};
+
 // This is a 3d array representative given a mesh
 class SdfModel {
 private:
@@ -40,6 +111,7 @@ public:
   std::optional<Texture3D> texture3D;
 
   // TODO: move to private, public is for debugging
+  // cpu copy of texture3D, empty until someone asks for it (get_distances)
   std::vector<float> texture3D_data;
   std::vector<std::vector<std::vector<float>>> distances;
   std::vector<std::vector<std::vector<glm::vec3>>>
@@ -55,7 +127,8 @@ public:
   BoundingBox bb; // mesh bb
 
   // Will generate SDF on CPU
-  SdfModel(Mesh &mesh, int cubeCount = 16) :
+  SdfModel(Mesh &mesh, int cubeCount = 16,
+           SdfSignMode sign_mode = SdfSignMode::WINDING_NUMBER) :
       cubeCount(cubeCount),
       outerBB(mesh.boundingBox),
       bb(mesh.boundingBox) {
@@ -72,7 +145,26 @@ public:
         vector(cubeCount, vector(cubeCount, vector(cubeCount, INFINITY)));
     positions = vector(cubeCount, vector(cubeCount, vector(cubeCount, vec3())));
 
+    auto bvh = SdfBvh(mesh);
+    auto batch = TriangleBatch(bvh.vertices, bvh.indices);
+    auto winding_number = SdfWindingNumber(bvh);
+
     this->loopOverCubes([&](int k, int j, int i, BoundingBox bb) {
+      // same as taking Util::udTriangle over every triangle
+      float unsigned_distance =
+          sqrt(min_triangle_distance2(batch, bb.center, 0, batch.size));
+      if (unsigned_distance < distances[i][j][k]) {
+        distances[i][j][k] = unsigned_distance;
+        positions[k][j][i] = bb.center;
+      }
+
+      if (sign_mode == SdfSignMode::WINDING_NUMBER) {
+        if (winding_number.is_inside(bb.center)) {
+          distances[i][j][k] = -distances[i][j][k];
+        }
+        return;
+      }
+
       vector<vec3> isectPoint;
       for (int tri = 0; tri + 2 < mesh.indices.size(); tri += 3) {
         Vertex a = mesh.vertices[mesh.indices[tri]];
@@ -95,13 +187,6 @@ public:
             isectPoint.push_back(isect);
           }
         }
-
-        float distance =
-            Util::udTriangle(bb.center, a.position, b.position, c.position);
-        if (distance < distances[i][j][k]) {
-          distances[i][j][k] = distance;
-          positions[k][j][i] = bb.center;
-        }
       }
       if (isectPoint.size() % 2 == 1) {
         distances[i][j][k] = -distances[i][j][k];
@@ -128,11 +213,16 @@ public:
                                                 .input_format = GL_RED,
                                                 .input_type = GL_FLOAT},
                                 distances1D);
+    texture3D_data = std::move(distances1D);
   }
 
-  // Skips sdf generation (pass it in through texture3D)
-  SdfModel(Mesh &mesh, Texture3D texture3D, int cubeCount) :
+  // Skips sdf generation (pass it in through texture3D). distances is the
+  // cpu copy of the texture when the caller already has one, the texture is
+  // not read back for it
+  SdfModel(Mesh &mesh, Texture3D texture3D, int cubeCount,
+           std::vector<float> distances = {}) :
       texture3D(std::move(texture3D)),
+      texture3D_data(std::move(distances)),
       cubeCount(cubeCount),
       outerBB(mesh.boundingBox),
       bb(mesh.boundingBox) {
@@ -144,9 +234,17 @@ public:
     cubeSize = vec3((outerBB.max.x - outerBB.min.x) / cubeCount,
                     (outerBB.max.y - outerBB.min.y) / cubeCount,
                     (outerBB.max.z - outerBB.min.z) / cubeCount);
+  }
+
+  bool has_distances() { return !texture3D_data.empty(); }
 
-    // flush back all distance to the vector (ergh)
-    texture3D_data = this->texture3D->retrieve_data_from_gpu();
+  // cpu copy of the distances, laid out like texture3D. Reads the texture
+  // back (a full pipeline stall) the first time when there is no copy yet
+  std::vector<float> &get_distances() {
+    if (texture3D_data.empty() && texture3D.has_value()) {
+      texture3D_data = texture3D->retrieve_data_from_gpu();
+    }
+    return texture3D_data;
   }
 
   // returns small cubes that creates the sdf
@@ -224,55 +322,119 @@ public:
     cout << "data written to " << path << endl;
   }
 
-  bool find_hit_positions(Ray debugRay, std::vector<glm::vec3> *debugHitPos) {
-    // to box only
-    // cout << "hit T" << endl;
-    // for(int i = 0; i < 20; ++i) {
-    //     // first check the box.
-    //     float dist = Util::distanceFromBox(debugRay.origin,
-    //     this->outerBB.min, this->outerBB.max); debugRay.origin =
-    //     debugRay.resolveT(dist); hitPos.push_back(debugRay.origin); cout <<
-    //     debugRay.origin.x << " " << debugRay.origin.y << " " <<
-    //     debugRay.origin.z << endl;
-    // }
+  // trilinear distance at p (mesh space), between voxel centers like the
+  // gpu sampler. Outside the grid the border voxels are stretched, so use
+  // distance_at() for points that can be anywhere
+  float sample_distance(vec3 p) {
+    float c[8];
+    vec3 t = cell_at(p, c);
+    float c00 = mix(c[0], c[1], t.x);
+    float c10 = mix(c[2], c[3], t.x);
+    float c01 = mix(c[4], c[5], t.x);
+    float c11 = mix(c[6], c[7], t.x);
+    return mix(mix(c00, c10, t.y), mix(c01, c11, t.y), t.z);
+  }
 
-    // to box with sdf
-    // cout << "hit T" << endl;
-    for (int i = 0; i < 100; ++i) {
-      if (this->bb.isInside(debugRay.origin)) {
-        vec3 localCoord = debugRay.origin - this->outerBB.min;
-        vec3 boxArrSize = this->outerBB.getSize() / vec3(this->cubeCount);
-        int x = localCoord.x / boxArrSize.x;
-        int y = localCoord.y / boxArrSize.y;
-        int z = localCoord.z / boxArrSize.z;
-        float dist = texture3D_data.at(texture3D->get_index(x, y, z, 1));
-        debugRay.origin = debugRay.resolve(dist);
-
-        if (dist < 0.01) {
-          if (debugHitPos != nullptr) {
-            debugHitPos->push_back(debugRay.origin);
-            cout << "isect found: " << debugRay.origin.x << " "
-                 << debugRay.origin.y << " " << debugRay.origin.z << endl;
-          }
-          return true;
-        }
-      } else {
-        float dist =
-            Util::distanceFromBox(debugRay.origin, this->bb.min, this->bb.max);
-        debugRay.origin = debugRay.resolve(dist);
+  // exact gradient of sample_distance at p, not normalized
+  vec3 sample_gradient(vec3 p) {
+    float c[8];
+    vec3 t = cell_at(p, c);
+    // the interpolant is linear along each axis once the other two are
+    // fixed, so every partial derivative is a difference of two lerps
+    float dx = mix(mix(c[1] - c[0], c[3] - c[2], t.y),
+                   mix(c[5] - c[4], c[7] - c[6], t.y), t.z);
+    float dy = mix(mix(c[2] - c[0], c[3] - c[1], t.x),
+                   mix(c[6] - c[4], c[7] - c[5], t.x), t.z);
+    float dz = mix(mix(c[4] - c[0], c[5] - c[1], t.x),
+                   mix(c[6] - c[2], c[7] - c[3], t.x), t.y);
+    return vec3(dx, dy, dz) / cubeSize;
+  }
+
+  // Lower bound of the distance to the surface from anywhere. Inside the
+  // grid it is sample_distance, outside both the mesh box and the sdf at the
+  // closest grid point minus the way there bound it, the second one keeps
+  // points on the box from looking like hits.
+  float distance_at(vec3 p) {
+    vec3 inside = clamp(p, outerBB.min, outerBB.max);
+    float sdf = sample_distance(inside);
+    if (inside == p) {
+      return sdf;
+    }
+    float to_grid = glm::distance(p, inside);
+    float to_mesh = Util::distanceFromBox(p, bb.min, bb.max);
+    return std::max(to_mesh, sdf - to_grid);
+  }
+
+  // Marches ray in mesh space. Enhanced mode over-relaxes every step
+  // (Keinert et al. 2014, "Enhanced Sphere Tracing"): it steps
+  // relaxation * distance, and when the unbounding spheres of two steps no
+  // longer overlap it may have skipped the surface, so it goes back to the
+  // last safe point and carries on with plain steps. positions gets every
+  // point the march stood on.
+  SdfTraceResult trace(Ray ray, SdfTraceSettings settings = {},
+                       std::vector<vec3> *positions = nullptr) {
+    bool enhanced = settings.mode == SdfTraceMode::ENHANCED;
+    float omega = enhanced ? settings.relaxation : 1.0f;
+    float t = 0.0f;
+    float step = 0.0f;
+    float previous_radius = 0.0f;
+    auto result = SdfTraceResult{};
+    for (int i = 0; i < settings.max_steps; ++i) {
+      vec3 p = ray.resolve(t);
+      float signed_radius = distance_at(p);
+      float radius = abs(signed_radius);
+      result.steps = i + 1;
+      if (positions != nullptr) {
+        positions->push_back(p);
       }
 
-      // first check the box.
-      if (debugHitPos != nullptr) {
-        debugHitPos->push_back(debugRay.origin);
-        // cout << debugRay.origin.x << " " << debugRay.origin.y << " " <<
-        // debugRay.origin.z << endl;
+      bool overshot = omega > 1.0f && radius + previous_radius < step;
+      if (overshot) {
+        // back to where the last step started, the sphere there was safe
+        step -= omega * step;
+        omega = 1.0f;
+      } else {
+        step = signed_radius * omega;
+        if (signed_radius < settings.hit_distance) {
+          result.hit = true;
+          result.t = t;
+          result.position = p;
+          return result;
+        }
       }
+      previous_radius = radius;
+      if (t > settings.max_distance) {
+        break;
+      }
+      t += step;
     }
-    if (debugHitPos != nullptr) {
-      cout << "isect not found" << endl;
+    result.t = t;
+    result.position = ray.resolve(t);
+    return result;
+  }
+
+  bool find_hit_positions(Ray debugRay, std::vector<glm::vec3> *debugHitPos) {
+    return trace(debugRay, {}, debugHitPos).hit;
+  }
+
+private:
+  // distance stored for a voxel, clamped to the grid
+  float voxel(ivec3 v) {
+    v = clamp(v, ivec3(0), ivec3(cubeCount - 1));
+    return get_distances()[(v.z * cubeCount + v.y) * cubeCount + v.x];
+  }
+
+  // the 8 voxels around p, x fastest then y then z, and where p sits
+  // between them
+  vec3 cell_at(vec3 p, float (&c)[8]) {
+    // voxel centers sit at + 0.5
+    vec3 coord = (p - outerBB.min) / cubeSize - vec3(0.5f);
+    coord = clamp(coord, vec3(0.0f), vec3(cubeCount - 1));
+    ivec3 v = ivec3(floor(coord));
+    for (int i = 0; i < 8; ++i) {
+      c[i] = voxel(v + ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
     }
-    return false;
+    return coord - vec3(v);
   }
 };
 
@@ -2,14 +2,23 @@ module;
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <vector>
+#include "src/graphics/gpu_bindings.h"
 
 export module graphics:sdf.sdf_model_packed;
 import data;
+import :compute_shader;
 import :texture;
+import :sdf.sdf_atlas_packer;
+import :sdf.sdf_bricked;
 import :sdf.sdf_model;
+import :sdf.sdf_quantize;
 
 
 using namespace ale::data;
@@ -18,10 +27,21 @@ using namespace glm;
 
 export namespace ale::graphics::sdf {
 
-constexpr int ATLAS_WIDTH = 4096;
-constexpr int ATLAS_HEIGHT = 4096;
-constexpr int OBJECTS_MAX_SIZE = 2000;
-constexpr int SINGLE_TEXTURE_SIZE_Y = 64;
+// dense sdfs are packed into 3d pages of ATLAS_SIZE^3, as many texels as
+// a 4096^2 texture. Bound as sampler3D atlas[ATLAS_PAGES_MAX]
+constexpr int ATLAS_SIZE = 256;
+constexpr int ATLAS_PAGES_MAX = 6;
+// larger sdfs do not fit in a page and are always stored as bricks
+constexpr int DENSE_MAX_RESOLUTION = ATLAS_SIZE;
+// objects the ssbo starts with, it grows when more are drawn
+constexpr int OBJECTS_INITIAL_SIZE = 2000;
+constexpr int BRICK_ATLAS_WIDTH = 4096;
+constexpr int BRICK_ATLAS_HEIGHT = 4096;
+// bricks sit in rows of 8 texels, the 8 z slices of a brick side by side
+constexpr int BRICKS_PER_ROW =
+    BRICK_ATLAS_WIDTH / (SDF_BRICK_SIZE * SDF_BRICK_SIZE);
+constexpr int BRICKS_MAX_SIZE =
+    BRICKS_PER_ROW * (BRICK_ATLAS_HEIGHT / SDF_BRICK_SIZE);
 
 class SdfModelPacked {
 public:
@@ -32,94 +52,63 @@ public:
     glm::vec4 inner_bbmax;
     glm::vec4 outer_bbmin;
     glm::vec4 outer_bbmax;
-    int atlas_index;
-    int atlas_count;
-    int _a = 0;
-    int _b = 0;
+    glm::ivec4 atlas_origin; // xyz = first voxel in the page, w = page
+    int brick_cell_offset = -1; // -1 means dense, stored in texture_atlas
+    int resolution = 0; // voxels per axis
+    // atlas values are normalized * scale + bias, bricks included
+    float distance_scale = 1.0f;
+    float distance_bias = 0.0f;
+  };
+
+  // one per 8^3 cell of a sparse sdf, matches BrickCell in the shader
+  struct GPUBrickCell {
+    int brick_index; // SdfBricked::EMPTY_CELL when only distance is kept
+    float distance;
   };
 
   struct Meta {
     glm::ivec3 size;
     BoundingBox inner_bb;
     BoundingBox outer_bb;
-    int atlas_index; // index of texture_atlas
-    int atlas_count; // index of texture number in atlas
+    int atlas_index; // page in texture_atlas, -1 when sparse
+    glm::ivec3 atlas_origin; // first voxel in the page
+    int brick_cell_offset = -1; // first cell in brick_cells, -1 when dense
+    SdfQuantization quantization;
   };
 
 private:
-  std::vector<Texture> texture_atlas;
+  std::vector<Texture3D> texture_atlas;
+  SdfAtlasPacker packer;
+  // copies sdfs without a cpu copy into snorm pages, created on first use
+  std::optional<ComputeShader> insert_shader;
   std::vector<Meta> offsets;
+  // bumped whenever the meta of a packed sdf changes
+  unsigned int revision = 0;
   bool debug_mode;
-  int ssbo;
+  unsigned int ssbo = 0;
+  int ssbo_capacity = 0; // objects
+  SdfAtlasFormat format;
+
+  // sparse sdfs, created on the first sparse add
+  std::optional<Texture> brick_atlas;
+  std::vector<GPUBrickCell> brick_cells;
+  int brick_count = 0;
+  unsigned int brick_cell_ssbo = 0;
 
   std::vector<unsigned int>
   pack_sdf_models(std::vector<SdfModel *> sdf_models) {
-    auto flat_data = vector(ATLAS_WIDTH * ATLAS_HEIGHT, 0.0f);
-    auto packed_count = 0; // how many texture is packed inside an atlas
-    auto entries = vector<unsigned int>{};
+    glGenBuffers(1, &ssbo);
+    reserve_objects(OBJECTS_INITIAL_SIZE);
 
+    // goes through add so every model is stored in the atlas format
+    auto entries = vector<unsigned int>{};
     for (auto &it: sdf_models) {
-      auto sdf_data = it->texture3D->retrieve_data_from_gpu();
-      Texture3D::Meta meta = it->texture3D->meta;
-
-      ivec3 size = ivec3(meta.width, meta.height, meta.depth);
-      ivec3 size2d = ivec3(64, 64, 64);
-      for (int i = 0; i < sdf_data.size(); ++i) {
-        unsigned int z = i / (size.x * size.y);
-        unsigned int y = (i % (size.x * size.y) / size.x);
-        unsigned int x = i % size.x;
-
-        unsigned int flat_index =
-            x + (y * size2d.x * size2d.z) + (z * size2d.x);
-
-        // stack it
-        flat_index = packed_count * size2d.x * size2d.z * size2d.y + flat_index;
-
-        // finish the remapping
-        // cout << x << " " << y << " " << z << " | " << flat_index << "\n";
-        flat_data[flat_index] = sdf_data[i];
-      }
-
-      entries.push_back(offsets.size());
-      offsets.push_back(SdfModelPacked::Meta{
-          .size = size,
-          .inner_bb = it->bb,
-          .outer_bb = it->outerBB,
-          .atlas_index = (int) texture_atlas.size(),
-          .atlas_count = packed_count,
-      });
-      packed_count += 1;
-
-      if (&it == &sdf_models.back() || packed_count >= 64) {
-        // we has filled in this texture, push and create a new one
-        texture_atlas.emplace_back(
-            Texture::Meta{
-                .width = ATLAS_WIDTH,
-                .height = ATLAS_HEIGHT,
-                .internal_format = GL_R32F,
-                .input_format = GL_RED,
-                .input_type = GL_FLOAT,
-                .min_filter = GL_LINEAR,
-                .max_filter = GL_LINEAR,
-            },
-            flat_data);
-        packed_count = 0;
-      }
+      entries.push_back(add(*it));
     }
 
-    unsigned int ssbo = 0;
-    glGenBuffers(1, &ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-    glBufferData(
-        GL_SHADER_STORAGE_BUFFER,
-        (sizeof(unsigned int) * 4 + sizeof(GPUObject) * OBJECTS_MAX_SIZE),
-        nullptr, GL_STATIC_DRAW);
-    this->ssbo = ssbo;
-
     if (debug_mode) {
       for (int i = 0; i < texture_atlas.size(); ++i) {
-        texture_atlas[i].dump_data_to_file(
-            afs::root("debug/atlas_" + to_string(i) + ".txt"));
+        texture_atlas[i].save_textfile("atlas_" + to_string(i));
       }
     }
 
@@ -128,8 +117,11 @@ private:
 
 public:
   // data will be copied, just need to have a temporary reference to sdf models
-  SdfModelPacked(std::vector<SdfModel *> sdf_models, bool debug_mode = false) :
-      debug_mode(debug_mode) {
+  SdfModelPacked(std::vector<SdfModel *> sdf_models, bool debug_mode = false,
+                 SdfAtlasFormat format = SdfAtlasFormat::F32) :
+      packer(ivec3(ATLAS_SIZE), ATLAS_PAGES_MAX),
+      debug_mode(debug_mode),
+      format(format) {
     pack_sdf_models(sdf_models);
   }
 
@@ -138,138 +130,554 @@ public:
 
   SdfModelPacked(SdfModelPacked &&other) :
       texture_atlas(std::move(other.texture_atlas)),
+      packer(std::move(other.packer)),
+      insert_shader(std::move(other.insert_shader)),
       offsets(std::move(other.offsets)),
-      debug_mode(other.debug_mode) {}
+      revision(other.revision),
+      debug_mode(other.debug_mode),
+      ssbo(other.ssbo),
+      ssbo_capacity(other.ssbo_capacity),
+      format(other.format),
+      brick_atlas(std::move(other.brick_atlas)),
+      brick_cells(std::move(other.brick_cells)),
+      brick_count(other.brick_count),
+      brick_cell_ssbo(other.brick_cell_ssbo) {
+    other.ssbo = 0;
+    other.brick_cell_ssbo = 0;
+  }
   SdfModelPacked &operator=(SdfModelPacked &&other) {
     if (this != &other) {
       std::swap(this->texture_atlas, other.texture_atlas);
+      std::swap(this->packer, other.packer);
+      std::swap(this->insert_shader, other.insert_shader);
       std::swap(this->offsets, other.offsets);
+      std::swap(this->revision, other.revision);
       this->debug_mode = other.debug_mode;
+      std::swap(this->ssbo, other.ssbo);
+      std::swap(this->ssbo_capacity, other.ssbo_capacity);
+      this->format = other.format;
+      std::swap(this->brick_atlas, other.brick_atlas);
+      std::swap(this->brick_cells, other.brick_cells);
+      std::swap(this->brick_count, other.brick_count);
+      std::swap(this->brick_cell_ssbo, other.brick_cell_ssbo);
     }
 
     return *this;
   }
 
+  // builds the objects of entries from scratch, SdfShadowCasters keeps
+  // them between frames instead
   void bind_to_shader(
       Shader &shader,
       // transform -> shadow mesh index
       std::vector<std::pair<Transform, std::vector<unsigned int>>> &entries,
       int atlas_start_index) {
-    glDisable(GL_CULL_FACE);
-
     auto details = vector<GPUObject>();
-    // TODO: no need to do this every frame, only when a change occur
     // TODO: shader supports 1 MESH = 1 SDF, not 1 MODEL = 1 SDF
     for (auto [transform, shadow_indices]: entries) {
+      mat4 model = transform.get_model_matrix();
       for (auto shadow_index: shadow_indices) {
-        auto &p = offsets[shadow_index];
-        mat4 model = transform.get_model_matrix();
-        details.push_back(GPUObject{
-            .model_mat = model,
-            .inv_model_mat = inverse(model),
-            .inner_bbmin = vec4(p.inner_bb.min, 0.0),
-            .inner_bbmax = vec4(p.inner_bb.max, 0.0),
-            .outer_bbmin = vec4(p.outer_bb.min, 0.0),
-            .outer_bbmax = vec4(p.outer_bb.max, 0.0),
-            .atlas_index = p.atlas_index,
-            .atlas_count = p.atlas_count,
-        });
+        details.push_back(gpu_object(model, shadow_index));
       }
     }
-    int details_size = details.size();
+    unsigned int details_size[4] = {(unsigned int) details.size()};
 
     // ssbo for packed sdf
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (sizeof(unsigned int) * 4),
-                    &details_size); // pass size
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, (sizeof(unsigned int) * 4),
+    reserve_objects(details.size());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(details_size),
+                    details_size); // pass size
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(details_size),
                     (details.size() * sizeof(GPUObject)), details.data());
 
     // bind ssbo
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_OBJECT_BINDING, ssbo);
+    bind_textures(shader, atlas_start_index);
+    shader.setInt("sdfBvhNodeCount", 0); // no bvh, every object is tested
+  }
+
+  // everything but the object ssbo at binding 0
+  void bind_textures(Shader &shader, int atlas_start_index) {
+    glDisable(GL_CULL_FACE);
 
     shader.use();
     shader.setInt("atlasStartIndex", atlas_start_index);
     shader.setInt("atlasSize", this->texture_atlas.size());
-    if (this->texture_atlas.empty()) {
-      return;
-    }
 
-    int texture_units[6] = {0};
-    for (int i = 0; i < this->texture_atlas.size(); ++i) {
+    // every page sampler gets its own unit even when the page doesn't
+    // exist yet, sampler3Ds left on unit 0 would clash with sampler2Ds there
+    int texture_units[ATLAS_PAGES_MAX] = {0};
+    for (int i = 0; i < ATLAS_PAGES_MAX; ++i) {
       texture_units[i] = i + atlas_start_index;
     }
     GLint location = glGetUniformLocation(shader.ID, "atlas");
-    glUniform1iv(location, this->texture_atlas.size(), texture_units);
+    glUniform1iv(location, ATLAS_PAGES_MAX, texture_units);
 
     for (int i = 0; i < this->texture_atlas.size(); ++i) {
       glActiveTexture(GL_TEXTURE0 + atlas_start_index + i);
-      glBindTexture(GL_TEXTURE_2D, texture_atlas[i].id);
+      glBindTexture(GL_TEXTURE_3D, texture_atlas[i].id);
+    }
+
+    // brick atlas goes after the dense pages
+    if (brick_atlas.has_value()) {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_BRICK_CELL_BINDING,
+                       brick_cell_ssbo);
+      shader.setInt("brickAtlas", atlas_start_index + ATLAS_PAGES_MAX);
+      glActiveTexture(GL_TEXTURE0 + atlas_start_index + ATLAS_PAGES_MAX);
+      glBindTexture(GL_TEXTURE_2D, brick_atlas->id);
     }
   }
 
-  unsigned int add(SdfModel &sdf_model) {
-    auto [latest_index, latest_count] =
-        offsets.empty() ? make_pair(0, 0)
-                        : make_pair(offsets.back().atlas_index,
-                                    offsets.back().atlas_count + 1);
+  // allow_sparse stores the sdf as bricks when that at least halves its
+  // memory, otherwise it gets its own box in one of the dense atlas pages,
+  // or bricks when every page is full. Sdfs have to be cubes, above
+  // DENSE_MAX_RESOLUTION they are always sparse.
+  // Sdfs without a cpu copy (SdfModel::has_distances) are copied into their
+  // page on the gpu and stay dense, their texture is only read back when
+  // they have to become bricks.
+  unsigned int add(SdfModel &sdf_model, bool allow_sparse = false) {
+    auto meta = sdf_model.texture3D->meta;
+    auto size = ivec3(meta.width, meta.height, meta.depth);
+    if (size.x != size.y || size.x != size.z) {
+      throw std::runtime_error("packed sdfs have to be cubes");
+    }
+
+    bool must_be_sparse = size.x > DENSE_MAX_RESOLUTION;
+    if (!sdf_model.has_distances() && !must_be_sparse) {
+      auto quantization = format == SdfAtlasFormat::F32
+                              ? SdfQuantization{}
+                              : bounded_quantization(sdf_model);
+      if (auto index = add_dense(sdf_model, quantization, nullptr)) {
+        return *index;
+      }
+    }
 
-    // 1 texture can only hold 64 models
-    if (latest_count >= 64) {
-      latest_index += 1;
-      latest_count = 0;
+    auto &sdf_data = sdf_model.get_distances();
+    auto quantization = format == SdfAtlasFormat::F32
+                            ? SdfQuantization{}
+                            : sdf_quantization(sdf_data);
+    if (allow_sparse || must_be_sparse) {
+      auto bricked = SdfBricked(sdf_data, size.x, sdf_model.outerBB);
+      bool fits = brick_count + bricked.brick_count() <= BRICKS_MAX_SIZE;
+      if (must_be_sparse && !fits) {
+        throw std::runtime_error("brick atlas is full");
+      }
+      if (fits && (must_be_sparse || bricked.memory_bytes() * 2 <=
+                                         bricked.dense_memory_bytes())) {
+        return add_bricked(sdf_model, bricked, quantization);
+      }
     }
 
-    // if count = 0, then we need to create a new texture
-    if (latest_count == 0) {
-      auto empty = vector<float>();
-      texture_atlas.emplace_back(
-          Texture::Meta{
-              .width = ATLAS_WIDTH,
-              .height = ATLAS_HEIGHT,
-              .internal_format = GL_R32F,
-              .input_format = GL_RED,
-              .input_type = GL_FLOAT,
-              .min_filter = GL_LINEAR,
-              .max_filter = GL_LINEAR,
-          },
-          empty);
-    }
-
-    auto sdf_data = sdf_model.texture3D->retrieve_data_from_gpu();
-    auto meta = sdf_model.texture3D->meta;
+    if (auto index = add_dense(sdf_model, quantization, &sdf_data)) {
+      return *index;
+    }
+    auto bricked = SdfBricked(sdf_data, size.x, sdf_model.outerBB);
+    if (brick_count + bricked.brick_count() > BRICKS_MAX_SIZE) {
+      throw std::runtime_error("sdf atlas is full");
+    }
+    return add_bricked(sdf_model, bricked, quantization);
+  }
 
-    auto flat_data = vector(ATLAS_WIDTH * SINGLE_TEXTURE_SIZE_Y, 0.0f);
-    auto size = ivec3(meta.width, meta.height, meta.depth);
-    auto size2d = ivec3(64, 64, 64);
-    for (int i = 0; i < sdf_data.size(); ++i) {
-      unsigned int z = i / (size.x * size.y);
-      unsigned int y = (i % (size.x * size.y) / size.x);
-      unsigned int x = i % size.x;
+  // Patches an sdf that is already packed with new distances of the same
+  // resolution (see SdfBakerCpu::rebake), inner_bb is the new mesh bounding
+  // box. Only the dirty tiles are uploaded unless full is set, the bounding
+  // box moved or the distances left the range the object was quantized
+  // with.
+  void update(unsigned int index, BoundingBox inner_bb,
+              const vector<float> &distances, const vector<ivec3> &dirty_tiles,
+              bool full) {
+    auto &meta = offsets.at(index);
+    int res = meta.size.x;
+    revision += 1;
+    if (distances.size() != res * res * res) {
+      throw std::runtime_error("sdf update has to keep the resolution");
+    }
 
-      unsigned int flat_index = x + (y * size2d.x * size2d.z) + (z * size2d.x);
+    if (inner_bb.min != meta.inner_bb.min ||
+        inner_bb.max != meta.inner_bb.max) {
+      meta.inner_bb = inner_bb;
+      meta.outer_bb = inner_bb.apply_scale(Transform{
+          .scale = vec3(1.1, 1.1, 1.1),
+      });
+      full = true;
+    }
 
-      // finish the remapping
-      // cout << x << " " << y << " " << z << " | " << flat_index << "\n";
-      flat_data[flat_index] = sdf_data[i];
+    if (format != SdfAtlasFormat::F32) {
+      auto q = sdf_quantization(distances);
+      auto &old_q = meta.quantization;
+      if (q.bias - q.scale < old_q.bias - old_q.scale ||
+          q.bias + q.scale > old_q.bias + old_q.scale) {
+        meta.quantization = q;
+        full = true;
+      }
     }
 
-    texture_atlas.back().partial_replace_data_f32(
-        0, latest_count * SINGLE_TEXTURE_SIZE_Y, ATLAS_WIDTH,
-        SINGLE_TEXTURE_SIZE_Y, flat_data);
+    auto tiles = dirty_tiles;
+    if (full) {
+      tiles.clear();
+      int grid_size = (res + SDF_BRICK_SIZE - 1) / SDF_BRICK_SIZE;
+      for (int z = 0; z < grid_size; ++z) {
+        for (int y = 0; y < grid_size; ++y) {
+          for (int x = 0; x < grid_size; ++x) {
+            tiles.emplace_back(x, y, z);
+          }
+        }
+      }
+    }
+
+    if (meta.brick_cell_offset >= 0) {
+      update_bricked(meta, distances, tiles);
+    } else if (full) {
+      upload_dense(meta, distances);
+    } else {
+      auto block = vector<float>();
+      for (auto tile: tiles) {
+        ivec3 start = tile * SDF_BRICK_SIZE;
+        ivec3 end = min(start + SDF_BRICK_SIZE, ivec3(res));
+        ivec3 size = end - start;
+        block.resize(size.x * size.y * size.z);
+        for (int z = start.z; z < end.z; ++z) {
+          for (int y = start.y; y < end.y; ++y) {
+            for (int x = start.x; x < end.x; ++x) {
+              ivec3 local = ivec3(x, y, z) - start;
+              block[(local.z * size.y + local.y) * size.x + local.x] =
+                  distances[(z * res + y) * res + x];
+            }
+          }
+        }
+        upload(texture_atlas[meta.atlas_index], meta.atlas_origin + start,
+               size, block, meta.quantization);
+      }
+    }
+  }
+
+  std::vector<Meta> &get_offsets() { return this->offsets; }
+  unsigned int get_revision() { return this->revision; }
+  std::vector<Texture3D> &get_texture_atlas() { return this->texture_atlas; }
+  int get_brick_count() { return this->brick_count; }
+  std::optional<Texture> &get_brick_atlas() { return this->brick_atlas; }
+  std::vector<GPUBrickCell> &get_brick_cells() { return this->brick_cells; }
+  SdfAtlasFormat get_format() { return this->format; }
+
+  // what the shader reads for packed sdf index drawn with model
+  GPUObject gpu_object(const mat4 &model, unsigned int index) {
+    auto &p = offsets.at(index);
+    return GPUObject{
+        .model_mat = model,
+        .inv_model_mat = inverse(model),
+        .inner_bbmin = vec4(p.inner_bb.min, 0.0),
+        .inner_bbmax = vec4(p.inner_bb.max, 0.0),
+        .outer_bbmin = vec4(p.outer_bb.min, 0.0),
+        .outer_bbmax = vec4(p.outer_bb.max, 0.0),
+        .atlas_origin = ivec4(p.atlas_origin, p.atlas_index),
+        .brick_cell_offset = p.brick_cell_offset,
+        .resolution = p.size.x,
+        .distance_scale = p.quantization.scale,
+        .distance_bias = p.quantization.bias,
+    };
+  }
+
+  // used part of the dense pages created so far
+  float atlas_occupancy() { return packer.occupancy(); }
+
+  // gpu memory of every atlas texture
+  size_t atlas_memory_bytes() {
+    size_t bytes = sdf_atlas_format_bytes(format);
+    size_t page_bytes = (size_t) ATLAS_SIZE * ATLAS_SIZE * ATLAS_SIZE * bytes;
+    size_t brick_atlas_bytes =
+        brick_atlas.has_value()
+            ? (size_t) BRICK_ATLAS_WIDTH * BRICK_ATLAS_HEIGHT * bytes
+            : 0;
+    return texture_atlas.size() * page_bytes + brick_atlas_bytes +
+           brick_cells.size() * sizeof(GPUBrickCell);
+  }
+
+private:
+  // nullopt when no page has room. Without sdf_data the texture of the
+  // model is copied on the gpu
+  optional<unsigned int> add_dense(SdfModel &sdf_model,
+                                   SdfQuantization quantization,
+                                   const vector<float> *sdf_data) {
+    auto &texture = *sdf_model.texture3D;
+    auto size = ivec3(texture.meta.width, texture.meta.height,
+                      texture.meta.depth);
+    auto allocation = packer.insert(size);
+    if (!allocation) {
+      return nullopt;
+    }
+    while ((int) texture_atlas.size() <= allocation->page) {
+      auto empty = vector<float>();
+      texture_atlas.emplace_back(atlas_meta(), empty);
+    }
 
     offsets.push_back(Meta{
         .size = size,
         .inner_bb = sdf_model.bb,
         .outer_bb = sdf_model.outerBB,
-        .atlas_index = latest_index,
-        .atlas_count = latest_count,
+        .atlas_index = allocation->page,
+        .atlas_origin = allocation->origin,
+        .quantization = quantization,
     });
-
+    if (sdf_data != nullptr) {
+      upload_dense(offsets.back(), *sdf_data);
+    } else {
+      copy_dense(offsets.back(), texture);
+    }
     return offsets.size() - 1;
   }
 
-  std::vector<Meta> &get_offsets() { return this->offsets; }
-  std::vector<Texture> &get_texture_atlas() { return this->texture_atlas; }
+  // Range every distance of the sdf falls in, without looking at them.
+  // Inside the mesh the surface is never further than the nearest face of
+  // its bounding box, outside never further than the diagonal of the sdf
+  // box. Wider than sdf_quantization, so a bit less precise.
+  static SdfQuantization bounded_quantization(SdfModel &sdf_model) {
+    vec3 inner_size = sdf_model.bb.getSize();
+    float inside =
+        0.5f * std::min(inner_size.x, std::min(inner_size.y, inner_size.z));
+    float outside = length(sdf_model.outerBB.getSize());
+    float scale = (inside + outside) / 2.0f;
+    return SdfQuantization{
+        .scale = scale > 0.0f ? scale : 1.0f,
+        .bias = (outside - inside) / 2.0f,
+    };
+  }
+
+  // gpu to gpu, float pages take a straight image copy, snorm pages go
+  // through sdf_atlas_insert.cs which quantizes on the way
+  void copy_dense(Meta &meta, Texture3D &source) {
+    auto &page = texture_atlas[meta.atlas_index];
+    ivec3 origin = meta.atlas_origin;
+    if (format == SdfAtlasFormat::F32 &&
+        source.meta.internal_format == GL_R32F) {
+      glCopyImageSubData(source.id, GL_TEXTURE_3D, 0, 0, 0, 0, page.id,
+                         GL_TEXTURE_3D, 0, origin.x, origin.y, origin.z,
+                         meta.size.x, meta.size.y, meta.size.z);
+      return;
+    }
+
+    if (!insert_shader.has_value()) {
+      insert_shader.emplace(
+          afs::root("resources/shaders/sdf/sdf_atlas_insert.cs"));
+    }
+    insert_shader->use();
+    insert_shader->setInt("source", 0);
+    insert_shader->setIVec3("origin", origin);
+    auto q = meta.quantization;
+    insert_shader->setVec2("scaleBias", vec2(q.scale, q.bias));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, source.id);
+    glBindImageTexture(0, page.id, 0, GL_TRUE, 0, GL_WRITE_ONLY,
+                       page.meta.internal_format);
+    int groups = (meta.size.x + 7) / 8;
+    insert_shader->execute(groups, groups, groups,
+                           GL_TEXTURE_FETCH_BARRIER_BIT |
+                               GL_TEXTURE_UPDATE_BARRIER_BIT);
+  }
+
+  // grows the object ssbo to hold at least count objects
+  void reserve_objects(int count) {
+    if (count <= ssbo_capacity) {
+      return;
+    }
+    ssbo_capacity = std::max(count, ssbo_capacity * 2);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 sizeof(unsigned int) * 4 + sizeof(GPUObject) * ssbo_capacity,
+                 nullptr, GL_STATIC_DRAW);
+  }
+
+  // one dense page, filtered by the hardware in all three axes
+  Texture3D::Meta atlas_meta() {
+    auto meta = Texture3D::Meta{
+        .width = ATLAS_SIZE,
+        .height = ATLAS_SIZE,
+        .depth = ATLAS_SIZE,
+        .internal_format = GL_R32F,
+        .input_format = GL_RED,
+        .input_type = GL_FLOAT,
+    };
+    if (format == SdfAtlasFormat::SNORM16) {
+      meta.internal_format = GL_R16_SNORM;
+      meta.input_type = GL_SHORT;
+    } else if (format == SdfAtlasFormat::SNORM8) {
+      meta.internal_format = GL_R8_SNORM;
+      meta.input_type = GL_BYTE;
+    }
+    return meta;
+  }
+
+  // sampled with texelFetch, bricks do their own interpolation
+  Texture::Meta brick_atlas_meta() {
+    auto meta = Texture::Meta{
+        .width = BRICK_ATLAS_WIDTH,
+        .height = BRICK_ATLAS_HEIGHT,
+        .internal_format = GL_R32F,
+        .input_format = GL_RED,
+        .input_type = GL_FLOAT,
+        .min_filter = GL_NEAREST,
+        .max_filter = GL_NEAREST,
+    };
+    if (format == SdfAtlasFormat::SNORM16) {
+      meta.internal_format = GL_R16_SNORM;
+      meta.input_type = GL_SHORT;
+    } else if (format == SdfAtlasFormat::SNORM8) {
+      meta.internal_format = GL_R8_SNORM;
+      meta.input_type = GL_BYTE;
+    }
+    return meta;
+  }
+
+  // distances are encoded into the atlas format on the cpu, so only the
+  // quantized bytes are sent
+  void upload(Texture &texture, int xoffset, int yoffset, int width,
+              int height, vector<float> &distances, SdfQuantization q) {
+    switch (format) {
+      case SdfAtlasFormat::F32:
+        texture.partial_replace_data_f32(xoffset, yoffset, width, height,
+                                         distances);
+        break;
+      case SdfAtlasFormat::SNORM16: {
+        auto encoded = encode_snorm<int16_t>(distances, q);
+        texture.partial_replace_data(xoffset, yoffset, width, height,
+                                     encoded.data());
+        break;
+      }
+      case SdfAtlasFormat::SNORM8: {
+        auto encoded = encode_snorm<int8_t>(distances, q);
+        texture.partial_replace_data(xoffset, yoffset, width, height,
+                                     encoded.data());
+        break;
+      }
+    }
+  }
+
+  void upload(Texture3D &texture, ivec3 offset, ivec3 size,
+              const vector<float> &distances, SdfQuantization q) {
+    switch (format) {
+      case SdfAtlasFormat::F32:
+        texture.partial_replace_data(offset, size, distances.data());
+        break;
+      case SdfAtlasFormat::SNORM16: {
+        auto encoded = encode_snorm<int16_t>(distances, q);
+        texture.partial_replace_data(offset, size, encoded.data());
+        break;
+      }
+      case SdfAtlasFormat::SNORM8: {
+        auto encoded = encode_snorm<int8_t>(distances, q);
+        texture.partial_replace_data(offset, size, encoded.data());
+        break;
+      }
+    }
+  }
+
+  // the distances are laid out like the page, so they go in as one box
+  void upload_dense(Meta &meta, const vector<float> &sdf_data) {
+    upload(texture_atlas[meta.atlas_index], meta.atlas_origin, meta.size,
+           sdf_data, meta.quantization);
+  }
+
+  // brick is laid out like a Texture3D, it goes in as a 64x8 block
+  void upload_brick(int atlas_brick, const float *brick, SdfQuantization q) {
+    const int brick_width = SDF_BRICK_SIZE * SDF_BRICK_SIZE;
+    auto block = vector<float>(brick_width * SDF_BRICK_SIZE);
+    for (int z = 0; z < SDF_BRICK_SIZE; ++z) {
+      for (int y = 0; y < SDF_BRICK_SIZE; ++y) {
+        for (int x = 0; x < SDF_BRICK_SIZE; ++x) {
+          block[y * brick_width + z * SDF_BRICK_SIZE + x] =
+              brick[(z * SDF_BRICK_SIZE + y) * SDF_BRICK_SIZE + x];
+        }
+      }
+    }
+    upload(*brick_atlas, (atlas_brick % BRICKS_PER_ROW) * brick_width,
+           (atlas_brick / BRICKS_PER_ROW) * SDF_BRICK_SIZE, brick_width,
+           SDF_BRICK_SIZE, block, q);
+  }
+
+  // cells keep their brick once they have one, cells that now need one get
+  // a new brick at the end of the atlas
+  void update_bricked(Meta &meta, const vector<float> &distances,
+                      const vector<ivec3> &tiles) {
+    int res = meta.size.x;
+    auto bricked = SdfBricked(distances, res, meta.outer_bb);
+    auto brick = vector<float>(SDF_BRICK_VOXELS);
+    for (auto tile: tiles) {
+      int cell = (tile.z * bricked.grid_size + tile.y) * bricked.grid_size +
+                 tile.x;
+      auto &gpu_cell = brick_cells[meta.brick_cell_offset + cell];
+      gpu_cell.distance = bricked.far_distances[cell];
+      if (gpu_cell.brick_index == SdfBricked::EMPTY_CELL) {
+        if (bricked.cells[cell] == SdfBricked::EMPTY_CELL) {
+          continue;
+        }
+        if (brick_count >= BRICKS_MAX_SIZE) {
+          throw std::runtime_error("brick atlas is full");
+        }
+        gpu_cell.brick_index = brick_count++;
+      }
+
+      ivec3 start = tile * SDF_BRICK_SIZE;
+      for (int z = 0; z < SDF_BRICK_SIZE; ++z) {
+        for (int y = 0; y < SDF_BRICK_SIZE; ++y) {
+          for (int x = 0; x < SDF_BRICK_SIZE; ++x) {
+            ivec3 v = min(start + ivec3(x, y, z), ivec3(res - 1));
+            brick[(z * SDF_BRICK_SIZE + y) * SDF_BRICK_SIZE + x] =
+                distances[(v.z * res + v.y) * res + v.x];
+          }
+        }
+      }
+      upload_brick(gpu_cell.brick_index, brick.data(), meta.quantization);
+    }
+
+    int cell_count = bricked.cells.size();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, brick_cell_ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                    meta.brick_cell_offset * sizeof(GPUBrickCell),
+                    cell_count * sizeof(GPUBrickCell),
+                    brick_cells.data() + meta.brick_cell_offset);
+  }
+
+  unsigned int add_bricked(SdfModel &sdf_model, SdfBricked &bricked,
+                           SdfQuantization quantization) {
+    if (!brick_atlas.has_value()) {
+      auto empty = vector<float>();
+      brick_atlas.emplace(brick_atlas_meta(), empty);
+      glGenBuffers(1, &brick_cell_ssbo);
+    }
+
+    for (int b = 0; b < bricked.brick_count(); ++b) {
+      upload_brick(brick_count + b,
+                   bricked.bricks.data() + b * SDF_BRICK_VOXELS, quantization);
+    }
+
+    int cell_offset = brick_cells.size();
+    for (int i = 0; i < bricked.cells.size(); ++i) {
+      int brick = bricked.cells[i];
+      brick_cells.push_back(GPUBrickCell{
+          .brick_index =
+              brick == SdfBricked::EMPTY_CELL ? brick : brick_count + brick,
+          .distance = bricked.far_distances[i],
+      });
+    }
+    brick_count += bricked.brick_count();
+
+    // only happens on load, so the whole cell buffer is uploaded again
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, brick_cell_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 brick_cells.size() * sizeof(GPUBrickCell), brick_cells.data(),
+                 GL_STATIC_DRAW);
+
+    offsets.push_back(Meta{
+        .size = ivec3(bricked.resolution),
+        .inner_bb = sdf_model.bb,
+        .outer_bb = sdf_model.outerBB,
+        .atlas_index = -1,
+        .atlas_origin = ivec3(0),
+        .brick_cell_offset = cell_offset,
+        .quantization = quantization,
+    });
+
+    return offsets.size() - 1;
+  }
 };
 
 } // namespace ale::graphics::sdf
@@ -0,0 +1,75 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+export module graphics:sdf.sdf_quantize;
+
+using namespace std;
+
+export namespace ale::graphics::sdf {
+
+enum class SdfAtlasFormat {
+  F32, // GL_R32F, 4 bytes per voxel
+  SNORM16, // GL_R16_SNORM, 2 bytes per voxel
+  SNORM8, // GL_R8_SNORM, 1 byte per voxel
+};
+
+// distance = normalized * scale + bias, normalized is in [-1, 1]
+struct SdfQuantization {
+  float scale = 1.0f;
+  float bias = 0.0f;
+};
+
+// maps the range of distances onto [-1, 1]
+SdfQuantization sdf_quantization(const vector<float> &distances) {
+  if (distances.empty()) {
+    return SdfQuantization{};
+  }
+  auto [min_it, max_it] = minmax_element(distances.begin(), distances.end());
+  float scale = (*max_it - *min_it) / 2.0f;
+  return SdfQuantization{
+      .scale = scale > 0.0f ? scale : 1.0f,
+      .bias = (*max_it + *min_it) / 2.0f,
+  };
+}
+
+// T is int16_t or int8_t, rounds the same way gl converts floats to snorm
+template <typename T>
+vector<T> encode_snorm(const vector<float> &distances, SdfQuantization q) {
+  constexpr float max_value = numeric_limits<T>::max();
+  auto encoded = vector<T>(distances.size());
+  for (int i = 0; i < distances.size(); ++i) {
+    float normalized =
+        std::clamp((distances[i] - q.bias) / q.scale, -1.0f, 1.0f);
+    encoded[i] = T(round(normalized * max_value));
+  }
+  return encoded;
+}
+
+// what the shader sees after sampling and applying scale/bias
+template <typename T>
+vector<float> decode_snorm(const vector<T> &encoded, SdfQuantization q) {
+  constexpr float max_value = numeric_limits<T>::max();
+  auto distances = vector<float>(encoded.size());
+  for (int i = 0; i < encoded.size(); ++i) {
+    distances[i] = std::max(encoded[i] / max_value, -1.0f) * q.scale + q.bias;
+  }
+  return distances;
+}
+
+int sdf_atlas_format_bytes(SdfAtlasFormat format) {
+  switch (format) {
+    case SdfAtlasFormat::SNORM16:
+      return 2;
+    case SdfAtlasFormat::SNORM8:
+      return 1;
+    default:
+      return 4;
+  }
+}
+
+} // namespace ale::graphics::sdf
@@ -0,0 +1,318 @@
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// clang-format off
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+// clang-format on
+
+export module graphics:sdf.sdf_renderer_cpu;
+import data;
+import :sdf.sdf_bricked;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+
+export namespace ale::graphics::sdf {
+
+// rgba, row 0 is the top of the image
+struct SdfImage {
+  int width = 0;
+  int height = 0;
+  vector<vec4> pixels;
+
+  vec4 &at(int x, int y) { return pixels[y * width + x]; }
+
+  // 8 bits per channel, clamped to [0, 1]
+  bool save_png(const string &path) const {
+    auto bytes = vector<unsigned char>(pixels.size() * 4);
+    for (int i = 0; i < pixels.size(); ++i) {
+      for (int c = 0; c < 4; ++c) {
+        bytes[i * 4 + c] = (unsigned char) std::round(
+            std::clamp(pixels[i][c], 0.0f, 1.0f) * 255.0f);
+      }
+    }
+    return stbi_write_png(path.c_str(), width, height, 4, bytes.data(),
+                          width * 4) != 0;
+  }
+
+  // radiance hdr, keeps the floats unclamped
+  bool save_hdr(const string &path) const {
+    return stbi_write_hdr(path.c_str(), width, height, 4,
+                          &pixels.data()->x) != 0;
+  }
+
+  // largest difference of any channel, infinity when the sizes differ
+  static float max_difference(const SdfImage &a, const SdfImage &b) {
+    if (a.width != b.width || a.height != b.height) {
+      return INFINITY;
+    }
+    float difference = 0.0f;
+    for (int i = 0; i < a.pixels.size(); ++i) {
+      vec4 d = abs(a.pixels[i] - b.pixels[i]);
+      difference = std::max(difference, std::max(std::max(d.x, d.y),
+                                                  std::max(d.z, d.w)));
+    }
+    return difference;
+  }
+};
+
+struct SdfRenderSettings {
+  vec3 light_dir = normalize(vec3(-0.4f, -1.0f, -0.3f)); // light travels
+  float ambient = 0.2f;
+  // march again from every hit towards the light
+  bool shadows = true;
+  float max_trace_distance = 100.0f;
+};
+
+// Raymarches sdfs on the cpu into an SdfImage. No gl calls are made, so it
+// runs without a window or context and can check what the shaders draw.
+// The image is cut into TILE_SIZE^2 tiles handed to the workers through a
+// shared counter. Every tile is traced as one packet: the planes through
+// its corner rays bound all of its rays, so objects outside of them are
+// dropped once per tile instead of being tested by every ray.
+class SdfRendererCpu {
+public:
+  static constexpr int TILE_SIZE = 8;
+  // same as raymarch() in sdf_atlas_partial.fs
+  static constexpr int NUMBER_OF_STEPS = 128;
+  static constexpr float MINIMUM_HIT_DISTANCE = 0.001f;
+  static inline const vec3 NO_HIT_COLOR = vec3(0.52f, 0.8f, 0.92f);
+  static inline const vec3 SDF_COLOR = vec3(0.89f, 0.89f, 0.56f);
+
+  struct Object {
+    mat4 model_mat;
+    // local space sdf, SdfBricked with an infinite band keeps every voxel
+    const SdfBricked *sdf;
+  };
+
+  SdfRendererCpu(int thread_count = thread::hardware_concurrency()) :
+      thread_count(std::max(1, thread_count)) {}
+
+  SdfImage render(const vector<Object> &objects, const mat4 &view,
+                  const mat4 &projection, int width, int height,
+                  SdfRenderSettings settings = {}) {
+    auto scene = vector<SceneObject>();
+    for (auto &object: objects) {
+      scene.push_back(scene_object(object));
+    }
+    // shadow rays leave the packet, they test everything
+    auto all = vector<const SceneObject *>();
+    for (auto &object: scene) {
+      all.push_back(&object);
+    }
+
+    auto image = SdfImage{width, height, vector<vec4>(width * height)};
+    mat4 inv_view_proj = inverse(projection * view);
+    vec3 eye = vec3(inverse(view)[3]);
+    auto ray_dir = [&](float x, float y) {
+      vec2 uv = vec2(x / width * 2.0f - 1.0f, 1.0f - y / height * 2.0f);
+      vec4 end = inv_view_proj * vec4(uv, 0.0f, 1.0f);
+      return normalize(vec3(end) / end.w - eye);
+    };
+
+    int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    int tile_count = tiles_x * tiles_y;
+    atomic<int> next = 0;
+    auto worker = [&]() {
+      auto candidates = vector<const SceneObject *>();
+      for (int tile = next++; tile < tile_count; tile = next++) {
+        ivec2 start = ivec2(tile % tiles_x, tile / tiles_x) * TILE_SIZE;
+        ivec2 end = min(start + TILE_SIZE, ivec2(width, height));
+
+        vec3 corners[4] = {
+            ray_dir(start.x, start.y), ray_dir(end.x, start.y),
+            ray_dir(end.x, end.y), ray_dir(start.x, end.y)};
+        vec3 center = normalize(corners[0] + corners[2]);
+        candidates.clear();
+        for (auto &object: scene) {
+          if (in_packet(object, eye, corners, center)) {
+            candidates.push_back(&object);
+          }
+        }
+
+        for (int y = start.y; y < end.y; ++y) {
+          for (int x = start.x; x < end.x; ++x) {
+            vec3 dir = ray_dir(x + 0.5f, y + 0.5f);
+            image.at(x, y) = shade(candidates, all, eye, dir, settings);
+          }
+        }
+      }
+    };
+
+    // the workers join at the end of the block, before image is returned
+    {
+      auto workers = vector<jthread>();
+      for (int i = 1; i < std::min(thread_count, tile_count); ++i) {
+        workers.emplace_back(worker);
+      }
+      worker();
+    }
+    return image;
+  }
+
+private:
+  int thread_count;
+
+  struct SceneObject {
+    mat4 inv_model_mat;
+    BoundingBox world_bb; // of the sdf box
+    const SdfBricked *sdf;
+  };
+
+  static SceneObject scene_object(const Object &object) {
+    auto &bb = object.sdf->outer_bb;
+    vec3 world_min = vec3(INFINITY);
+    vec3 world_max = vec3(-INFINITY);
+    for (int i = 0; i < 8; ++i) {
+      vec3 corner = vec3(i & 1 ? bb.max.x : bb.min.x,
+                         i & 2 ? bb.max.y : bb.min.y,
+                         i & 4 ? bb.max.z : bb.min.z);
+      vec3 world = vec3(object.model_mat * vec4(corner, 1.0f));
+      world_min = min(world_min, world);
+      world_max = max(world_max, world);
+    }
+    return SceneObject{
+        .inv_model_mat = inverse(object.model_mat),
+        .world_bb = BoundingBox(world_min, world_max),
+        .sdf = object.sdf,
+    };
+  }
+
+  // false when the box is fully outside one of the four planes through
+  // neighbouring corner rays
+  static bool in_packet(const SceneObject &object, vec3 eye,
+                        const vec3 (&corners)[4], vec3 center) {
+    for (int i = 0; i < 4; ++i) {
+      vec3 normal = cross(corners[i], corners[(i + 1) % 4]);
+      if (dot(normal, center) < 0.0f) {
+        normal = -normal;
+      }
+      // the box corner furthest along the normal
+      vec3 furthest = mix(object.world_bb.min, object.world_bb.max,
+                          vec3(greaterThan(normal, vec3(0.0f))));
+      if (dot(normal, furthest - eye) < 0.0f) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static float box_distance(vec3 p, const BoundingBox &bb) {
+    vec3 d = max(p - bb.max, bb.min - p);
+    return length(max(d, 0.0f)) + std::min(std::max(d.x, std::max(d.y, d.z)),
+                                            0.0f);
+  }
+
+  // world space distance along dir, scaled like get_scale_factor in
+  // sdf_atlas_partial.fs
+  static float scene_distance(const vector<const SceneObject *> &objects,
+                              vec3 p, vec3 dir) {
+    float closest = INFINITY;
+    for (auto object: objects) {
+      vec3 local = vec3(object->inv_model_mat * vec4(p, 1.0f));
+      // outside the box both the box and the sdf at the closest point of
+      // the box minus the way there are lower bounds, the second one keeps
+      // rays on the box from counting as hits
+      auto &bb = object->sdf->outer_bb;
+      float dist = box_distance(local, bb);
+      float sdf = object->sdf->sample(clamp(local, bb.min, bb.max));
+      dist = dist < 0.0f ? sdf : std::max(dist, sdf - dist);
+      float scale = length(mat3(object->inv_model_mat) * dir) + 0.00001f;
+      closest = std::min(closest, dist / scale);
+    }
+    return closest;
+  }
+
+  // t of the first hit, or nullopt
+  static optional<float> march(const vector<const SceneObject *> &objects,
+                               vec3 origin, vec3 dir, float max_t) {
+    float t = 0.0f;
+    for (int i = 0; i < NUMBER_OF_STEPS && t < max_t; ++i) {
+      float dist = scene_distance(objects, origin + dir * t, dir);
+      if (dist < MINIMUM_HIT_DISTANCE) {
+        return t;
+      }
+      t += dist;
+    }
+    return nullopt;
+  }
+
+  static vec3 normal_at(const vector<const SceneObject *> &objects, vec3 p,
+                        vec3 dir) {
+    constexpr float EPSILON = 0.001f;
+    vec3 normal;
+    for (int axis = 0; axis < 3; ++axis) {
+      vec3 offset = vec3(0.0f);
+      offset[axis] = EPSILON;
+      normal[axis] = scene_distance(objects, p + offset, dir) -
+                     scene_distance(objects, p - offset, dir);
+    }
+    return length(normal) > 0.0f ? normalize(normal) : -dir;
+  }
+
+  static vec4 shade(const vector<const SceneObject *> &objects,
+                    const vector<const SceneObject *> &all, vec3 eye,
+                    vec3 dir, const SdfRenderSettings &settings) {
+    // rays missing every box of the packet skip the march
+    float enter = INFINITY;
+    float exit = 0.0f;
+    for (auto object: objects) {
+      if (auto span = box_span(object->world_bb, eye, dir)) {
+        enter = std::min(enter, span->x);
+        exit = std::max(exit, span->y);
+      }
+    }
+    if (enter == INFINITY) {
+      return vec4(NO_HIT_COLOR, 1.0f);
+    }
+
+    exit = std::min(exit, settings.max_trace_distance);
+    vec3 origin = eye + dir * enter;
+    auto t = march(objects, origin, dir, exit - enter);
+    if (!t.has_value()) {
+      return vec4(NO_HIT_COLOR, 1.0f);
+    }
+
+    vec3 hit = origin + dir * *t;
+    vec3 normal = normal_at(objects, hit, dir);
+    vec3 to_light = -normalize(settings.light_dir);
+    float diffuse = std::max(dot(normal, to_light), 0.0f);
+    if (settings.shadows && diffuse > 0.0f) {
+      vec3 shadow_origin = hit + normal * (MINIMUM_HIT_DISTANCE * 10.0f);
+      if (march(all, shadow_origin, to_light,
+                settings.max_trace_distance)) {
+        diffuse = 0.0f;
+      }
+    }
+    return vec4(SDF_COLOR * (settings.ambient + diffuse), 1.0f);
+  }
+
+  // t where the ray enters and leaves bb, enter is 0 when it starts inside
+  static optional<vec2> box_span(const BoundingBox &bb, vec3 origin,
+                                 vec3 dir) {
+    vec3 t1 = (bb.min - origin) / dir;
+    vec3 t2 = (bb.max - origin) / dir;
+    vec3 t_min = min(t1, t2);
+    vec3 t_max = max(t1, t2);
+    float enter = std::max(std::max(t_min.x, t_min.y), std::max(t_min.z, 0.0f));
+    float exit = std::min(t_max.x, std::min(t_max.y, t_max.z));
+    if (enter > exit) {
+      return nullopt;
+    }
+    return vec2(enter, exit);
+  }
+};
+
+} // namespace ale::graphics::sdf
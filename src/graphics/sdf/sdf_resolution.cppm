@@ -0,0 +1,67 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <vector>
+
+export module graphics:sdf.sdf_resolution;
+import data;
+import :mesh;
+import :sdf.sdf_bricked;
+
+using namespace std;
+using namespace glm;
+using namespace ale::data;
+
+export namespace ale::graphics::sdf {
+
+struct SdfResolutionSettings {
+  // largest voxel wanted, in mesh space. Trilinear sampling keeps the
+  // distance error within about half of it
+  float target_voxel_size = 0.05f;
+  // voxels per average triangle edge, flat low poly meshes need few voxels
+  // no matter how big they are
+  float voxels_per_triangle = 1.0f;
+  int min_resolution = 16;
+  int max_resolution = 128;
+};
+
+// Picks the sdf resolution (voxels per axis) of a mesh. The extent asks for
+// target_voxel_size voxels, the triangle density caps that for meshes without
+// much detail. Always a multiple of SDF_BRICK_SIZE.
+int choose_sdf_resolution(Mesh &mesh, SdfResolutionSettings settings = {}) {
+  // same bounding box the sdf is baked in
+  auto outer_bb = mesh.boundingBox.apply_scale(Transform{
+      .scale = vec3(1.1, 1.1, 1.1),
+  });
+  vec3 size = outer_bb.getSize();
+  float extent = std::max(size.x, std::max(size.y, size.z));
+
+  float area = 0.0f;
+  int triangle_count = 0;
+  auto vertex = [&](int i) {
+    return mesh.indices.empty() ? mesh.vertices[i].position
+                                : mesh.vertices[mesh.indices[i]].position;
+  };
+  int index_count =
+      mesh.indices.empty() ? mesh.vertices.size() : mesh.indices.size();
+  for (int i = 0; i + 2 < index_count; i += 3) {
+    vec3 a = vertex(i);
+    area += 0.5f * length(cross(vertex(i + 1) - a, vertex(i + 2) - a));
+    ++triangle_count;
+  }
+
+  float resolution = extent / settings.target_voxel_size;
+  if (triangle_count > 0 && area > 0.0f) {
+    float triangle_size = sqrt(area / triangle_count);
+    resolution = std::min(resolution, extent / triangle_size *
+                                          settings.voxels_per_triangle);
+  }
+
+  int rounded = int(ceil(resolution / SDF_BRICK_SIZE)) * SDF_BRICK_SIZE;
+  return std::clamp(rounded, settings.min_resolution,
+                    settings.max_resolution);
+}
+
+} // namespace ale::graphics::sdf
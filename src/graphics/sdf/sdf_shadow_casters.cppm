@@ -0,0 +1,303 @@
+module;
+
+#include <algorithm>
+#include <entt/entt.hpp>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "src/graphics/gpu_bindings.h"
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
+
+export module graphics:sdf.sdf_shadow_casters;
+import data;
+import :shader;
+import :static_mesh;
+import :world_tracker;
+import :sdf.sdf_instance_bvh;
+import :sdf.sdf_model_packed;
+
+using namespace ale::data;
+using namespace std;
+using namespace glm;
+
+export namespace ale::graphics::sdf {
+
+// Object ssbo of the shadow casting StaticMeshes of a world, kept between
+// frames. Every packed sdf of a caster owns a slot of the buffer that is
+// only rewritten when the Transform or StaticMesh of its entity changes,
+// which a WorldTracker tells, so a static scene uploads nothing.
+// An SdfInstanceBvh over the world boxes of the slots goes along at
+// SDF_SHADOW_BVH_BINDING, refit with the slots that moved.
+class SdfShadowCasters {
+public:
+  SdfShadowCasters() = default;
+  ~SdfShadowCasters() {
+    glDeleteBuffers(1, &ssbo);
+    glDeleteBuffers(1, &bvh_ssbo);
+  }
+
+  SdfShadowCasters(SdfShadowCasters &other) = delete;
+  SdfShadowCasters &operator=(SdfShadowCasters &other) = delete;
+
+  // the moved to casters start over on their next bind, the buffers stay
+  // with the moved from ones
+  SdfShadowCasters(SdfShadowCasters &&other) :
+      tracker(std::move(other.tracker)) {}
+  SdfShadowCasters &operator=(SdfShadowCasters &&other) {
+    tracker = std::move(other.tracker);
+    return *this;
+  }
+
+  // Brings the objects up to date with world and binds them along with the
+  // atlas they sample. Only one SdfModelPacked is supported. The world can
+  // be assigned over (loading a scene) or destroyed before this.
+  // Returns false when nothing casts a shadow yet.
+  bool bind_to_shader(Shader &shader, entt::registry &world,
+                      int atlas_start_index) {
+    sync(world);
+    if (packed == nullptr) {
+      return false;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_OBJECT_BINDING, ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SDF_SHADOW_BVH_BINDING,
+                     bvh_ssbo);
+    packed->bind_textures(shader, atlas_start_index);
+    shader.setInt("sdfBvhNodeCount", (int) bvh.nodes.size());
+    return true;
+  }
+
+  int size() { return objects.size(); }
+
+  // slots as the shader sees them, for the cpu reference (SdfShadowCpu)
+  const vector<SdfModelPacked::GPUObject> &get_objects() { return objects; }
+  const vector<BvhNode> &get_bvh_nodes() { return bvh.nodes; }
+
+private:
+  // count of objects, padded to a vec4 like the shader expects
+  static constexpr int HEADER_BYTES = sizeof(unsigned int) * 4;
+
+  WorldTracker tracker;
+
+  shared_ptr<SdfModelPacked> packed;
+  unsigned int packed_revision = 0;
+
+  vector<SdfModelPacked::GPUObject> objects;
+  vector<entt::entity> slot_owner;
+  unordered_map<entt::entity, vector<int>> casters;
+
+  vector<int> dirty_slots;
+  bool count_dirty = true;
+
+  unsigned int ssbo = 0;
+  int capacity = 0; // objects
+
+  SdfInstanceBvh bvh;
+  vector<BoundingBox> boxes; // world space outer box of every slot
+  vector<float> distance_scales; // SdfInstanceBvh::distance_scale per slot
+  vector<int> dirty_nodes;
+  unsigned int bvh_ssbo = 0;
+  int bvh_capacity = 0; // nodes
+
+  void sync(entt::registry &world) {
+    if (tracker.track(world)) {
+      // the slots belonged to what was there before
+      objects.clear();
+      slot_owner.clear();
+      boxes.clear();
+      distance_scales.clear();
+      casters.clear();
+      dirty_slots.clear();
+      count_dirty = true;
+      packed = nullptr;
+    }
+
+    // a rebake can move the bounding boxes of every object
+    if (packed != nullptr && packed->get_revision() != packed_revision) {
+      packed_revision = packed->get_revision();
+      for (auto &[entity, _]: casters) {
+        tracker.mark_dirty(entity);
+      }
+    }
+
+    for (auto entity: tracker.take_dirty()) {
+      refresh(world, entity);
+    }
+    update_bvh();
+    upload();
+  }
+
+  // rewrites the slots of entity, they only move when the number of
+  // packed sdfs changes or it stops casting
+  void refresh(entt::registry &world, entt::entity entity) {
+    auto indices = vector<unsigned int>();
+    auto model = mat4(1.0f);
+    // destroy signals come before the component is gone
+    if (world.valid(entity) && world.all_of<Transform, StaticMesh>(entity)) {
+      auto &static_mesh = world.get<StaticMesh>(entity);
+      auto [mesh_packed, mesh_indices] = static_mesh.get_model_shadow();
+      if (static_mesh.get_cast_shadow() && mesh_packed != nullptr) {
+        if (packed == nullptr) {
+          packed = mesh_packed;
+          packed_revision = packed->get_revision();
+        } else if (packed != mesh_packed) {
+          throw std::runtime_error(
+              "multiple different sdf model packed not supported");
+        }
+        indices = mesh_indices;
+        model = world.get<Transform>(entity).get_model_matrix();
+      }
+    }
+
+    auto it = casters.find(entity);
+    if (it != casters.end() && it->second.size() != indices.size()) {
+      remove(it->second);
+      casters.erase(it);
+      it = casters.end();
+    }
+    if (indices.empty()) {
+      return;
+    }
+    if (it == casters.end()) {
+      auto slots = vector<int>();
+      for (int i = 0; i < indices.size(); ++i) {
+        slots.push_back(objects.size());
+        objects.emplace_back();
+        slot_owner.push_back(entity);
+        boxes.emplace_back(vec3(0.0f), vec3(0.0f));
+        distance_scales.push_back(0.0f);
+      }
+      it = casters.emplace(entity, std::move(slots)).first;
+      count_dirty = true;
+    }
+
+    auto &slots = it->second;
+    for (int i = 0; i < indices.size(); ++i) {
+      auto &object = objects[slots[i]];
+      object = packed->gpu_object(model, indices[i]);
+      boxes[slots[i]] = BoundingBox(vec3(object.outer_bbmin),
+                                    vec3(object.outer_bbmax))
+                            .transform(model);
+      distance_scales[slots[i]] = SdfInstanceBvh::distance_scale(model);
+      dirty_slots.push_back(slots[i]);
+    }
+  }
+
+  // the last slot fills each hole so the objects stay contiguous
+  void remove(vector<int> slots) {
+    sort(slots.begin(), slots.end(), greater<int>());
+    for (int slot: slots) {
+      int last = objects.size() - 1;
+      if (slot != last) {
+        objects[slot] = objects[last];
+        slot_owner[slot] = slot_owner[last];
+        boxes[slot] = boxes[last];
+        distance_scales[slot] = distance_scales[last];
+        auto &owner_slots = casters.at(slot_owner[slot]);
+        *find(owner_slots.begin(), owner_slots.end(), last) = slot;
+        dirty_slots.push_back(slot);
+      }
+      objects.pop_back();
+      slot_owner.pop_back();
+      boxes.pop_back();
+      distance_scales.pop_back();
+    }
+    count_dirty = true;
+  }
+
+  // slots that came or went rebuild the tree, moved ones are refit into it
+  // until that made it too loose
+  void update_bvh() {
+    if (!count_dirty && bvh.size() == boxes.size()) {
+      sort(dirty_slots.begin(), dirty_slots.end());
+      dirty_slots.erase(unique(dirty_slots.begin(), dirty_slots.end()),
+                        dirty_slots.end());
+      bvh.refit(dirty_slots, boxes, distance_scales, dirty_nodes);
+      if (bvh.degradation() <= SdfInstanceBvh::MAX_DEGRADATION) {
+        return;
+      }
+    }
+
+    bvh.build(boxes, distance_scales);
+    dirty_nodes.resize(bvh.nodes.size());
+    for (int i = 0; i < dirty_nodes.size(); ++i) {
+      dirty_nodes[i] = i;
+    }
+  }
+
+  // only the dirty slots and nodes
+  void upload() {
+    int count = objects.size();
+    if (packed == nullptr) {
+      return;
+    }
+    if (ssbo == 0) {
+      glGenBuffers(1, &ssbo);
+      glGenBuffers(1, &bvh_ssbo);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    if (capacity == 0 || count > capacity) {
+      capacity = std::max({count, capacity * 2, OBJECTS_INITIAL_SIZE});
+      glBufferData(GL_SHADER_STORAGE_BUFFER,
+                   HEADER_BYTES +
+                       sizeof(SdfModelPacked::GPUObject) * capacity,
+                   nullptr, GL_DYNAMIC_DRAW);
+      // a new store starts empty
+      dirty_slots.resize(count);
+      for (int i = 0; i < count; ++i) {
+        dirty_slots[i] = i;
+      }
+      count_dirty = true;
+    }
+
+    if (count_dirty) {
+      unsigned int header[4] = {(unsigned int) count};
+      glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, HEADER_BYTES, header);
+      count_dirty = false;
+    }
+    upload_runs(dirty_slots, count, HEADER_BYTES,
+                sizeof(SdfModelPacked::GPUObject), objects.data());
+
+    int node_count = bvh.nodes.size();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvh_ssbo);
+    if (bvh_capacity == 0 || node_count > bvh_capacity) {
+      bvh_capacity = std::max({node_count, bvh_capacity * 2,
+                               OBJECTS_INITIAL_SIZE * 2});
+      glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(BvhNode) * bvh_capacity,
+                   nullptr, GL_DYNAMIC_DRAW);
+      dirty_nodes.resize(node_count);
+      for (int i = 0; i < node_count; ++i) {
+        dirty_nodes[i] = i;
+      }
+    }
+    upload_runs(dirty_nodes, node_count, 0, sizeof(BvhNode),
+                bvh.nodes.data());
+  }
+
+  // writes the elements of the bound buffer listed in dirty, a run of
+  // neighbours in one call, and clears it. Elements from count on are gone
+  static void upload_runs(vector<int> &dirty, int count, size_t offset,
+                          size_t stride, const void *data) {
+    sort(dirty.begin(), dirty.end());
+    dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+    auto bytes = static_cast<const char *>(data);
+    for (int i = 0; i < dirty.size();) {
+      int first = dirty[i];
+      if (first >= count) {
+        break;
+      }
+      int last = first;
+      while (++i < dirty.size() && dirty[i] == last + 1 && dirty[i] < count) {
+        last = dirty[i];
+      }
+      glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset + stride * first,
+                      stride * (last - first + 1), bytes + stride * first);
+    }
+    dirty.clear();
+  }
+};
+
+} // namespace ale::graphics::sdf
@@ -0,0 +1,322 @@
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <thread>
+#include <vector>
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
+
+export module graphics:sdf.sdf_shadow_cpu;
+import :texture;
+import :sdf.sdf_bricked;
+import :sdf.sdf_model_packed;
+
+using namespace std;
+using namespace glm;
+
+export namespace ale::graphics::sdf {
+
+// what the shadow pass samples, as floats the way the shaders read them:
+// snorm pages hold the normalized values, scale and bias come with the
+// objects
+struct SdfShadowAtlas {
+  // ATLAS_SIZE^3 each, x fastest
+  vector<vector<float>> pages;
+  // BRICK_ATLAS_WIDTH * BRICK_ATLAS_HEIGHT, empty without sparse sdfs
+  vector<float> bricks;
+  vector<SdfModelPacked::GPUBrickCell> brick_cells;
+
+  // reads every page and the brick atlas back from the gpu, a stall and
+  // ATLAS_SIZE^3 floats per page, meant for tests and offline bakes
+  static SdfShadowAtlas read_back(SdfModelPacked &packed) {
+    auto atlas = SdfShadowAtlas{};
+    for (auto &page: packed.get_texture_atlas()) {
+      atlas.pages.push_back(page.retrieve_data_from_gpu());
+    }
+    if (packed.get_brick_atlas().has_value()) {
+      atlas.bricks = packed.get_brick_atlas()->retrieve_data_from_gpu();
+    }
+    atlas.brick_cells = packed.get_brick_cells();
+    return atlas;
+  }
+};
+
+// a shaded point, the ray leaves it like ShadowCalculation does
+struct SdfShadowPoint {
+  vec3 position;
+  vec3 normal;
+};
+
+// Soft shadows of raymarch() in sdf_atlas_partial.fs on the cpu, reading
+// the same objects (SdfModelPacked::gpu_object) and the same atlas data, so
+// shadows can be checked and baked without a window and the algorithm can
+// be changed and timed here before it goes into glsl. Dense pages are
+// filtered like the hardware does, up to its 8 bit filter weights.
+class SdfShadowCpu {
+public:
+  // same as raymarch() in sdf_atlas_partial.fs
+  static constexpr int NUMBER_OF_STEPS = 128;
+  static constexpr float MIN_STEP_DIST = 0.02f;
+  static constexpr float K = 16.0f; // penumbra sharpness
+  // ShadowCalculation moves the origin off the surface and towards the
+  // light by this much
+  static constexpr float SURFACE_OFFSET = 0.05f;
+
+  explicit SdfShadowCpu(SdfShadowAtlas atlas,
+                        int thread_count = thread::hardware_concurrency()) :
+      atlas(std::move(atlas)),
+      thread_count(std::max(1, thread_count)) {}
+
+  explicit SdfShadowCpu(SdfModelPacked &packed,
+                        int thread_count = thread::hardware_concurrency()) :
+      SdfShadowCpu(SdfShadowAtlas::read_back(packed), thread_count) {}
+
+  // Shadow factor of every point for every point light, 1 is fully lit.
+  // Point p and light l end up at p * lights.size() + l. bvh is the
+  // SdfInstanceBvh over objects, without it every object is tested
+  vector<float>
+  shadow_factors(const vector<SdfModelPacked::GPUObject> &objects,
+                 const vector<SdfShadowPoint> &points,
+                 const vector<vec3> &lights,
+                 const vector<BvhNode> &bvh = {}) const {
+    constexpr int CHUNK = 64;
+    int light_count = lights.size();
+    int count = points.size() * light_count;
+    auto factors = vector<float>(count);
+    atomic<int> next = 0;
+    auto worker = [&]() {
+      for (int start = next.fetch_add(CHUNK); start < count;
+           start = next.fetch_add(CHUNK)) {
+        for (int i = start; i < std::min(start + CHUNK, count); ++i) {
+          auto &point = points[i / light_count];
+          factors[i] = shadow_calculation(objects, point.position,
+                                          lights[i % light_count],
+                                          point.normal, bvh);
+        }
+      }
+    };
+
+    // the workers join at the end of the block, before factors is returned
+    {
+      auto workers = vector<jthread>();
+      int chunks = (count + CHUNK - 1) / CHUNK;
+      for (int i = 1; i < std::min(thread_count, chunks); ++i) {
+        workers.emplace_back(worker);
+      }
+      worker();
+    }
+    return factors;
+  }
+
+  // ShadowCalculation in second_pass.fs and basic_renderer.fs
+  float shadow_calculation(const vector<SdfModelPacked::GPUObject> &objects,
+                           vec3 frag_pos, vec3 light_pos, vec3 normal,
+                           const vector<BvhNode> &bvh = {}) const {
+    vec3 light_dir = normalize(light_pos - frag_pos);
+    vec3 origin =
+        frag_pos + normal * SURFACE_OFFSET + light_dir * SURFACE_OFFSET;
+    return raymarch(objects, origin, light_dir,
+                    glm::distance(light_pos, frag_pos), bvh);
+  }
+
+  float raymarch(const vector<SdfModelPacked::GPUObject> &objects,
+                 vec3 origin, vec3 dir, float max_trace_dist,
+                 const vector<BvhNode> &bvh = {}) const {
+    const float max_step_dist =
+        std::max(2.0f, max_trace_dist / NUMBER_OF_STEPS / 2.0f);
+    // the shader works it out every step, it only depends on the ray
+    auto scale_factors = vector<float>(objects.size());
+    for (int j = 0; j < objects.size(); ++j) {
+      scale_factors[j] = length(mat3(objects[j].inv_model_mat) * dir) +
+                         0.00001f;
+    }
+
+    float t = 0.0f;
+    float shadow = 1.0f;
+    vec3 p = origin;
+    for (int i = 0; i < NUMBER_OF_STEPS; ++i) {
+      auto step = Step{.p = p, .scale_factors = scale_factors};
+      if (!bvh.empty()) {
+        bvh_distance(objects, bvh, step);
+      } else {
+        for (int j = 0; j < objects.size(); ++j) {
+          object_distance(objects, j, step);
+        }
+      }
+
+      shadow = std::min(shadow, step.shadow_dist * K / (t + 0.0001f));
+      t += std::clamp(step.closest_dist * 0.5f, MIN_STEP_DIST,
+                      max_step_dist);
+      p = origin + dir * t;
+      if (shadow < 0.0f) {
+        break;
+      }
+      if (glm::distance(p, origin) > max_trace_dist) {
+        break;
+      }
+    }
+    shadow = std::max(shadow, 0.0f);
+    return shadow * shadow * (3.0f - 2.0f * shadow);
+  }
+
+private:
+  SdfShadowAtlas atlas;
+  int thread_count;
+
+  // one raymarch step
+  struct Step {
+    vec3 p;
+    const vector<float> &scale_factors;
+    float closest_dist = 1000000.0f;
+    // only objects p is inside of cast shadows
+    float shadow_dist = 100000.0f;
+  };
+
+  // offset_distance in sdf_atlas_partial.fs
+  void object_distance(const vector<SdfModelPacked::GPUObject> &objects,
+                       int j, Step &step) const {
+    auto &object = objects[j];
+    vec3 local = vec3(object.inv_model_mat * vec4(step.p, 1.0f));
+    vec3 outer_min = vec3(object.outer_bbmin);
+    vec3 outer_max = vec3(object.outer_bbmax);
+
+    float dist = box_distance(local, vec3(object.inner_bbmin),
+                              vec3(object.inner_bbmax));
+    float outer_dist = box_distance(local, outer_min, outer_max);
+    if (outer_dist < 0.0f) {
+      dist = object.brick_cell_offset >= 0
+                 ? distance_from_bricks(object, local)
+                 : distance_from_atlas(object, local) *
+                           object.distance_scale +
+                       object.distance_bias;
+    }
+
+    dist /= step.scale_factors[j];
+    if (outer_dist < 0.0f) {
+      step.shadow_dist = std::min(step.shadow_dist, dist);
+    }
+    step.closest_dist = std::min(step.closest_dist, dist);
+  }
+
+  // bvh_distance in sdf_atlas_partial.fs
+  void bvh_distance(const vector<SdfModelPacked::GPUObject> &objects,
+                    const vector<BvhNode> &bvh, Step &step) const {
+    // bvh_node_distance, bb_min.w shrinks the box distance to what an
+    // object under non-uniform scale can report
+    auto node_distance = [&](int node) {
+      return box_distance(step.p, vec3(bvh[node].bb_min),
+                          vec3(bvh[node].bb_max)) *
+             bvh[node].bb_min.w;
+    };
+
+    int stack[SDF_BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+      int node = stack[--stack_size];
+      if (node_distance(node) > step.closest_dist) {
+        continue;
+      }
+
+      ivec4 data = bvh[node].data;
+      if (data.z > 0) {
+        object_distance(objects, data.x, step);
+      } else if (node_distance(data.x) < node_distance(data.y)) {
+        stack[stack_size++] = data.y;
+        stack[stack_size++] = data.x;
+      } else {
+        stack[stack_size++] = data.x;
+        stack[stack_size++] = data.y;
+      }
+    }
+  }
+
+  static float box_distance(vec3 p, vec3 bb_min, vec3 bb_max) {
+    vec3 d = max(p - bb_max, bb_min - p);
+    return length(max(d, 0.0f)) +
+           std::min(std::max(d.x, std::max(d.y, d.z)), 0.0f);
+  }
+
+  float page_voxel(const vector<float> &page, ivec3 v) const {
+    // clamp to edge, only reached with a weight of 0
+    v = clamp(v, ivec3(0), ivec3(ATLAS_SIZE - 1));
+    return page[((size_t) v.z * ATLAS_SIZE + v.y) * ATLAS_SIZE + v.x];
+  }
+
+  // the trilinear fetch of distance_from_atlas, normalized
+  float distance_from_atlas(const SdfModelPacked::GPUObject &object,
+                            vec3 p) const {
+    int res = object.resolution;
+    vec3 outer_min = vec3(object.outer_bbmin);
+    vec3 outer_max = vec3(object.outer_bbmax);
+    vec3 coord = (p - outer_min) / (outer_max - outer_min) * float(res);
+    coord = clamp(coord, vec3(0.5f), vec3(float(res) - 0.5f));
+
+    // texel centers sit at + 0.5
+    vec3 texel = vec3(ivec3(object.atlas_origin)) + coord - vec3(0.5f);
+    vec3 base = floor(texel);
+    vec3 t = texel - base;
+    ivec3 v = ivec3(base);
+    auto &page = atlas.pages.at(object.atlas_origin.w);
+    float c[8];
+    for (int i = 0; i < 8; ++i) {
+      c[i] = page_voxel(page, v + ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+    }
+    return trilinear(c, t);
+  }
+
+  float brick_voxel(ivec3 v, const SdfModelPacked::GPUObject &object) const {
+    int res = object.resolution;
+    v = clamp(v, ivec3(0), ivec3(res - 1));
+    int grid_size = (res + SDF_BRICK_SIZE - 1) / SDF_BRICK_SIZE;
+    ivec3 cell = v / SDF_BRICK_SIZE;
+    auto &brick_cell =
+        atlas.brick_cells[object.brick_cell_offset +
+                          (cell.z * grid_size + cell.y) * grid_size + cell.x];
+    if (brick_cell.brick_index < 0) {
+      return brick_cell.distance;
+    }
+
+    ivec3 local = v - cell * SDF_BRICK_SIZE;
+    int x = (brick_cell.brick_index % BRICKS_PER_ROW) * SDF_BRICK_SIZE *
+                SDF_BRICK_SIZE +
+            local.z * SDF_BRICK_SIZE + local.x;
+    int y = (brick_cell.brick_index / BRICKS_PER_ROW) * SDF_BRICK_SIZE +
+            local.y;
+    return atlas.bricks[(size_t) y * BRICK_ATLAS_WIDTH + x] *
+               object.distance_scale +
+           object.distance_bias;
+  }
+
+  // same as distance_from_bricks in sdf_atlas_partial.fs
+  float distance_from_bricks(const SdfModelPacked::GPUObject &object,
+                             vec3 p) const {
+    int res = object.resolution;
+    vec3 outer_min = vec3(object.outer_bbmin);
+    vec3 outer_max = vec3(object.outer_bbmax);
+    vec3 coord =
+        (p - outer_min) / (outer_max - outer_min) * float(res) - vec3(0.5f);
+    vec3 base = floor(coord);
+    vec3 t = coord - base;
+    ivec3 v = ivec3(base);
+    float c[8];
+    for (int i = 0; i < 8; ++i) {
+      c[i] = brick_voxel(v + ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1),
+                         object);
+    }
+    return trilinear(c, t);
+  }
+
+  // c is x fastest, then y, then z
+  static float trilinear(const float (&c)[8], vec3 t) {
+    float c00 = mix(c[0], c[1], t.x);
+    float c10 = mix(c[2], c[3], t.x);
+    float c01 = mix(c[4], c[5], t.x);
+    float c11 = mix(c[6], c[7], t.x);
+    return mix(mix(c00, c10, t.y), mix(c01, c11, t.y), t.z);
+  }
+};
+
+} // namespace ale::graphics::sdf
@@ -0,0 +1,136 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <numbers>
+#include <vector>
+#include "src/graphics/sdf/sdf_generator_gpu_v2_shared.h"
+
+export module graphics:sdf.sdf_winding_number;
+import :sdf.sdf_bvh;
+
+using namespace std;
+using namespace glm;
+
+export namespace ale::graphics::sdf {
+
+// Fast generalized winding numbers (Barill et al. 2018) on top of an SdfBvh.
+// Every node keeps the area weighted normal of its triangles as a dipole,
+// nodes far enough from the query point (beta * radius) are evaluated with
+// that instead of descending. Works on meshes with holes and
+// self intersections, anything above 0.5 is inside.
+// The bvh is not owned and has to outlive this.
+class SdfWindingNumber {
+  struct Dipole {
+    vec3 center;
+    vec3 normal; // sum of the triangle area vectors
+    float area;
+    float radius;
+  };
+
+  SdfBvh *bvh;
+  vector<Dipole> dipoles;
+  float beta;
+
+public:
+  SdfWindingNumber(SdfBvh &bvh, float beta = 2.0f) :
+      bvh(&bvh),
+      dipoles(bvh.nodes.size()),
+      beta(beta) {
+    // children are always pushed after their parent, so walking backwards
+    // visits them first
+    for (int n = (int) bvh.nodes.size() - 1; n >= 0; --n) {
+      auto &node = bvh.nodes[n];
+      auto &dipole = dipoles[n];
+      dipole = Dipole{vec3(0.0f), vec3(0.0f), 0.0f, 0.0f};
+      vec3 weighted_center = vec3(0.0f);
+      if (node.data.w != 0) {
+        for (int tri = node.data.x; tri < node.data.x + node.data.z; ++tri) {
+          vec3 a, b, c;
+          triangle(tri, a, b, c);
+          vec3 area_vector = 0.5f * cross(b - a, c - a);
+          float area = length(area_vector);
+          dipole.normal += area_vector;
+          dipole.area += area;
+          weighted_center += area * (a + b + c) / 3.0f;
+        }
+      } else {
+        for (int child: {node.data.x, node.data.y}) {
+          dipole.normal += dipoles[child].normal;
+          dipole.area += dipoles[child].area;
+          weighted_center += dipoles[child].area * dipoles[child].center;
+        }
+      }
+
+      vec3 bb_min = vec3(node.bb_min);
+      vec3 bb_max = vec3(node.bb_max);
+      dipole.center = dipole.area > 0.0f ? weighted_center / dipole.area
+                                         : (bb_min + bb_max) / 2.0f;
+      // farthest box corner bounds every triangle in the node
+      vec3 corner = max(abs(bb_min - dipole.center), abs(bb_max - dipole.center));
+      dipole.radius = length(corner);
+    }
+  }
+
+  float winding_number(vec3 q) {
+    if (dipoles.empty()) {
+      return 0.0f;
+    }
+
+    float w = 0.0f;
+    int stack[SDF_BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+      int n = stack[--stack_size];
+      auto &node = bvh->nodes[n];
+      auto &dipole = dipoles[n];
+
+      vec3 r = dipole.center - q;
+      float dist = length(r);
+      if (dist > beta * dipole.radius) {
+        w += dot(r, dipole.normal) /
+             (4.0f * numbers::pi_v<float> * dist * dist * dist);
+        continue;
+      }
+
+      if (node.data.w != 0) {
+        for (int tri = node.data.x; tri < node.data.x + node.data.z; ++tri) {
+          vec3 a, b, c;
+          triangle(tri, a, b, c);
+          w += solid_angle(q, a, b, c) / (4.0f * numbers::pi_v<float>);
+        }
+      } else {
+        stack[stack_size++] = node.data.x;
+        stack[stack_size++] = node.data.y;
+      }
+    }
+    return w;
+  }
+
+  bool is_inside(vec3 q) { return winding_number(q) > 0.5f; }
+
+private:
+  void triangle(int tri, vec3 &a, vec3 &b, vec3 &c) {
+    a = vec3(bvh->vertices[bvh->indices[tri * 3]].position);
+    b = vec3(bvh->vertices[bvh->indices[tri * 3 + 1]].position);
+    c = vec3(bvh->vertices[bvh->indices[tri * 3 + 2]].position);
+  }
+
+  // signed solid angle of abc seen from q (Van Oosterom and Strackee)
+  static float solid_angle(vec3 q, vec3 a, vec3 b, vec3 c) {
+    a -= q;
+    b -= q;
+    c -= q;
+    float la = length(a);
+    float lb = length(b);
+    float lc = length(c);
+    float numerator = dot(a, cross(b, c));
+    float denominator =
+        la * lb * lc + dot(a, b) * lc + dot(b, c) * la + dot(c, a) * lb;
+    return 2.0f * atan2(numerator, denominator);
+  }
+};
+
+} // namespace ale::graphics::sdf
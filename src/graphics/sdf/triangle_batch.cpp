@@ -0,0 +1,387 @@
+#include "triangle_batch.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+TriangleBatch::TriangleBatch(const vector<SdfVertex> &vertices,
+                             const vector<unsigned int> &indices) :
+    size(indices.size() / 3) {
+  for (auto &field: fields) {
+    field.resize(size + PADDING, 0.0f);
+  }
+
+  auto set = [&](Field x, int i, vec3 v) {
+    fields[x][i] = v.x;
+    fields[x + 1][i] = v.y;
+    fields[x + 2][i] = v.z;
+  };
+  auto inverse_or_zero = [](float f) { return f > 0.0f ? 1.0f / f : 0.0f; };
+
+  for (int i = 0; i < size; ++i) {
+    vec3 a = vec3(vertices[indices[i * 3]].position);
+    vec3 b = vec3(vertices[indices[i * 3 + 1]].position);
+    vec3 c = vec3(vertices[indices[i * 3 + 2]].position);
+    vec3 ba = b - a;
+    vec3 cb = c - b;
+    vec3 ac = a - c;
+    vec3 nor = cross(ba, ac);
+
+    set(AX, i, a);
+    set(BX, i, b);
+    set(CX, i, c);
+    set(BAX, i, ba);
+    set(CBX, i, cb);
+    set(ACX, i, ac);
+    fields[INV_BA2][i] = inverse_or_zero(dot(ba, ba));
+    fields[INV_CB2][i] = inverse_or_zero(dot(cb, cb));
+    fields[INV_AC2][i] = inverse_or_zero(dot(ac, ac));
+    set(BANX, i, cross(ba, nor));
+    set(CBNX, i, cross(cb, nor));
+    set(ACNX, i, cross(ac, nor));
+    set(NORX, i, nor);
+    fields[INV_NOR2][i] = inverse_or_zero(dot(nor, nor));
+  }
+}
+
+// -- scalar --------------------------------------------------------------
+
+static vec3 load3(const TriangleBatch &batch, TriangleBatch::Field x, int i) {
+  return vec3(batch.get(x)[i], batch.get(TriangleBatch::Field(x + 1))[i],
+              batch.get(TriangleBatch::Field(x + 2))[i]);
+}
+
+static float segment_distance2(vec3 edge, vec3 v, float inv_edge2) {
+  vec3 d = edge * glm::clamp(dot(edge, v) * inv_edge2, 0.0f, 1.0f) - v;
+  return dot(d, d);
+}
+
+// Util::udTriangle squared, reading the precomputed terms
+static float distance2_scalar(const TriangleBatch &batch, vec3 p, int i) {
+  using F = TriangleBatch;
+  vec3 pa = p - load3(batch, F::AX, i);
+  vec3 pb = p - load3(batch, F::BX, i);
+  vec3 pc = p - load3(batch, F::CX, i);
+
+  float s = sign(dot(load3(batch, F::BANX, i), pa)) +
+            sign(dot(load3(batch, F::CBNX, i), pb)) +
+            sign(dot(load3(batch, F::ACNX, i), pc));
+  if (s < 2.0f) {
+    return std::min(
+        std::min(segment_distance2(load3(batch, F::BAX, i), pa,
+                                   batch.get(F::INV_BA2)[i]),
+                 segment_distance2(load3(batch, F::CBX, i), pb,
+                                   batch.get(F::INV_CB2)[i])),
+        segment_distance2(load3(batch, F::ACX, i), pc,
+                          batch.get(F::INV_AC2)[i]));
+  }
+  float t = dot(load3(batch, F::NORX, i), pa);
+  return t * t * batch.get(F::INV_NOR2)[i];
+}
+
+#if ALE_X86
+
+// -- sse -----------------------------------------------------------------
+
+struct Vec3x4 {
+  __m128 x, y, z;
+};
+
+static inline Vec3x4 load3_sse(const TriangleBatch &batch,
+                               TriangleBatch::Field x, int i) {
+  return Vec3x4{_mm_loadu_ps(batch.get(x) + i),
+                _mm_loadu_ps(batch.get(TriangleBatch::Field(x + 1)) + i),
+                _mm_loadu_ps(batch.get(TriangleBatch::Field(x + 2)) + i)};
+}
+
+static inline Vec3x4 sub_sse(Vec3x4 a, Vec3x4 b) {
+  return Vec3x4{_mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y),
+                _mm_sub_ps(a.z, b.z)};
+}
+
+static inline __m128 dot_sse(Vec3x4 a, Vec3x4 b) {
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)),
+                    _mm_mul_ps(a.z, b.z));
+}
+
+static inline __m128 sign_sse(__m128 v) {
+  __m128 zero = _mm_setzero_ps();
+  __m128 one = _mm_set1_ps(1.0f);
+  return _mm_sub_ps(_mm_and_ps(_mm_cmpgt_ps(v, zero), one),
+                    _mm_and_ps(_mm_cmplt_ps(v, zero), one));
+}
+
+static inline __m128 segment_distance2_sse(Vec3x4 edge, Vec3x4 v,
+                                           __m128 inv_edge2) {
+  __m128 t = _mm_mul_ps(dot_sse(edge, v), inv_edge2);
+  t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+  Vec3x4 d = Vec3x4{_mm_sub_ps(_mm_mul_ps(edge.x, t), v.x),
+                    _mm_sub_ps(_mm_mul_ps(edge.y, t), v.y),
+                    _mm_sub_ps(_mm_mul_ps(edge.z, t), v.z)};
+  return dot_sse(d, d);
+}
+
+// squared distances from p to the triangles [i, i + 4)
+static inline __m128 distance2_sse(const TriangleBatch &batch, Vec3x4 p,
+                                   int i) {
+  using F = TriangleBatch;
+  Vec3x4 pa = sub_sse(p, load3_sse(batch, F::AX, i));
+  Vec3x4 pb = sub_sse(p, load3_sse(batch, F::BX, i));
+  Vec3x4 pc = sub_sse(p, load3_sse(batch, F::CX, i));
+
+  __m128 s =
+      _mm_add_ps(_mm_add_ps(sign_sse(dot_sse(load3_sse(batch, F::BANX, i), pa)),
+                            sign_sse(dot_sse(load3_sse(batch, F::CBNX, i), pb))),
+                 sign_sse(dot_sse(load3_sse(batch, F::ACNX, i), pc)));
+
+  __m128 edge = _mm_min_ps(
+      _mm_min_ps(segment_distance2_sse(load3_sse(batch, F::BAX, i), pa,
+                                       _mm_loadu_ps(batch.get(F::INV_BA2) + i)),
+                 segment_distance2_sse(load3_sse(batch, F::CBX, i), pb,
+                                       _mm_loadu_ps(batch.get(F::INV_CB2) + i))),
+      segment_distance2_sse(load3_sse(batch, F::ACX, i), pc,
+                            _mm_loadu_ps(batch.get(F::INV_AC2) + i)));
+
+  __m128 t = dot_sse(load3_sse(batch, F::NORX, i), pa);
+  __m128 face =
+      _mm_mul_ps(_mm_mul_ps(t, t), _mm_loadu_ps(batch.get(F::INV_NOR2) + i));
+
+  __m128 use_edge = _mm_cmplt_ps(s, _mm_set1_ps(2.0f));
+  return _mm_or_ps(_mm_and_ps(use_edge, edge), _mm_andnot_ps(use_edge, face));
+}
+
+static void distances2_sse(const TriangleBatch &batch, vec3 p, int first,
+                           int count, float *out) {
+  Vec3x4 pv = Vec3x4{_mm_set1_ps(p.x), _mm_set1_ps(p.y), _mm_set1_ps(p.z)};
+  alignas(16) float lanes[4];
+  for (int i = 0; i < count; i += 4) {
+    _mm_store_ps(lanes, distance2_sse(batch, pv, first + i));
+    copy_n(lanes, std::min(4, count - i), out + i);
+  }
+}
+
+static float min_distance2_sse(const TriangleBatch &batch, vec3 p, int first,
+                               int count) {
+  Vec3x4 pv = Vec3x4{_mm_set1_ps(p.x), _mm_set1_ps(p.y), _mm_set1_ps(p.z)};
+  __m128 best = _mm_set1_ps(INFINITY);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    best = _mm_min_ps(best, distance2_sse(batch, pv, first + i));
+  }
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, best);
+  float result = std::min(std::min(lanes[0], lanes[1]),
+                          std::min(lanes[2], lanes[3]));
+  for (; i < count; ++i) {
+    result = std::min(result, distance2_scalar(batch, p, first + i));
+  }
+  return result;
+}
+
+// -- avx2 ----------------------------------------------------------------
+
+struct Vec3x8 {
+  __m256 x, y, z;
+};
+
+ALE_TARGET_AVX2
+static inline Vec3x8 load3_avx2(const TriangleBatch &batch,
+                                TriangleBatch::Field x, int i) {
+  return Vec3x8{_mm256_loadu_ps(batch.get(x) + i),
+                _mm256_loadu_ps(batch.get(TriangleBatch::Field(x + 1)) + i),
+                _mm256_loadu_ps(batch.get(TriangleBatch::Field(x + 2)) + i)};
+}
+
+ALE_TARGET_AVX2
+static inline Vec3x8 sub_avx2(Vec3x8 a, Vec3x8 b) {
+  return Vec3x8{_mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y),
+                _mm256_sub_ps(a.z, b.z)};
+}
+
+ALE_TARGET_AVX2
+static inline __m256 dot_avx2(Vec3x8 a, Vec3x8 b) {
+  return _mm256_fmadd_ps(a.z, b.z,
+                         _mm256_fmadd_ps(a.y, b.y, _mm256_mul_ps(a.x, b.x)));
+}
+
+ALE_TARGET_AVX2
+static inline __m256 sign_avx2(__m256 v) {
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1.0f);
+  return _mm256_sub_ps(
+      _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GT_OQ), one),
+      _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), one));
+}
+
+ALE_TARGET_AVX2
+static inline __m256 segment_distance2_avx2(Vec3x8 edge, Vec3x8 v,
+                                            __m256 inv_edge2) {
+  __m256 t = _mm256_mul_ps(dot_avx2(edge, v), inv_edge2);
+  t = _mm256_min_ps(_mm256_max_ps(t, _mm256_setzero_ps()),
+                    _mm256_set1_ps(1.0f));
+  Vec3x8 d = Vec3x8{_mm256_fmsub_ps(edge.x, t, v.x),
+                    _mm256_fmsub_ps(edge.y, t, v.y),
+                    _mm256_fmsub_ps(edge.z, t, v.z)};
+  return dot_avx2(d, d);
+}
+
+// squared distances from p to the triangles [i, i + 8)
+ALE_TARGET_AVX2
+static inline __m256 distance2_avx2(const TriangleBatch &batch, Vec3x8 p,
+                                    int i) {
+  using F = TriangleBatch;
+  Vec3x8 pa = sub_avx2(p, load3_avx2(batch, F::AX, i));
+  Vec3x8 pb = sub_avx2(p, load3_avx2(batch, F::BX, i));
+  Vec3x8 pc = sub_avx2(p, load3_avx2(batch, F::CX, i));
+
+  __m256 s = _mm256_add_ps(
+      _mm256_add_ps(sign_avx2(dot_avx2(load3_avx2(batch, F::BANX, i), pa)),
+                    sign_avx2(dot_avx2(load3_avx2(batch, F::CBNX, i), pb))),
+      sign_avx2(dot_avx2(load3_avx2(batch, F::ACNX, i), pc)));
+
+  __m256 edge = _mm256_min_ps(
+      _mm256_min_ps(
+          segment_distance2_avx2(load3_avx2(batch, F::BAX, i), pa,
+                                 _mm256_loadu_ps(batch.get(F::INV_BA2) + i)),
+          segment_distance2_avx2(load3_avx2(batch, F::CBX, i), pb,
+                                 _mm256_loadu_ps(batch.get(F::INV_CB2) + i))),
+      segment_distance2_avx2(load3_avx2(batch, F::ACX, i), pc,
+                             _mm256_loadu_ps(batch.get(F::INV_AC2) + i)));
+
+  __m256 t = dot_avx2(load3_avx2(batch, F::NORX, i), pa);
+  __m256 face = _mm256_mul_ps(_mm256_mul_ps(t, t),
+                              _mm256_loadu_ps(batch.get(F::INV_NOR2) + i));
+
+  __m256 use_edge = _mm256_cmp_ps(s, _mm256_set1_ps(2.0f), _CMP_LT_OQ);
+  return _mm256_blendv_ps(face, edge, use_edge);
+}
+
+ALE_TARGET_AVX2
+static void distances2_avx2(const TriangleBatch &batch, vec3 p, int first,
+                            int count, float *out) {
+  Vec3x8 pv = Vec3x8{_mm256_set1_ps(p.x), _mm256_set1_ps(p.y),
+                     _mm256_set1_ps(p.z)};
+  alignas(32) float lanes[8];
+  for (int i = 0; i < count; i += 8) {
+    _mm256_store_ps(lanes, distance2_avx2(batch, pv, first + i));
+    copy_n(lanes, std::min(8, count - i), out + i);
+  }
+}
+
+ALE_TARGET_AVX2
+static float min_distance2_avx2(const TriangleBatch &batch, vec3 p, int first,
+                                int count) {
+  Vec3x8 pv = Vec3x8{_mm256_set1_ps(p.x), _mm256_set1_ps(p.y),
+                     _mm256_set1_ps(p.z)};
+  __m256 best = _mm256_set1_ps(INFINITY);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    best = _mm256_min_ps(best, distance2_avx2(batch, pv, first + i));
+  }
+  alignas(32) float lanes[8];
+  _mm256_store_ps(lanes, best);
+  float result = *min_element(lanes, lanes + 8);
+  for (; i < count; ++i) {
+    result = std::min(result, distance2_scalar(batch, p, first + i));
+  }
+  return result;
+}
+
+#endif
+
+// -- dispatch ------------------------------------------------------------
+
+void triangle_distances2(const TriangleBatch &batch, vec3 p, int first,
+                         int count, float *out, SimdLevel level) {
+#if ALE_X86
+  // leaves with a handful of triangles waste most of an 8 wide register
+  if (level == SimdLevel::AVX2 && count > 4) {
+    distances2_avx2(batch, p, first, count, out);
+    return;
+  }
+  if (level != SimdLevel::SCALAR) {
+    distances2_sse(batch, p, first, count, out);
+    return;
+  }
+#endif
+  for (int i = 0; i < count; ++i) {
+    out[i] = distance2_scalar(batch, p, first + i);
+  }
+}
+
+float min_triangle_distance2(const TriangleBatch &batch, vec3 p, int first,
+                             int count, SimdLevel level) {
+#if ALE_X86
+  if (level == SimdLevel::AVX2) {
+    return min_distance2_avx2(batch, p, first, count);
+  }
+  if (level == SimdLevel::SSE) {
+    return min_distance2_sse(batch, p, first, count);
+  }
+#endif
+  float result = INFINITY;
+  for (int i = 0; i < count; ++i) {
+    result = std::min(result, distance2_scalar(batch, p, first + i));
+  }
+  return result;
+}
+
+ClosestTriangle closest_triangle_bvh_batched(
+    vec3 p, const vector<SdfVertex> &vertices,
+    const vector<unsigned int> &indices, const vector<BvhNode> &bvh_nodes,
+    const TriangleBatch &batch, SimdLevel level) {
+  ClosestTriangle best = no_triangle();
+  if (bvh_nodes.empty()) {
+    return best;
+  }
+
+  int stack[SDF_BVH_MAX_DEPTH + 1];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+  float distances2[8];
+  while (stack_size > 0) {
+    const BvhNode &node = bvh_nodes[stack[--stack_size]];
+
+    float box_distance =
+        sqrt(distance2_to_box(p, vec3(node.bb_min), vec3(node.bb_max)));
+    if (box_distance - 0.0001f > best.check_distance)
+      continue;
+
+    if (node.data.w != 0) {
+      for (int chunk = 0; chunk < node.data.z; chunk += 8) {
+        int first = node.data.x + chunk;
+        int count = std::min(8, node.data.z - chunk);
+        triangle_distances2(batch, p, first, count, distances2, level);
+        for (int i = 0; i < count; ++i) {
+          // a triangle only wins with distance - 0.0001 < best check
+          // distance, the rest is slack for the two formulas rounding
+          // differently
+          float bound = best.check_distance * 1.0001f + 0.0002f;
+          if (distances2[i] > bound * bound)
+            continue;
+          int tri = (first + i) * 3;
+          best = closer_triangle(best, p, vec3(vertices[indices[tri]].position),
+                                 vec3(vertices[indices[tri + 1]].position),
+                                 vec3(vertices[indices[tri + 2]].position));
+        }
+      }
+    } else {
+      const BvhNode &left = bvh_nodes[node.data.x];
+      const BvhNode &right = bvh_nodes[node.data.y];
+      float left_distance =
+          distance2_to_box(p, vec3(left.bb_min), vec3(left.bb_max));
+      float right_distance =
+          distance2_to_box(p, vec3(right.bb_min), vec3(right.bb_max));
+      if (left_distance < right_distance) {
+        stack[stack_size++] = node.data.y;
+        stack[stack_size++] = node.data.x;
+      } else {
+        stack[stack_size++] = node.data.x;
+        stack[stack_size++] = node.data.y;
+      }
+    }
+  }
+  return best;
+}
@@ -0,0 +1,66 @@
+#ifndef TRIANGLE_BATCH_H
+#define TRIANGLE_BATCH_H
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "../simd_level.h"
+#include "sdf_generator_gpu_v2_shared.h"
+
+// Triangles as structure of arrays, with every term of Util::udTriangle that
+// does not depend on the query point computed up front. Each array is padded
+// by a full vector width so kernels can read past the last triangle.
+class TriangleBatch {
+public:
+  enum Field {
+    AX, AY, AZ,
+    BX, BY, BZ,
+    CX, CY, CZ,
+    BAX, BAY, BAZ, // b - a
+    CBX, CBY, CBZ, // c - b
+    ACX, ACY, ACZ, // a - c
+    INV_BA2, INV_CB2, INV_AC2, // 1 / dot2(edge), 0 for zero length edges
+    BANX, BANY, BANZ, // cross(ba, nor)
+    CBNX, CBNY, CBNZ, // cross(cb, nor)
+    ACNX, ACNY, ACNZ, // cross(ac, nor)
+    NORX, NORY, NORZ, // cross(ba, ac)
+    INV_NOR2,
+    FIELD_COUNT
+  };
+
+  static constexpr int PADDING = 8;
+
+  int size = 0;
+
+  TriangleBatch() = default;
+  TriangleBatch(const std::vector<SdfVertex> &vertices,
+                const std::vector<unsigned int> &indices);
+
+  const float *get(Field field) const { return fields[field].data(); }
+
+private:
+  std::vector<float> fields[FIELD_COUNT];
+};
+
+// Squared unsigned distance from p to the triangles [first, first + count),
+// written to out[0 .. count).
+void triangle_distances2(const TriangleBatch &batch, glm::vec3 p, int first,
+                         int count, float *out,
+                         SimdLevel level = simd_level());
+
+// Smallest squared unsigned distance from p to the triangles
+// [first, first + count), INFINITY when count is 0.
+float min_triangle_distance2(const TriangleBatch &batch, glm::vec3 p,
+                             int first, int count,
+                             SimdLevel level = simd_level());
+
+// Same result as closest_triangle_bvh, but leaves are first screened with the
+// batch kernels and only triangles that can still win go through the exact
+// (gpu matching) closest point test. batch has to be built from the same
+// reordered vertices/indices as the bvh.
+ClosestTriangle closest_triangle_bvh_batched(
+    glm::vec3 p, const std::vector<SdfVertex> &vertices,
+    const std::vector<unsigned int> &indices,
+    const std::vector<BvhNode> &bvh_nodes, const TriangleBatch &batch,
+    SimdLevel level = simd_level());
+
+#endif // TRIANGLE_BATCH_H
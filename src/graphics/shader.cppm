@@ -6,6 +6,7 @@ module;
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include "shader_common.h"
 
@@ -80,11 +81,13 @@ public:
     if (this == &other)
       return;
     std::swap(this->ID, other.ID);
+    std::swap(this->locations, other.locations);
   }
   Shader &operator=(Shader &&other) noexcept {
     if (this == &other)
       return *this;
     std::swap(this->ID, other.ID);
+    std::swap(this->locations, other.locations);
     return *this;
   }
 
@@ -93,54 +96,62 @@ public:
   // activate the shader
   // ------------------------------------------------------------------------
   void use() { glUseProgram(ID); }
+  // location of a uniform, asked from the driver once per name and kept.
+  // Names the program does not have are kept as -1, which GL ignores
+  // ------------------------------------------------------------------------
+  GLint location(const std::string &name) const {
+    auto it = locations.find(name);
+    if (it == locations.end()) {
+      it = locations.emplace(name, glGetUniformLocation(ID, name.c_str()))
+               .first;
+    }
+    return it->second;
+  }
   // utility uniform functions
   // ------------------------------------------------------------------------
   void setBool(const std::string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int) value);
+    glUniform1i(location(name), (int) value);
   }
   // ------------------------------------------------------------------------
   void setInt(const std::string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(location(name), value);
   }
   // ------------------------------------------------------------------------
   void setFloat(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(location(name), value);
   }
   // ------------------------------------------------------------------------
   void setVec2(const std::string &name, const glm::vec2 &value) const {
-    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform2fv(location(name), 1, &value[0]);
   }
   void setVec2(const std::string &name, float x, float y) const {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+    glUniform2f(location(name), x, y);
   }
   // ------------------------------------------------------------------------
   void setVec3(const std::string &name, const glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform3fv(location(name), 1, &value[0]);
   }
   void setVec3(const std::string &name, float x, float y, float z) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    glUniform3f(location(name), x, y, z);
   }
   // ------------------------------------------------------------------------
   void setVec4(const std::string &name, const glm::vec4 &value) const {
-    glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform4fv(location(name), 1, &value[0]);
   }
   void setVec4(const std::string &name, float x, float y, float z, float w) {
-    glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+    glUniform4f(location(name), x, y, z, w);
   }
   // ------------------------------------------------------------------------
   void setMat2(const std::string &name, const glm::mat2 &mat) const {
-    glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                       &mat[0][0]);
+    glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
   }
   // ------------------------------------------------------------------------
   void setMat3(const std::string &name, const glm::mat3 &mat) const {
-    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                       &mat[0][0]);
+    glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
   }
   // ------------------------------------------------------------------------
   void setMat4(const std::string &name, const glm::mat4 &mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                       &mat[0][0]);
+    glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
   }
   void setTexture2D(const std::string &name, int slot,
                     const GLuint &textureId) const {
@@ -150,6 +161,9 @@ public:
   };
 
 private:
+  // setters are const, filling the cache is not what they change
+  mutable std::unordered_map<std::string, GLint> locations;
+
   // utility function for checking shader compilation/linking errors.
   // ------------------------------------------------------------------------
   void checkCompileErrors(GLuint shader, std::string type, std::string path) {
@@ -0,0 +1,40 @@
+#include "simd_level.h"
+
+static SimdLevel detect_simd_level() {
+#if ALE_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+  __cpuidex(info, 7, 0);
+  bool avx2 = info[1] & (1 << 5);
+  if (os_saves_ymm && avx2) {
+    return SimdLevel::AVX2;
+  }
+#else
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SimdLevel::AVX2;
+  }
+#endif
+  // sse2 is part of x86-64
+  return SimdLevel::SSE;
+#else
+  return SimdLevel::SCALAR;
+#endif
+}
+
+SimdLevel simd_level() {
+  static SimdLevel level = detect_simd_level();
+  return level;
+}
+
+const char *simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::AVX2:
+      return "avx2";
+    case SimdLevel::SSE:
+      return "sse";
+    default:
+      return "scalar";
+  }
+}
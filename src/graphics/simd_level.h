@@ -0,0 +1,28 @@
+#ifndef SIMD_LEVEL_H
+#define SIMD_LEVEL_H
+
+// Picks the widest kernel the cpu runs. Kernel translation units mark their
+// avx2 functions with ALE_TARGET_AVX2 and only call them after checking
+// simd_level(), so the rest of the build stays baseline x86-64.
+#if defined(__x86_64__) || defined(_M_X64)
+#define ALE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// msvc lets every intrinsic through regardless of the /arch flag
+#define ALE_TARGET_AVX2
+#else
+#define ALE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#else
+#define ALE_X86 0
+#endif
+
+enum class SimdLevel { SCALAR, SSE, AVX2 };
+
+// Best kernel supported by this cpu, detected once.
+SimdLevel simd_level();
+
+const char *simd_level_name(SimdLevel level);
+
+#endif // SIMD_LEVEL_H
@@ -1,19 +1,25 @@
 module;
 
+#include <entt/entt.hpp>
+#include <filesystem>
 #include <fstream>
 #include <glad/glad.h>
 #include <memory>
+#include <optional>
 #include <spdlog/spdlog.h>
 #include "nlohmann/json.hpp"
 
 export module graphics:static_mesh;
 import data;
 import :material;
+import :sdf.sdf_baker_cpu;
+import :sdf.sdf_cache;
 import :sdf.sdf_generator_gpu;
 import :sdf.sdf_generator_gpu_v2;
 import :model;
 import :sdf.sdf_model;
 import :sdf.sdf_model_packed;
+import :sdf.sdf_resolution;
 import :texture;
 
 namespace fs = std::filesystem;
@@ -58,8 +64,10 @@ public:
 
   // only use for loading world
   void set_meta(Meta meta) { this->meta = meta; }
+  Meta get_meta() const { return this->meta; }
 
-  shared_ptr<Model> get_model() { return model; }
+  // by reference, render threads read it for every entity every frame
+  const shared_ptr<Model> &get_model() const { return model; }
   pair<shared_ptr<SdfModelPacked>, vector<unsigned int>> get_model_shadow() {
     return make_pair(sdf_model_packed, sdf_model_packed_index);
   }
@@ -83,18 +91,30 @@ const string SM_UNIT_SPHERE = "default_sphere";
 class StaticMeshLoader {
   // SdfGeneratorGPU sdf_generator_gpu;
   SdfGeneratorGPUV2 sdf_generator_gpu_v2;
+  SdfBakerCpu sdf_baker_cpu;
   shared_ptr<SdfModelPacked> packed; // OWNING pointer
+  SdfResolutionSettings sdf_resolution_settings;
+  SdfCache sdf_cache;
   unordered_map<string, StaticMesh> static_meshes;
 
   // refer to static meshes keys
   unordered_map<string, string> alternate_names;
 
+  // what poll_changed_files compares against, by static meshes keys
+  struct WatchedFile {
+    string path;
+    fs::file_time_type write_time;
+  };
+  unordered_map<string, WatchedFile> watched_files;
+
   // stashes
   shared_ptr<Stash<Texture>> texture_stash;
 
 public:
   StaticMeshLoader(const shared_ptr<Stash<Texture>> &texture_stash) :
-      packed(make_shared<SdfModelPacked>(vector<SdfModel *>(), false)),
+      packed(make_shared<SdfModelPacked>(vector<SdfModel *>(), false,
+                                         SdfAtlasFormat::SNORM16)),
+      sdf_cache(afs::root("caches/sdf"), SdfGeneratorGPUV2::VERSION),
       texture_stash(texture_stash) {
     this->load_static_mesh(afs::root("resources/models/default/unit_cube.obj"),
                            {SM_UNIT_CUBE});
@@ -114,34 +134,53 @@ public:
       return it->second;
     }
     auto start_time = std::chrono::high_resolution_clock::now();
-    const int res = 64;
 
     auto model = Model(path);
-    auto indices = vector<unsigned int>();
+    auto resolutions = vector<int>();
+    auto textures = vector<optional<Texture3D>>(model.meshes.size());
+    // cpu copies, the packer and the cache both need them
+    auto distances = vector<vector<float>>(model.meshes.size());
+    auto baked = vector<bool>(model.meshes.size());
+    auto misses = vector<Mesh *>();
+    auto miss_resolutions = vector<int>();
     for (int i = 0; i < model.meshes.size(); ++i) {
-      string name = id + "_" + to_string(i);
+      // the packed meta keeps the resolution, it is also part of the cache
+      // key so changing the settings rebakes
+      int res = choose_sdf_resolution(model.meshes[i], sdf_resolution_settings);
+      SPDLOG_TRACE("{} mesh {} sdf resolution {}", id, i, res);
+      resolutions.push_back(res);
 
-      auto cached = load_cached_sdf(res, name);
+      auto cached = sdf_cache.load(model.meshes[i], res);
       if (cached) {
-        auto sdf_model = SdfModel(model.meshes[i], std::move(*cached), res);
-        auto index = packed->add(sdf_model);
-        indices.push_back(index);
+        textures[i] = sdf_texture(res, *cached);
+        distances[i] = std::move(*cached);
       } else {
-        auto texture = sdf_generator_gpu_v2.generate_gpu(model.meshes[i], res);
-        auto sdf_model = SdfModel(model.meshes[i], std::move(texture), res);
-        auto index = packed->add(sdf_model);
-        indices.push_back(index);
-        this->save_sdf(*sdf_model.texture3D, name);
-
-        // sdf_generator_gpu.add_mesh(name, model.meshes[i], res, res, res);
-        // sdf_generator_gpu.generate_all();
-        //
-        // auto sdf_model =
-        //     SdfModel(model.meshes[i], move(sdf_generator_gpu.at(name)), res);
-        // auto index = packed->add(sdf_model);
-        // indices.push_back(index);
-        //
-        // this->save_sdf(*sdf_model.texture3D, name);
+        baked[i] = true;
+        misses.push_back(&model.meshes[i]);
+        miss_resolutions.push_back(res);
+      }
+    }
+
+    // every mesh that missed the cache is baked in a single dispatch
+    auto generated =
+        sdf_generator_gpu_v2.generate_gpu_batched(misses, miss_resolutions);
+    for (int i = 0, miss = 0; i < model.meshes.size(); ++i) {
+      if (baked[i]) {
+        textures[i] = std::move(generated[miss++]);
+        // the only readback of a load, the cache file needs the distances
+        distances[i] = textures[i]->retrieve_data_from_gpu();
+      }
+    }
+
+    auto indices = vector<unsigned int>();
+    for (int i = 0; i < model.meshes.size(); ++i) {
+      auto sdf_model = SdfModel(model.meshes[i], std::move(*textures[i]),
+                                resolutions[i], std::move(distances[i]));
+      auto index = packed->add(sdf_model, true);
+      indices.push_back(index);
+      if (baked[i]) {
+        sdf_cache.save(model.meshes[i], resolutions[i],
+                       sdf_model.get_distances());
       }
     }
 
@@ -153,6 +192,7 @@ public:
     auto static_mesh =
         StaticMesh{make_shared<Model>(std::move(model)), packed, indices};
     this->static_meshes.emplace(id, static_mesh);
+    this->watched_files[id] = WatchedFile{path, write_time(path)};
 
     for (auto &name: alternate_names) {
       this->alternate_names[name] = id;
@@ -161,6 +201,87 @@ public:
     return static_mesh;
   }
 
+  // Paths of the loaded meshes whose file was written since they were
+  // loaded or last returned here, for reload_static_mesh
+  vector<string> poll_changed_files() {
+    auto changed = vector<string>();
+    for (auto &[id, file]: watched_files) {
+      auto time = write_time(file.path);
+      // gone for now, an editor saving by replacing the file
+      if (time == fs::file_time_type() || time == file.write_time) {
+        continue;
+      }
+      file.write_time = time;
+      changed.push_back(file.path);
+    }
+    return changed;
+  }
+
+  // Loads an already loaded mesh again after it changed on disk. Every mesh
+  // is rebaked against its cached sdf, so only the region around the edit is
+  // recomputed and uploaded. The model is replaced in place and the
+  // StaticMeshes of world drawing it are patched, so whatever tracks the
+  // world (WorldBounds, SdfShadowCasters) sees the new bounds.
+  void reload_static_mesh(string path, entt::registry &world) {
+    string id = afs::from_root(path);
+    auto it = this->static_meshes.find(id);
+    if (it == this->static_meshes.end()) {
+      load_static_mesh(path);
+      return;
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    auto model = it->second.get_model();
+    auto [_, indices] = it->second.get_model_shadow();
+    auto new_model = Model(path);
+    auto users = entities_drawing(world, model.get());
+    if (new_model.meshes.size() != model->meshes.size()) {
+      // packed slots can't be added to StaticMesh copies, start over and
+      // move the entities over to the new one
+      SPDLOG_WARN("{} changed its mesh count, loading it as a new mesh", id);
+      this->static_meshes.erase(it);
+      auto static_mesh = load_static_mesh(path);
+      for (auto entity: users) {
+        world.patch<StaticMesh>(entity, [&](StaticMesh &old) {
+          auto meta = old.get_meta();
+          old = static_mesh;
+          old.set_meta(meta);
+        });
+      }
+      return;
+    }
+
+    for (int i = 0; i < new_model.meshes.size(); ++i) {
+      auto &old_mesh = model->meshes[i];
+      auto &new_mesh = new_model.meshes[i];
+      // keeps the resolution so the packed slot can be patched
+      int res = packed->get_offsets()[indices[i]].size.x;
+      auto old_distances =
+          sdf_cache.load(old_mesh, res).value_or(vector<float>());
+      auto rebake =
+          sdf_baker_cpu.rebake(old_mesh, new_mesh, old_distances, res);
+      packed->update(indices[i], new_mesh.boundingBox, rebake.distances,
+                     rebake.dirty_tiles, rebake.full);
+      sdf_cache.save(new_mesh, res, rebake.distances);
+      SPDLOG_TRACE("{} mesh {} rebaked, full {}, {} dirty tiles", id, i,
+                   rebake.full, rebake.dirty_tiles.size());
+    }
+    // the model is the only owner of its meshes' buffers
+    for (auto &mesh: model->meshes) {
+      mesh.delete_buffers();
+    }
+    *model = std::move(new_model);
+    for (auto entity: users) {
+      world.patch<StaticMesh>(entity);
+    }
+    this->watched_files[id].write_time = write_time(path);
+
+    auto elapsed = std::chrono::high_resolution_clock::now() - start_time;
+    SPDLOG_INFO(
+        "reloaded {}, took {}ms", id,
+        std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+  }
+
   pair<StaticMesh, BasicMaterial>
   load_static_mesh_with_basic_material(string path) {
     auto static_mesh = load_static_mesh(path, {});
@@ -201,61 +322,38 @@ public:
     return this->static_meshes;
   }
 
-private:
-  optional<Texture3D> load_cached_sdf(int res, const string &sdf_name) {
-
-    string sdf_cache_name = this->hash_sdf_name(sdf_name);
-    string sdf_cache_path = afs::root("caches/sdf/" + sdf_cache_name + ".bin");
-
-    // let's escape the name since it's possibe that it's a path
-    auto texture_file = ifstream{}; // open files
-    texture_file.exceptions(std::ifstream::badbit);
-    texture_file.open(sdf_cache_path, std::ios::binary);
-    if (!texture_file.is_open()) {
-      return nullopt;
-    }
-
-    SPDLOG_TRACE("loading {} -> {}", sdf_cache_path, sdf_name);
-
-    texture_file.seekg(0, std::ios::end);
-    std::streamsize filesize = texture_file.tellg();
-    texture_file.seekg(0, std::ios::beg);
-
-    size_t num_floats = filesize / sizeof(float);
-
-    vector<float> texture_data(num_floats);
-    if (texture_file.read(reinterpret_cast<char *>(texture_data.data()),
-                          filesize)) {
-      return Texture3D(Texture3D::Meta{.width = res,
-                                       .height = res,
-                                       .depth = res,
-                                       .internal_format = GL_R32F,
-                                       .input_format = GL_RED,
-                                       .input_type = GL_FLOAT},
-                       texture_data);
-    }
-
-    return nullopt;
+  // only affects meshes loaded afterwards
+  void set_sdf_resolution_settings(SdfResolutionSettings settings) {
+    this->sdf_resolution_settings = settings;
   }
 
-  void save_sdf(Texture3D &sdf, const string &sdf_name) {
-
-    string sdf_cache_name = this->hash_sdf_name(sdf_name);
-    string sdf_cache_path = afs::root("caches/sdf/" + sdf_cache_name + ".bin");
-
-    SPDLOG_TRACE("saving sdf {} -> {}", sdf_name, sdf_cache_path);
+private:
+  // the epoch when the file can't be read
+  static fs::file_time_type write_time(const string &path) {
+    auto error = std::error_code();
+    auto time = fs::last_write_time(path, error);
+    return error ? fs::file_time_type() : time;
+  }
 
-    auto data = sdf.retrieve_data_from_gpu();
-    ofstream out_file(sdf_cache_path, std::ios::binary);
-    out_file.write(reinterpret_cast<const char *>(data.data()),
-                   data.size() * sizeof(float));
-    out_file.close();
+  static vector<entt::entity> entities_drawing(entt::registry &world,
+                                               const Model *model) {
+    auto entities = vector<entt::entity>();
+    for (auto [entity, static_mesh]: world.view<StaticMesh>().each()) {
+      if (static_mesh.get_model().get() == model) {
+        entities.push_back(entity);
+      }
+    }
+    return entities;
   }
 
-  std::string hash_sdf_name(std::string sdf_name) {
-    std::hash<std::string> hasher;
-    size_t hashedValue = hasher(sdf_name);
-    return to_string(hashedValue);
+  Texture3D sdf_texture(int res, vector<float> &distances) {
+    return Texture3D(Texture3D::Meta{.width = res,
+                                     .height = res,
+                                     .depth = res,
+                                     .internal_format = GL_R32F,
+                                     .input_format = GL_RED,
+                                     .input_type = GL_FLOAT},
+                     distances);
   }
 };
 
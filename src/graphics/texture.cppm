@@ -139,6 +139,15 @@ public:
     glBindTexture(GL_TEXTURE_2D, 0);
   }
 
+  // data has to be in meta.input_format / meta.input_type
+  void partial_replace_data(int xoffset, int yoffset, int width, int height,
+                            const void *data) {
+    glBindTexture(GL_TEXTURE_2D, this->id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, xoffset, yoffset, width, height,
+                    meta.input_format, meta.input_type, data);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
   std::vector<float> retrieve_data_from_gpu() {
     unsigned long long element_size = this->meta.width * this->meta.height;
 
@@ -159,8 +168,9 @@ public:
     vector<float> data(element_size);
 
     glBindTexture(GL_TEXTURE_2D, this->id);
-    glGetTexImage(GL_TEXTURE_2D, 0, this->meta.input_format,
-                  this->meta.input_type, data.data());
+    // always read back as floats, normalized formats come back in [-1, 1]
+    glGetTexImage(GL_TEXTURE_2D, 0, this->meta.input_format, GL_FLOAT,
+                  data.data());
     glBindTexture(GL_TEXTURE_2D, 0);
 
     return data;
@@ -261,13 +271,23 @@ public:
     vector<float> data(element_size);
 
     glBindTexture(GL_TEXTURE_3D, this->id);
-    glGetTexImage(GL_TEXTURE_3D, 0, this->meta.input_format,
-                  this->meta.input_type, data.data());
+    // always read back as floats, normalized formats come back in [-1, 1]
+    glGetTexImage(GL_TEXTURE_3D, 0, this->meta.input_format, GL_FLOAT,
+                  data.data());
     glBindTexture(GL_TEXTURE_3D, 0);
 
     return data;
   }
 
+  // data has to be in meta.input_format / meta.input_type, laid out like
+  // the whole texture: x first, then y, then z
+  void partial_replace_data(ivec3 offset, ivec3 size, const void *data) {
+    glBindTexture(GL_TEXTURE_3D, this->id);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, offset.x, offset.y, offset.z, size.x,
+                    size.y, size.z, meta.input_format, meta.input_type, data);
+    glBindTexture(GL_TEXTURE_3D, 0);
+  }
+
   int get_index(int x, int y, int z, int ele_count) {
     return (z * meta.height * meta.width + y * meta.width + x) + ele_count;
   }
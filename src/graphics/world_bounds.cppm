@@ -0,0 +1,99 @@
+module;
+
+#include <entt/entt.hpp>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+
+export module graphics:world_bounds;
+import data;
+import :aabb_tree;
+import :static_mesh;
+import :world_tracker;
+
+using namespace ale::data;
+using namespace std;
+using namespace glm;
+
+export namespace ale::graphics {
+
+// World space boxes of the StaticMeshes of a world in an AabbTree, one
+// proxy per entity around the boxes of all of its meshes moved by its
+// Transform, rotation included. A WorldTracker tells which entities
+// changed, only those are refit on the next sync. The tree is the same for
+// every user of a world, so the renderers and the gizmo of the editor share
+// one instead of keeping a copy each.
+class WorldBounds {
+public:
+  WorldBounds() = default;
+
+  WorldBounds(WorldBounds &other) = delete;
+  WorldBounds &operator=(WorldBounds &other) = delete;
+  WorldBounds(WorldBounds &&other) = default;
+  WorldBounds &operator=(WorldBounds &&other) = default;
+
+  // Brings the tree up to date with world and returns it. The world can be
+  // assigned over (loading a scene) or destroyed before this.
+  const AabbTree<entt::entity> &sync(entt::registry &world) {
+    if (tracker.track(world)) {
+      // the proxies belonged to what was there before
+      tree.clear();
+      proxies.clear();
+    }
+
+    for (auto entity: tracker.take_dirty()) {
+      refresh(world, entity);
+    }
+    return tree;
+  }
+
+  // tight world box of the meshes of entity, false without any
+  static bool world_box(entt::registry &world, entt::entity entity,
+                        BoundingBox &box) {
+    auto model = world.get<StaticMesh>(entity).get_model();
+    if (model == nullptr || model->meshes.empty()) {
+      return false;
+    }
+
+    auto matrix = world.get<Transform>(entity).get_model_matrix();
+    vec3 min = vec3(INFINITY);
+    vec3 max = vec3(-INFINITY);
+    for (auto &mesh: model->meshes) {
+      auto moved = mesh.boundingBox.transform(matrix);
+      min = glm::min(min, moved.min);
+      max = glm::max(max, moved.max);
+    }
+    box = BoundingBox(min, max);
+    return true;
+  }
+
+private:
+  WorldTracker tracker;
+  AabbTree<entt::entity> tree;
+  unordered_map<entt::entity, int> proxies;
+
+  void refresh(entt::registry &world, entt::entity entity) {
+    auto box = BoundingBox(vec3(0.0f), vec3(0.0f));
+    // destroy signals come before the component is gone
+    bool has_box = world.valid(entity) &&
+                   world.all_of<Transform, StaticMesh>(entity) &&
+                   world_box(world, entity, box);
+
+    auto it = proxies.find(entity);
+    if (!has_box) {
+      if (it != proxies.end()) {
+        tree.remove(it->second);
+        proxies.erase(it);
+      }
+      return;
+    }
+
+    if (it == proxies.end()) {
+      proxies.emplace(entity, tree.insert(box, entity));
+    } else {
+      tree.refit(it->second, box);
+    }
+  }
+};
+
+} // namespace ale::graphics
@@ -0,0 +1,119 @@
+module;
+
+#include <entt/entt.hpp>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+export module graphics:world_tracker;
+import data;
+import :static_mesh;
+
+using namespace ale::data;
+using namespace std;
+
+export namespace ale::graphics {
+
+// Entities of a world whose Transform or StaticMesh changed, told by entt
+// signals. The state kept between frames about the StaticMeshes of a world
+// (WorldBounds, SdfShadowCasters) only refreshes these. Components edited
+// in place have to go through registry::patch to be picked up.
+class WorldTracker {
+public:
+  WorldTracker() = default;
+  ~WorldTracker() { disconnect(); }
+
+  WorldTracker(WorldTracker &other) = delete;
+  WorldTracker &operator=(WorldTracker &other) = delete;
+
+  // signals point at this, so a moved to tracker starts over on its next
+  // track and the moved from one lets go of the world
+  WorldTracker(WorldTracker &&other) { other.disconnect(); }
+  WorldTracker &operator=(WorldTracker &&other) {
+    if (this != &other) {
+      disconnect();
+      other.disconnect();
+    }
+
+    return *this;
+  }
+
+  // Listens to world from now on. Returns true when that means starting
+  // over: a different world, or the same one assigned over (loading a
+  // scene). Everything kept about the old world is stale then, and every
+  // entity with a Transform and StaticMesh is dirty. The world can be
+  // destroyed before this.
+  bool track(entt::registry &world) {
+    if (registry == &world && !world_token.expired()) {
+      return false;
+    }
+
+    connect(world);
+    return true;
+  }
+
+  void mark_dirty(entt::entity entity) { dirty.insert(entity); }
+
+  // the entities that changed since the last call
+  unordered_set<entt::entity> take_dirty() { return std::exchange(dirty, {}); }
+
+private:
+  // Lives in the context of a tracked world. The context goes with the
+  // pools, so once the token is gone so are the signals connected to them
+  struct WorldToken {
+    shared_ptr<int> token = make_shared<int>();
+  };
+
+  entt::registry *registry = nullptr;
+  // a world assigned over keeps its address but not its pools
+  weak_ptr<int> world_token;
+  vector<entt::connection> connections;
+  unordered_set<entt::entity> dirty;
+
+  void on_change(entt::registry &, entt::entity entity) {
+    dirty.insert(entity);
+  }
+
+  void connect(entt::registry &world) {
+    disconnect();
+    registry = &world;
+    auto token = world.ctx().find<WorldToken>();
+    if (token == nullptr) {
+      token = &world.ctx().emplace<WorldToken>();
+    }
+    world_token = token->token;
+
+    auto &self = *this;
+    connections = {
+        world.on_construct<Transform>().connect<&WorldTracker::on_change>(
+            self),
+        world.on_update<Transform>().connect<&WorldTracker::on_change>(self),
+        world.on_destroy<Transform>().connect<&WorldTracker::on_change>(self),
+        world.on_construct<StaticMesh>().connect<&WorldTracker::on_change>(
+            self),
+        world.on_update<StaticMesh>().connect<&WorldTracker::on_change>(self),
+        world.on_destroy<StaticMesh>().connect<&WorldTracker::on_change>(
+            self),
+    };
+
+    dirty.clear();
+    for (auto entity: world.view<Transform, StaticMesh>()) {
+      dirty.insert(entity);
+    }
+  }
+
+  void disconnect() {
+    // releasing the signals of a world that is gone would touch freed pools
+    if (!world_token.expired()) {
+      for (auto &connection: connections) {
+        connection.release();
+      }
+    }
+    connections.clear();
+    registry = nullptr;
+    world_token.reset();
+  }
+};
+
+} // namespace ale::graphics